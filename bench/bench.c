@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <regex.h>
+#include <sched.h>
+
+#include "bench.h"
+
+/**
+ * Outline:
+ * 1. parse argv:
+ *  1. <?--list> <?--filter=regex> <?--sizes=a,b,...> <?--reps=n> <?--warmup=n> <?--min-time=s>
+ *     <?--cpu=n, -1 to not pin> <?--json=path> <?--compare=baseline.json> <?--threshold=percent>
+ * 2. pin to one CPU, the one it started on unless --cpu says otherwise;
+ *    threaded kernels (mul_sgemm, on sgemm's tuned thread grid) run unpinned,
+ *    as threads inherit the pin and would all share that one CPU
+ * 3. for each kernel matching the filter, for each of its sizes:
+ *  1. set up an input and run the kernel --warmup times untimed
+ *  2. time runs until there are --reps of them and --min-time has passed
+ *  3. drop the slow outliers, runs more than 3 MADs (scaled median absolute
+ *     deviations) above the median: interrupts, page faults, migrations
+ *  4. print min and median of the rest and the throughput at the median, and
+ *     p99 and max of all the runs: the tail is what the outliers are
+ * 4. --json: write the results, one per line
+ * 5. --compare: match the results to a baseline's --json by kernel and size and
+ *    flag medians more than --threshold slower whose fastest run is still
+ *    slower than the baseline's median; exit with 2 if there are any
+ */
+
+#define MAX_RUNS 100000
+#define MAX_RESULTS 256
+#define MAX_SIZES 16
+
+extern const bench_kernel_t bench_gol, bench_approx_pi_serial;
+extern const bench_kernel_t bench_mul_matrixrow, bench_mul_matrixcol, bench_mul_matrixrow256, bench_mul_standard_mult, bench_mul_sgemm;
+// only built where hpc-lib is installed (see the Makefile)
+extern const bench_kernel_t bench_array __attribute__((weak));
+
+static const bench_kernel_t* kernels[] = {
+  &bench_array, &bench_gol,
+  &bench_mul_matrixrow, &bench_mul_matrixcol, &bench_mul_matrixrow256, &bench_mul_standard_mult, &bench_mul_sgemm,
+  &bench_approx_pi_serial,
+};
+
+typedef struct {
+  bool list;
+  regex_t filter;
+  bool hasFilter;
+  int sizes[MAX_SIZES + 1]; // 0 terminated, sizes[0] == 0 for each kernel's own
+  int reps, warmup;
+  double minTime;
+  int cpu;
+  const char* json;
+  const char* compare;
+  double threshold;
+} info_t;
+
+typedef struct {
+  char kernel[64];
+  char unit[16];
+  int size;
+  int runs, rejected;
+  double min, median, mean; // s, of the runs kept
+  double p99, max;          // s, of all the runs
+  double throughput;        // units of work per s, at the median
+} result_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+void measure(info_t* info, const bench_kernel_t* k, int size, result_t* res);
+void print_result(result_t* res);
+void write_json(const char* path, result_t* results, int count);
+int compare(const char* path, double threshold, result_t* results, int count);
+
+// ------------------------ main ------------------------
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  if(info->list) {
+    for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+      if(kernels[k] == NULL) continue;
+      printf("%-20s %s per run, sizes (%s):", kernels[k]->name, kernels[k]->unit, kernels[k]->sizeName);
+      for(int s = 0; kernels[k]->sizes[s] > 0; s++) printf(" %d", kernels[k]->sizes[s]);
+      printf("\n");
+    }
+    free_info(info);
+    return 0;
+  }
+
+  cpu_set_t pinned, unpinned;
+  sched_getaffinity(0, sizeof(unpinned), &unpinned);
+  if(info->cpu >= 0) {
+    CPU_ZERO(&pinned);
+    CPU_SET(info->cpu, &pinned);
+    if(sched_setaffinity(0, sizeof(pinned), &pinned) != 0) {
+      fprintf(stderr, "Failed to pin to CPU %d\n", info->cpu);
+      exit(1);
+    }
+  }
+
+  printf("%-20s %10s %6s %4s %12s %12s %12s %12s %18s\n", "kernel", "size", "runs", "rej", "min", "median", "p99", "max", "throughput");
+
+  result_t* results = malloc(sizeof(result_t) * MAX_RESULTS);
+  int count = 0;
+  for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    const bench_kernel_t* kernel = kernels[k];
+    if(kernel == NULL || (info->hasFilter && regexec(&info->filter, kernel->name, 0, NULL, 0) != 0)) continue;
+
+    bool unpin = (kernel->threaded && info->cpu >= 0);
+    if(unpin) sched_setaffinity(0, sizeof(unpinned), &unpinned);
+
+    const int* sizes = (info->sizes[0] > 0 ? info->sizes : kernel->sizes);
+    for(int s = 0; sizes[s] > 0 && count < MAX_RESULTS; s++) {
+      measure(info, kernel, sizes[s], &results[count]);
+      print_result(&results[count]);
+      count++;
+    }
+
+    if(unpin) sched_setaffinity(0, sizeof(pinned), &pinned);
+  }
+
+  if(info->json != NULL) write_json(info->json, results, count);
+
+  int regressions = 0;
+  if(info->compare != NULL) regressions = compare(info->compare, info->threshold, results, count);
+
+  free(results);
+  free_info(info);
+
+  return regressions > 0 ? 2 : 0;
+}
+
+// ------------------------ main ------------------------
+
+info_t* parse_args(int argc, char* argv[])
+{
+  info_t* info = calloc(1, sizeof(*info));
+  info->reps = 15;
+  info->warmup = 3;
+  info->threshold = 5.0;
+  info->cpu = sched_getcpu();
+
+  for(int arg = 1; arg < argc; arg++) {
+    char* a = argv[arg];
+    if(strcmp(a, "--list") == 0) info->list = true;
+    else if(strncmp(a, "--filter=", 9) == 0) {
+      if(regcomp(&info->filter, a + 9, REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf(stderr, "Invalid filter '%s'\n", a + 9);
+        exit(1);
+      }
+      info->hasFilter = true;
+    }
+    else if(strncmp(a, "--sizes=", 8) == 0) {
+      int n = 0;
+      for(char* p = a + 8; *p != '\0' && n < MAX_SIZES; p += (*p == ',')) {
+        int size = (int)strtol(p, &p, 10);
+        if(size <= 0 || (*p != ',' && *p != '\0')) {
+          fprintf(stderr, "Invalid sizes '%s'\n", a + 8);
+          exit(1);
+        }
+        info->sizes[n++] = size;
+      }
+      info->sizes[n] = 0;
+    }
+    else if(strncmp(a, "--reps=", 7) == 0) info->reps = atoi(a + 7);
+    else if(strncmp(a, "--warmup=", 9) == 0) info->warmup = atoi(a + 9);
+    else if(strncmp(a, "--min-time=", 11) == 0) info->minTime = atof(a + 11);
+    else if(strncmp(a, "--cpu=", 6) == 0) info->cpu = atoi(a + 6);
+    else if(strncmp(a, "--json=", 7) == 0) info->json = a + 7;
+    else if(strncmp(a, "--compare=", 10) == 0) info->compare = a + 10;
+    else if(strncmp(a, "--threshold=", 12) == 0) info->threshold = atof(a + 12);
+    else {
+      printf("usage: %s <?--list> <?--filter=regex> <?--sizes=a,b,...> <?--reps=n, default=15> <?--warmup=n, default=3>\n"
+             "       <?--min-time=seconds> <?--cpu=n, default=current, -1=no pinning> <?--json=path>\n"
+             "       <?--compare=baseline json> <?--threshold=percent, default=5>\n", argv[0]);
+      free_info(info);
+      exit(0);
+    }
+  }
+
+  if(info->reps < 1) info->reps = 1;
+  if(info->reps > MAX_RUNS) info->reps = MAX_RUNS;
+  if(info->warmup < 0) info->warmup = 0;
+
+  return info;
+}
+
+void free_info(info_t* info)
+{
+  if(info->hasFilter) regfree(&info->filter);
+  free(info);
+}
+
+// ------------------------ measuring ------------------------
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int by_value(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// element q (0..1) of sorted, nearest rank
+static double quantile(const double* sorted, int n, double q)
+{
+  int i = (int)ceil(q * n) - 1;
+  return sorted[i < 0 ? 0 : i >= n ? n - 1 : i];
+}
+
+void measure(info_t* info, const bench_kernel_t* k, int size, result_t* res)
+{
+  double* times = malloc(sizeof(double) * MAX_RUNS);
+
+  void* ctx = k->setup(size);
+  for(int w = 0; w < info->warmup; w++) {
+    k->run(ctx);
+    if(k->fresh) {
+      k->teardown(ctx);
+      ctx = k->setup(size);
+    }
+  }
+
+  int runs = 0;
+  double total = 0.0;
+  while(runs < MAX_RUNS && (runs < info->reps || total < info->minTime)) {
+    double start = now();
+    k->run(ctx);
+    times[runs] = now() - start;
+    total += times[runs++];
+
+    if(k->fresh) {
+      k->teardown(ctx);
+      ctx = k->setup(size);
+    }
+  }
+  k->teardown(ctx);
+
+  qsort(times, runs, sizeof(double), by_value);
+
+  // slow outliers only: a run can be slowed down by the system but not sped up
+  double median = quantile(times, runs, 0.5);
+  double* dev = malloc(sizeof(double) * runs);
+  for(int i = 0; i < runs; i++) dev[i] = fabs(times[i] - median);
+  qsort(dev, runs, sizeof(double), by_value);
+  double mad = 1.4826 * quantile(dev, runs, 0.5);
+  free(dev);
+
+  // at least 1% of the median, or identical runs would reject any difference
+  double cutoff = median + fmax(3.0 * mad, 0.01 * median);
+  int kept = runs;
+  while(kept > 1 && times[kept - 1] > cutoff) kept--;
+
+  double sum = 0.0;
+  for(int i = 0; i < kept; i++) sum += times[i];
+
+  memset(res, 0, sizeof(*res));
+  snprintf(res->kernel, sizeof(res->kernel), "%s", k->name);
+  snprintf(res->unit, sizeof(res->unit), "%s", k->unit);
+  res->size = size;
+  res->runs = kept;
+  res->rejected = runs - kept;
+  res->min = times[0];
+  res->median = quantile(times, kept, 0.5);
+  res->mean = sum / kept;
+  res->p99 = quantile(times, runs, 0.99);
+  res->max = times[runs - 1];
+  res->throughput = k->work(size) / res->median;
+
+  free(times);
+}
+
+// ------------------------ output ------------------------
+
+// secs in s, ms or µs
+static const char* fmt_time(char* buf, size_t n, double secs)
+{
+  if(secs >= 1.0) snprintf(buf, n, "%.3f s", secs);
+  else if(secs >= 1e-3) snprintf(buf, n, "%.3f ms", secs * 1e3);
+  else snprintf(buf, n, "%.3f us", secs * 1e6);
+  return buf;
+}
+
+void print_result(result_t* res)
+{
+  char min[32], median[32], p99[32], max[32], rate[32];
+
+  const char* prefixes[] = { "", "k", "M", "G", "T" };
+  double r = res->throughput;
+  int p = 0;
+  while(r >= 1000.0 && p < 4) {
+    r /= 1000.0;
+    p++;
+  }
+  snprintf(rate, sizeof(rate), "%.3g %s%s/s", r, prefixes[p], res->unit);
+
+  printf("%-20s %10d %6d %4d %12s %12s %12s %12s %18s\n", res->kernel, res->size, res->runs, res->rejected,
+         fmt_time(min, sizeof(min), res->min), fmt_time(median, sizeof(median), res->median),
+         fmt_time(p99, sizeof(p99), res->p99), fmt_time(max, sizeof(max), res->max), rate);
+  fflush(stdout);
+}
+
+static void cpu_model(char* buf, size_t n)
+{
+  snprintf(buf, n, "unknown");
+
+  FILE* file = fopen("/proc/cpuinfo", "r");
+  if(file == NULL) return;
+
+  char line[256];
+  while(fgets(line, sizeof(line), file) != NULL) {
+    char* colon = strchr(line, ':');
+    if(strncmp(line, "model name", 10) == 0 && colon != NULL) {
+      snprintf(buf, n, "%s", colon + 2);
+      buf[strcspn(buf, "\n\"\\")] = '\0';
+      break;
+    }
+  }
+  fclose(file);
+}
+
+void write_json(const char* path, result_t* results, int count)
+{
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    fprintf(stderr, "Failed to write '%s'\n", path);
+    exit(1);
+  }
+
+  char cpu[128];
+  cpu_model(cpu, sizeof(cpu));
+  fprintf(file, "{\"cpu\":\"%s\",\"results\":[\n", cpu);
+
+  // one result per line, which is also what compare() reads back
+  for(int i = 0; i < count; i++) {
+    result_t* r = &results[i];
+    fprintf(file, "{\"kernel\":\"%s\",\"size\":%d,\"unit\":\"%s\",\"runs\":%d,\"rejected\":%d,"
+                  "\"min\":%.9g,\"median\":%.9g,\"p99\":%.9g,\"max\":%.9g,\"mean\":%.9g,\"throughput\":%.9g}%s\n",
+            r->kernel, r->size, r->unit, r->runs, r->rejected, r->min, r->median, r->p99, r->max, r->mean, r->throughput,
+            i + 1 < count ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+}
+
+// ------------------------ compare ------------------------
+
+// the number after "key": in line, NAN if missing
+static double json_number(const char* line, const char* key)
+{
+  char pat[32];
+  snprintf(pat, sizeof(pat), "\"%s\":", key);
+  const char* at = strstr(line, pat);
+  return (at != NULL ? strtod(at + strlen(pat), NULL) : NAN);
+}
+
+int compare(const char* path, double threshold, result_t* results, int count)
+{
+  FILE* file = fopen(path, "r");
+  if(file == NULL) {
+    fprintf(stderr, "Failed to open the baseline '%s'\n", path);
+    exit(1);
+  }
+
+  printf("\ncompared to %s (threshold %.1f%%):\n", path, threshold);
+  printf("%-20s %10s %12s %12s %8s\n", "kernel", "size", "baseline", "median", "change");
+
+  int regressions = 0, matched = 0;
+  char line[1024];
+  while(fgets(line, sizeof(line), file) != NULL) {
+    const char* at = strstr(line, "\"kernel\":\"");
+    if(at == NULL) continue;
+
+    char name[64];
+    if(sscanf(at + 10, "%63[^\"]", name) != 1) continue;
+    int size = (int)json_number(line, "size");
+    double baseMin = json_number(line, "min"), baseMedian = json_number(line, "median");
+
+    for(int i = 0; i < count; i++) {
+      result_t* r = &results[i];
+      if(strcmp(r->kernel, name) != 0 || r->size != size) continue;
+      matched++;
+
+      // beyond the threshold, and beyond the noise: even the best of the new
+      // runs is slower than the typical old one (or the reverse)
+      double change = 100.0 * (r->median / baseMedian - 1.0);
+      const char* verdict = "";
+      if(change > threshold && r->min > baseMedian) {
+        verdict = "REGRESSION";
+        regressions++;
+      }
+      else if(change < -threshold && r->median < baseMin) verdict = "improved";
+
+      char base[32], median[32];
+      printf("%-20s %10d %12s %12s %+7.1f%% %s\n", r->kernel, r->size, fmt_time(base, sizeof(base), baseMedian),
+             fmt_time(median, sizeof(median), r->median), change, verdict);
+    }
+  }
+  fclose(file);
+
+  printf("%d of %d results compared, %d regression%s\n", matched, count, regressions, regressions == 1 ? "" : "s");
+  return regressions;
+}
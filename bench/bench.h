@@ -0,0 +1,27 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+/**
+ * A kernel the harness (bench.c) can time. Each one lives in a k_*.c file
+ * that #includes the lab program it comes from, with that program's main
+ * renamed; the Makefile then makes every global of the object local except
+ * the bench_* descriptor, so the labs' parse_args, mul, update, ... don't
+ * collide in one executable.
+ */
+
+typedef struct {
+  const char* name;
+  const char* unit;         // of work(): "cells", "flop", "samples"
+  const char* sizeName;     // what a size is: "n" for n x n, "points", ...
+  int sizes[4];             // defaults, 0 terminated
+  bool fresh;               // every run needs a new input (run changes how much work it has)
+  bool threaded;            // starts threads of its own, so is not pinned to one CPU
+  void* (*setup)(int size); // a fresh input, untimed
+  void (*run)(void* ctx);   // the kernel once, timed
+  void (*teardown)(void* ctx);
+  double (*work)(int size); // units of work in one run
+} bench_kernel_t;
+
+#endif
@@ -0,0 +1,35 @@
+// pthreads-class's serial approx_pi(), not approx_pi_parallel: n rand() points tested against the quarter circle
+#include <stdint.h>
+
+#define main lab_main
+#include "../pthreads-class/approx_pi.c"
+#undef main
+
+#include "bench.h"
+
+static void* pi_setup(int size)
+{
+  srand(1);
+  return (void*)(intptr_t)size;
+}
+
+static void pi_run(void* ctx)
+{
+  volatile double pi = approx_pi((int)(intptr_t)ctx);
+  (void)pi;
+}
+
+static void pi_teardown(void* ctx)
+{
+  (void)ctx;
+}
+
+static double pi_work(int size)
+{
+  return size;
+}
+
+const bench_kernel_t bench_approx_pi_serial = {
+  "approx_pi_serial", "samples", "points", { 1000000, 10000000, 0 }, false, false,
+  pi_setup, pi_run, pi_teardown, pi_work
+};
@@ -0,0 +1,40 @@
+// lab01's update(): one pass of random steps over the cells within the threshold
+#define main lab_main
+#include "../lab01/array.c"
+#undef main
+
+#include "bench.h"
+
+#define THRESHOLD 10
+
+// an all zero size x size array: every cell is within the threshold
+static void* array_setup(int size)
+{
+  info_t* info = calloc(1, sizeof(*info));
+  info->rows = info->cols = size;
+  info->threshold = THRESHOLD;
+  info->mat = make_array(size, size);
+  srand(1);
+  return info;
+}
+
+static void array_run(void* ctx)
+{
+  update(ctx);
+}
+
+static void array_teardown(void* ctx)
+{
+  free_info(ctx);
+}
+
+static double array_work(int size)
+{
+  return (double)size * size;
+}
+
+// cells leave the threshold as it runs, so every run starts from zeros
+const bench_kernel_t bench_array = {
+  "array_update", "cells", "n", { 256, 1024, 0 }, true, false,
+  array_setup, array_run, array_teardown, array_work
+};
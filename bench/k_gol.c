@@ -0,0 +1,36 @@
+// lab02's update(): one generation of the game of life
+#define main lab_main
+#include "../lab02/gol.c"
+#undef main
+
+#include "bench.h"
+
+// a random size x size grid, as `gol <gens> <freq> <seed> size size` makes it
+static void* gol_setup(int size)
+{
+  info_t* info = calloc(1, sizeof(*info));
+  info->rows = info->cols = size;
+  srand(1);
+  make_array(info, true);
+  return info;
+}
+
+static void gol_run(void* ctx)
+{
+  update(ctx);
+}
+
+static void gol_teardown(void* ctx)
+{
+  free_info(ctx);
+}
+
+static double gol_work(int size)
+{
+  return (double)size * size;
+}
+
+const bench_kernel_t bench_gol = {
+  "gol_update", "cells", "n", { 128, 512, 0 }, false, false,
+  gol_setup, gol_run, gol_teardown, gol_work
+};
@@ -0,0 +1,72 @@
+// one lab04 program's mul(), built once per program:
+//   -DLAB_SRC='"../lab04/matrixrow.c"' -DNAME=matrixrow -DROW_FORM=true
+// without LAB_SRC it is the library's mat_mul() (sgemm, see mat.h), on sgemm's thread grid
+#ifdef LAB_SRC
+#define main lab_main
+#include LAB_SRC
+#undef main
+#define THREADED false
+#else
+#include <stdlib.h>
+#include "mat.h"
+#define THREADED true
+
+static mat_t* mul(mat_t* A, mat_t* B)
+{
+  return mat_mul(A, B, true);
+}
+#endif
+
+#include "bench.h"
+
+#define PASTE(a, b) a##b
+#define DESCRIPTOR(name) PASTE(bench_mul_, name)
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+typedef struct {
+  mat_t *A, *B;
+} operands_t;
+
+// small integers, in the form this mul() multiplies without converting
+static mat_t* random_mat(int n)
+{
+  mat_t* mat = mat_alloc(n, n, ROW_FORM);
+  for(int row = 0; row < n; row++) {
+    for(int col = 0; col < n; col++) MAT_AT(mat, row, col) = (float)(rand() % 10);
+  }
+  return mat;
+}
+
+static void* mul_setup(int n)
+{
+  srand(1);
+  operands_t* ops = malloc(sizeof(*ops));
+  ops->A = random_mat(n);
+  ops->B = random_mat(n);
+  return ops;
+}
+
+static void mul_run(void* ctx)
+{
+  operands_t* ops = ctx;
+  free_mat(mul(ops->A, ops->B), true);
+}
+
+static void mul_teardown(void* ctx)
+{
+  operands_t* ops = ctx;
+  free_mat(ops->A, true);
+  free_mat(ops->B, true);
+  free(ops);
+}
+
+static double mul_work(int n)
+{
+  return 2.0 * n * n * n;
+}
+
+const bench_kernel_t DESCRIPTOR(NAME) = {
+  "mul_" XSTR(NAME), "flop", "n", { 256, 512, 0 }, false, THREADED,
+  mul_setup, mul_run, mul_teardown, mul_work
+};
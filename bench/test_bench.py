@@ -0,0 +1,62 @@
+import pytest
+
+import json
+import subprocess
+
+FAST = ['--reps=3', '--warmup=1']
+
+@pytest.fixture(scope='module', autouse=True)
+def build():
+  subprocess.run(['make'], check=True, capture_output=True)
+
+def run(*args):
+  return subprocess.run(['./bench'] + list(args), capture_output=True, text=True)
+
+def test_list():
+  result = run('--list')
+
+  names = [line.split()[0] for line in result.stdout.strip().split('\n')]
+  for kernel in ['gol_update', 'mul_matrixrow', 'mul_matrixcol', 'mul_matrixrow256', 'mul_standard_mult', 'mul_sgemm', 'approx_pi_serial']:
+    assert kernel in names
+
+def test_json(tmp_path):
+  path = tmp_path / 'out.json'
+  result = run('--filter=^(gol_update|mul_)', '--sizes=32,64', '--json=' + str(path), *FAST)
+  assert result.returncode == 0
+
+  with open(path) as fh:
+    results = json.load(fh)['results']
+
+  assert len(results) == 2 * 6
+  for r in results:
+    assert r['size'] in (32, 64)
+    assert 0 < r['min'] <= r['median'] <= r['p99'] <= r['max']
+    assert r['runs'] + r['rejected'] == 3
+    assert r['throughput'] == pytest.approx((2 * r['size']**3 if r['unit'] == 'flop' else r['size']**2) / r['median'])
+
+def test_compare(tmp_path):
+  base = tmp_path / 'base.json'
+  run('--filter=^mul_sgemm$', '--sizes=64', '--json=' + str(base), *FAST)
+
+  # a baseline 1000x faster than anything real
+  with open(base) as fh:
+    doc = json.load(fh)
+  for r in doc['results']:
+    r['min'] /= 1000
+    r['median'] /= 1000
+  fast = tmp_path / 'fast.json'
+  fast.write_text('{"results":[\n' + ',\n'.join(json.dumps(r, separators=(',', ':')) for r in doc['results']) + '\n]}\n')
+
+  result = run('--filter=^mul_sgemm$', '--sizes=64', '--compare=' + str(fast), *FAST)
+  assert result.returncode == 2
+  assert 'REGRESSION' in result.stdout
+
+  # and 1000x slower: no regression
+  for r in doc['results']:
+    r['min'] *= 1e6
+    r['median'] *= 1e6
+  fast.write_text('{"results":[\n' + ',\n'.join(json.dumps(r, separators=(',', ':')) for r in doc['results']) + '\n]}\n')
+
+  result = run('--filter=^mul_sgemm$', '--sizes=64', '--compare=' + str(fast), *FAST)
+  assert result.returncode == 0
+  assert 'improved' in result.stdout
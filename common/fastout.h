@@ -0,0 +1,248 @@
+#ifndef FASTOUT_H
+#define FASTOUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/**
+ * Buffered text output shared by the labs (include with -I../common).
+ *
+ * Matrices used to be printed with one printf("%d ") per element. Here
+ * integers are turned into text two digits at a time from a lookup table,
+ * appended to a large buffer and handed to write() once the buffer fills
+ * (or once at the end), with no locale or format string parsing. Floats are
+ * written as the shortest decimal of up to 8 places that reads back as the
+ * same float, through the same digit table; anything that needs more digits
+ * or an exponent falls back to "%.9g", which is always exact.
+ *
+ * out_rows() also splits the formatting of a matrix across threads by row
+ * ranges; each thread fills its own buffer and they are written in order.
+ *
+ * Everything is static inline so a lab program only pulls in what it uses
+ * (out_rows needs -pthread).
+ */
+
+#define OUT_BUF_SIZE (1 << 20)
+
+typedef struct {
+  int fd;      // where out_flush writes, -1 just collects into buf
+  char* buf;
+  size_t len, cap;
+} out_t;
+
+static const char out_digits[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+__attribute__((no_instrument_function))
+static inline void out_init(out_t* out, int fd, size_t sizeHint)
+{
+  out->fd = fd;
+  out->cap = (sizeHint < 64 ? 64 : sizeHint > OUT_BUF_SIZE ? OUT_BUF_SIZE : sizeHint);
+  out->buf = malloc(out->cap);
+  out->len = 0;
+}
+
+__attribute__((no_instrument_function))
+static inline void out_write_all(int fd, const char* buf, size_t len)
+{
+  // anything printf'd before this has to reach the fd first
+  if(fd == STDOUT_FILENO) fflush(stdout);
+
+  while(len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+__attribute__((no_instrument_function))
+static inline void out_flush(out_t* out)
+{
+  if(out->fd >= 0 && out->len > 0) {
+    out_write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+  }
+}
+
+__attribute__((no_instrument_function))
+static inline void out_close(out_t* out)
+{
+  out_flush(out);
+  free(out->buf);
+  out->buf = NULL;
+}
+
+// room for n more bytes: flush when there is an fd to flush to, grow otherwise
+__attribute__((no_instrument_function))
+static inline char* out_reserve(out_t* out, size_t n)
+{
+  if(out->len + n > out->cap) {
+    out_flush(out);
+    if(out->len + n > out->cap) {
+      while(out->len + n > out->cap) out->cap *= 2;
+      out->buf = realloc(out->buf, out->cap);
+    }
+  }
+  return &out->buf[out->len];
+}
+
+__attribute__((no_instrument_function))
+static inline void out_char(out_t* out, char c)
+{
+  *out_reserve(out, 1) = c;
+  out->len++;
+}
+
+__attribute__((no_instrument_function))
+static inline void out_str(out_t* out, const char* str)
+{
+  size_t n = strlen(str);
+  memcpy(out_reserve(out, n), str, n);
+  out->len += n;
+}
+
+__attribute__((no_instrument_function))
+static inline void out_uint(out_t* out, uint64_t v)
+{
+  char tmp[20];
+  char* p = tmp + sizeof(tmp);
+
+  // two digits per division, written back to front
+  while(v >= 100) {
+    unsigned pair = (unsigned)(v % 100) * 2;
+    v /= 100;
+    p -= 2;
+    memcpy(p, &out_digits[pair], 2);
+  }
+  if(v >= 10) {
+    p -= 2;
+    memcpy(p, &out_digits[v * 2], 2);
+  }
+  else *--p = (char)('0' + v);
+
+  size_t n = tmp + sizeof(tmp) - p;
+  memcpy(out_reserve(out, n), p, n);
+  out->len += n;
+}
+
+__attribute__((no_instrument_function))
+static inline void out_int(out_t* out, int64_t v)
+{
+  if(v < 0) {
+    out_char(out, '-');
+    out_uint(out, -(uint64_t)v);
+  }
+  else out_uint(out, v);
+}
+
+// the shortest fixed-point text that reads back as v (integers print as integers)
+__attribute__((no_instrument_function))
+static inline void out_float(out_t* out, float v)
+{
+  static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
+
+  if(signbit(v) && !isnan(v)) {
+    out_char(out, '-');
+    v = -v;
+  }
+
+  if(v < 1e9f) {
+    for(int places = 0; places <= 8; places++) {
+      uint64_t m = (uint64_t)llround((double)v * pow10[places]);
+      uint64_t whole = m / (uint64_t)pow10[places], frac = m % (uint64_t)pow10[places];
+      // the value a decimal reader (mat.c's parse_float, strtof) rounds it to
+      if((float)(whole + frac / pow10[places]) != v) continue;
+
+      out_uint(out, whole);
+      if(places > 0) {
+        char* p = out_reserve(out, places + 1);
+        p[0] = '.';
+        for(int i = places; i > 0; i--, frac /= 10) p[i] = (char)('0' + frac % 10);
+        out->len += places + 1;
+      }
+      return;
+    }
+  }
+
+  char tmp[32];
+  int n = snprintf(tmp, sizeof(tmp), "%.9g", v);
+  memcpy(out_reserve(out, n), tmp, n);
+  out->len += n;
+}
+
+// ------------------- threaded row formatting -------------------
+
+// appends row `row` of whatever ctx is to out
+typedef void (*out_row_fn)(out_t* out, void* ctx, int row);
+
+#define OUT_MAX_THREADS 16
+
+typedef struct {
+  out_t out;
+  out_row_fn fn;
+  void* ctx;
+  int start, stop;
+} out_task_t;
+
+__attribute__((no_instrument_function))
+static inline void* out_task_run(void* arg)
+{
+  out_task_t* task = arg;
+  for(int row = task->start; row < task->stop; row++) task->fn(&task->out, task->ctx, row);
+  return NULL;
+}
+
+// formats rows [0, rows) into out (which needs an fd) in row order. rows are
+// handed out in waves of one ~OUT_BUF_SIZE range per thread, so memory stays bounded
+__attribute__((no_instrument_function))
+static inline void out_rows(out_t* out, int rows, out_row_fn fn, void* ctx, size_t bytesPerRow)
+{
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads > OUT_MAX_THREADS) threads = OUT_MAX_THREADS;
+
+  int perTask = OUT_BUF_SIZE / (bytesPerRow > 0 ? bytesPerRow : 1);
+  if(perTask < 1) perTask = 1;
+
+  if(threads <= 1 || rows <= perTask) {
+    for(int row = 0; row < rows; row++) fn(out, ctx, row);
+    return;
+  }
+
+  out_task_t tasks[OUT_MAX_THREADS];
+  pthread_t ids[OUT_MAX_THREADS];
+  for(int t = 0; t < threads; t++) {
+    out_init(&tasks[t].out, -1, OUT_BUF_SIZE);
+    tasks[t].fn = fn;
+    tasks[t].ctx = ctx;
+  }
+
+  out_flush(out);
+  for(int row = 0; row < rows; row += perTask * threads) {
+    for(int t = 0; t < threads; t++) {
+      tasks[t].start = row + t*perTask < rows ? row + t*perTask : rows;
+      tasks[t].stop = tasks[t].start + perTask < rows ? tasks[t].start + perTask : rows;
+      tasks[t].out.len = 0;
+      if(t > 0) pthread_create(&ids[t], NULL, out_task_run, &tasks[t]);
+    }
+    out_task_run(&tasks[0]);
+    for(int t = 1; t < threads; t++) pthread_join(ids[t], NULL);
+
+    for(int t = 0; t < threads; t++) out_write_all(out->fd, tasks[t].out.buf, tasks[t].out.len);
+  }
+
+  for(int t = 0; t < threads; t++) free(tasks[t].out.buf);
+}
+
+#endif
@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "symbols.h"
+
+/**
+ * Allocation profiler: malloc, calloc, realloc, free and the aligned
+ * allocators are interposed on an unmodified binary.
+ *
+ *   HPC_ALLOC=1 LD_PRELOAD=../common/hpctools/libhpcalloc.so ./gol 200 1000 1 256 256
+ *
+ * Every allocation is counted by the thread making it, under its call site
+ * (the return address into the caller of malloc) and its phase: the
+ * innermost hpc_region_begin() region of the thread (region.h, with
+ * HPC_REGIONS=1), or "(no region)" without regions. At exit two tables go to
+ * stderr: per phase the calls, bytes requested and freed, the peak of live
+ * heap bytes while the phase ran, the RSS high-water mark ("RSS hwm") when
+ * it ended and the allocation rate per second a thread spent in it; then
+ * the call sites that requested the most bytes, by function name and offset.
+ * The high-water mark is getrusage()'s, so the whole process's peak so far,
+ * not what the phase itself used: it only tells which phase first pushed it up.
+ *
+ * Set in the environment:
+ *   HPC_ALLOC=1          count (anything but unset, empty or 0)
+ *   HPC_ALLOC_SITES=n    call sites to report, default 10
+ *
+ * The counters of a thread live in memory of its own, mapped outside the
+ * heap, so the bookkeeping neither calls malloc nor takes a lock; only the
+ * live byte count is shared. Freed bytes are malloc_usable_size(), the block
+ * as glibc handed it out, so a little more than was asked for.
+ */
+
+#define MAX_PHASES 64
+#define SITE_BITS 12
+#define SITE_SLOTS (1 << SITE_BITS)
+#define DEFAULT_SITES 10
+#define NO_REGION "(no region)"
+
+// the allocator itself, under the names glibc exports it by
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t align, size_t size);
+extern void __libc_free(void* ptr);
+
+typedef enum { OP_MALLOC, OP_CALLOC, OP_REALLOC, OP_FREE, OPS } op_t;
+
+typedef struct {
+  const char* name;
+  uint64_t ops[OPS];
+  uint64_t bytes, freed; // requested, usable size freed
+  int64_t peakHeap;      // live bytes, all threads
+  long maxrss;           // kB, the process high-water mark at the end of the phase
+  double ns;             // thread time in the phase
+} phase_t;
+
+typedef struct {
+  const void* site;
+  int phase;
+  uint64_t calls, bytes;
+} site_t;
+
+typedef struct state {
+  struct state* next; // every thread's, for the report at exit
+  int phase;          // index into phases
+  double since;       // when it was entered
+  bool done;          // thread exited, its time is closed
+  int phaseCount;
+  phase_t phases[MAX_PHASES];
+  uint64_t lostSites; // calls whose site did not fit the table
+  site_t sites[SITE_SLOTS]; // open addressing, by site and phase
+} state_t;
+
+static atomic_bool on;
+static _Atomic(state_t*) states;
+static _Atomic int64_t live;
+static pthread_key_t exitKey;
+static int topSites;
+
+// initial-exec: a preloaded library has static TLS, reaching it never allocates
+static __thread __attribute__((tls_model("initial-exec"))) state_t* self;
+static __thread __attribute__((tls_model("initial-exec"))) bool busy;
+
+static double now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static long maxrss_kb(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// ------------------------ phases ------------------------
+
+static int phase_index(state_t* s, const char* name)
+{
+  for(int p = 0; p < s->phaseCount; p++) {
+    if(s->phases[p].name == name || strcmp(s->phases[p].name, name) == 0) return p;
+  }
+  if(s->phaseCount == MAX_PHASES) return 0; // into "(no region)"
+  s->phases[s->phaseCount].name = name;
+  return s->phaseCount++;
+}
+
+static void leave_phase(state_t* s)
+{
+  double t = now_ns();
+  phase_t* p = &s->phases[s->phase];
+  p->ns += t - s->since;
+  long rss = maxrss_kb();
+  if(rss > p->maxrss) p->maxrss = rss;
+  s->since = t;
+}
+
+static void thread_exit(void* arg)
+{
+  state_t* s = arg;
+  leave_phase(s);
+  s->done = true;
+}
+
+static state_t* state(void)
+{
+  if(self != NULL) return self;
+
+  state_t* s = mmap(NULL, sizeof(state_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(s == MAP_FAILED) return NULL;
+  s->phases[0].name = NO_REGION;
+  s->phaseCount = 1;
+  s->since = now_ns();
+
+  s->next = atomic_load(&states);
+  while(!atomic_compare_exchange_weak(&states, &s->next, s));
+  self = s;
+  pthread_setspecific(exitKey, s); // the first keys are static, no allocation
+  return s;
+}
+
+/**
+ * Called by region.c (found with dlsym, so programs do not link this
+ * library) whenever the innermost region of the calling thread changes;
+ * NULL when none is open. name must live until exit.
+ */
+void hpc_alloc_phase(const char* name)
+{
+  if(!atomic_load_explicit(&on, memory_order_relaxed) || busy) return;
+  state_t* s = state();
+  if(s == NULL) return;
+
+  leave_phase(s);
+  s->phase = phase_index(s, name != NULL ? name : NO_REGION);
+}
+
+// ------------------------ counting ------------------------
+
+static void count(op_t op, const void* site, size_t bytes, size_t usable)
+{
+  busy = true;
+  state_t* s = state();
+  if(s == NULL) {
+    busy = false;
+    return;
+  }
+
+  phase_t* p = &s->phases[s->phase];
+  p->ops[op]++;
+  p->bytes += bytes;
+  int64_t heap = atomic_fetch_add_explicit(&live, (int64_t)usable, memory_order_relaxed) + (int64_t)usable;
+  if(heap > p->peakHeap) p->peakHeap = heap;
+
+  uintptr_t h = ((uintptr_t)site >> 4) * 0x9e3779b97f4a7c15ULL + s->phase;
+  for(int probe = 0; probe < SITE_SLOTS; probe++) {
+    site_t* e = &s->sites[(h + probe) & (SITE_SLOTS - 1)];
+    if(e->calls > 0 && (e->site != site || e->phase != s->phase)) continue;
+    e->site = site;
+    e->phase = s->phase;
+    e->calls++;
+    e->bytes += bytes;
+    busy = false;
+    return;
+  }
+  s->lostSites++;
+  busy = false;
+}
+
+static void count_free(void* ptr)
+{
+  busy = true;
+  state_t* s = state();
+  if(s != NULL) {
+    size_t usable = malloc_usable_size(ptr);
+    s->phases[s->phase].ops[OP_FREE]++;
+    s->phases[s->phase].freed += usable;
+    atomic_fetch_sub_explicit(&live, (int64_t)usable, memory_order_relaxed);
+  }
+  busy = false;
+}
+
+static inline bool counting(void)
+{
+  return atomic_load_explicit(&on, memory_order_relaxed) && !busy;
+}
+
+void* malloc(size_t size)
+{
+  void* ptr = __libc_malloc(size);
+  if(ptr != NULL && counting()) count(OP_MALLOC, __builtin_return_address(0), size, malloc_usable_size(ptr));
+  return ptr;
+}
+
+void* calloc(size_t n, size_t size)
+{
+  void* ptr = __libc_calloc(n, size);
+  if(ptr != NULL && counting()) count(OP_CALLOC, __builtin_return_address(0), n * size, malloc_usable_size(ptr));
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  if(!counting()) return __libc_realloc(ptr, size);
+  if(ptr != NULL && size == 0) {
+    free(ptr); // what glibc does with it
+    return NULL;
+  }
+
+  // a realloc frees the old block and allocates the new one, if only in place
+  size_t old = (ptr != NULL ? malloc_usable_size(ptr) : 0);
+  void* moved = __libc_realloc(ptr, size);
+  if(moved == NULL) return NULL; // ptr is untouched
+
+  atomic_fetch_sub_explicit(&live, (int64_t)old, memory_order_relaxed);
+  count(OP_REALLOC, __builtin_return_address(0), size, malloc_usable_size(moved));
+  return moved;
+}
+
+void free(void* ptr)
+{
+  if(ptr != NULL && counting()) count_free(ptr);
+  __libc_free(ptr);
+}
+
+// the aligned ones count as mallocs, so their frees balance
+void* memalign(size_t align, size_t size)
+{
+  void* ptr = __libc_memalign(align, size);
+  if(ptr != NULL && counting()) count(OP_MALLOC, __builtin_return_address(0), size, malloc_usable_size(ptr));
+  return ptr;
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+  void* ptr = __libc_memalign(align, size);
+  if(ptr != NULL && counting()) count(OP_MALLOC, __builtin_return_address(0), size, malloc_usable_size(ptr));
+  return ptr;
+}
+
+int posix_memalign(void** out, size_t align, size_t size)
+{
+  if(align % sizeof(void*) != 0 || (align & (align - 1)) != 0) return EINVAL;
+  void* ptr = __libc_memalign(align, size);
+  if(ptr == NULL) return ENOMEM;
+  if(counting()) count(OP_MALLOC, __builtin_return_address(0), size, malloc_usable_size(ptr));
+  *out = ptr;
+  return 0;
+}
+
+__attribute__((constructor))
+static void alloc_start(void)
+{
+  const char* v = getenv("HPC_ALLOC");
+  if(v == NULL || *v == '\0' || strcmp(v, "0") == 0) return;
+
+  v = getenv("HPC_ALLOC_SITES");
+  topSites = (v != NULL ? atoi(v) : DEFAULT_SITES);
+  if(topSites < 0) topSites = DEFAULT_SITES;
+
+  pthread_key_create(&exitKey, thread_exit);
+  atomic_store(&on, true);
+}
+
+// ------------------------ report ------------------------
+
+static int by_bytes(const void* a, const void* b)
+{
+  const site_t* x = a;
+  const site_t* y = b;
+  return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+// a size in B, kB, MB or GB, into buf
+static const char* human(char* buf, size_t n, double bytes)
+{
+  const char* units[] = { "B", "kB", "MB", "GB" };
+  int u = 0;
+  while(bytes >= 1000.0 && u < 3) {
+    bytes /= 1000.0;
+    u++;
+  }
+  snprintf(buf, n, u == 0 ? "%.0f%s" : "%.1f%s", bytes, units[u]);
+  return buf;
+}
+
+__attribute__((destructor))
+static void alloc_report(void)
+{
+  if(!atomic_exchange(&on, false)) return;
+
+  // the names of every thread's phases, merged
+  phase_t merged[MAX_PHASES];
+  int phases = 0;
+  // phase index of a thread -> merged index, for its sites
+  int (*map)[MAX_PHASES] = NULL;
+  size_t threads = 0;
+  for(state_t* s = atomic_load(&states); s != NULL; s = s->next) threads++;
+  map = calloc(threads > 0 ? threads : 1, sizeof(*map));
+
+  size_t t = 0;
+  uint64_t lost = 0;
+  for(state_t* s = atomic_load(&states); s != NULL; s = s->next, t++) {
+    if(!s->done) leave_phase(s); // still running: up to now
+    lost += s->lostSites;
+
+    for(int p = 0; p < s->phaseCount; p++) {
+      phase_t* from = &s->phases[p];
+      int m = 0;
+      while(m < phases && strcmp(merged[m].name, from->name) != 0) m++;
+      if(m == phases) {
+        if(phases == MAX_PHASES) m = 0;
+        else {
+          memset(&merged[m], 0, sizeof(merged[m]));
+          merged[m].name = from->name;
+          phases++;
+        }
+      }
+      map[t][p] = m;
+
+      for(int op = 0; op < OPS; op++) merged[m].ops[op] += from->ops[op];
+      merged[m].bytes += from->bytes;
+      merged[m].freed += from->freed;
+      merged[m].ns += from->ns;
+      if(from->peakHeap > merged[m].peakHeap) merged[m].peakHeap = from->peakHeap;
+      if(from->maxrss > merged[m].maxrss) merged[m].maxrss = from->maxrss;
+    }
+  }
+
+  fprintf(stderr, "hpc_alloc: %zu thread%s, peak RSS %.1f MB\n", threads, threads == 1 ? "" : "s", maxrss_kb() / 1000.0);
+  fprintf(stderr, "%-16s %9s %9s %9s %9s %10s %10s %10s %10s %12s %10s\n",
+          "phase", "malloc", "calloc", "realloc", "free", "bytes", "freed", "peak heap", "RSS hwm", "allocs/s", "bytes/s");
+
+  for(int m = 0; m < phases; m++) {
+    phase_t* p = &merged[m];
+    uint64_t allocs = p->ops[OP_MALLOC] + p->ops[OP_CALLOC] + p->ops[OP_REALLOC];
+    if(allocs == 0 && p->ops[OP_FREE] == 0 && strcmp(p->name, NO_REGION) == 0) continue;
+
+    char bytes[16], freed[16], peak[16], rss[16], rate[16];
+    double s = p->ns * 1e-9;
+    fprintf(stderr, "%-16s %9lu %9lu %9lu %9lu %10s %10s %10s %10s ", p->name,
+            (unsigned long)p->ops[OP_MALLOC], (unsigned long)p->ops[OP_CALLOC], (unsigned long)p->ops[OP_REALLOC], (unsigned long)p->ops[OP_FREE],
+            human(bytes, sizeof(bytes), p->bytes), human(freed, sizeof(freed), p->freed),
+            human(peak, sizeof(peak), p->peakHeap > 0 ? p->peakHeap : 0), human(rss, sizeof(rss), p->maxrss * 1000.0));
+    if(s > 0) fprintf(stderr, "%12.0f %10s\n", allocs / s, human(rate, sizeof(rate), p->bytes / s));
+    else fprintf(stderr, "%12s %10s\n", "-", "-");
+  }
+
+  // every thread's sites, merged by site and phase
+  size_t n = 0;
+  for(state_t* s = atomic_load(&states); s != NULL; s = s->next) {
+    for(int i = 0; i < SITE_SLOTS; i++) n += (s->sites[i].calls > 0);
+  }
+  site_t* sites = malloc(sizeof(site_t) * (n > 0 ? n : 1));
+  size_t used = 0;
+  t = 0;
+  for(state_t* s = atomic_load(&states); s != NULL; s = s->next, t++) {
+    for(int i = 0; i < SITE_SLOTS; i++) {
+      site_t e = s->sites[i];
+      if(e.calls == 0) continue;
+      e.phase = map[t][e.phase];
+
+      size_t j = 0;
+      while(j < used && (sites[j].site != e.site || sites[j].phase != e.phase)) j++;
+      if(j == used) sites[used++] = e;
+      else {
+        sites[j].calls += e.calls;
+        sites[j].bytes += e.bytes;
+      }
+    }
+  }
+  qsort(sites, used, sizeof(site_t), by_bytes);
+
+  if(topSites > 0 && used > 0) {
+    fprintf(stderr, "%-40s %-16s %9s %10s %10s\n", "call site", "phase", "calls", "bytes", "bytes/call");
+    for(size_t i = 0; i < used && i < (size_t)topSites; i++) {
+      // the call instruction is just before the return address
+      uintptr_t offset;
+      const char* fn = hpc_symbol((const char*)sites[i].site - 1, &offset);
+      char where[64], bytes[16], each[16];
+      if(fn != NULL) snprintf(where, sizeof(where), "%s+%#lx", fn, (unsigned long)offset + 1);
+      else {
+        const char* module = hpc_module(sites[i].site);
+        if(module != NULL) snprintf(where, sizeof(where), "[%s]", module);
+        else snprintf(where, sizeof(where), "%p", sites[i].site);
+      }
+      fprintf(stderr, "%-40s %-16s %9lu %10s %10s\n", where, merged[sites[i].phase].name, (unsigned long)sites[i].calls,
+              human(bytes, sizeof(bytes), sites[i].bytes), human(each, sizeof(each), (double)sites[i].bytes / sites[i].calls));
+    }
+  }
+  if(lost > 0) fprintf(stderr, "hpc_alloc: %lu calls at sites past the %d the table holds\n", (unsigned long)lost, SITE_SLOTS);
+
+  free(sites);
+  free(map);
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "symbols.h"
+
+/**
+ * Sampling profiler for uninstrumented, fully optimized binaries: nothing is
+ * recompiled, the library is preloaded into the program.
+ *
+ *   HPC_PROFILE=1 LD_PRELOAD=../common/hpctools/libhpcprof.so ./matrixrow A B
+ *   flamegraph.pl profile.folded > profile.svg
+ *
+ * An ITIMER_PROF timer sends SIGPROF every 1/HPC_PROFILE_HZ s of CPU time the
+ * process uses, to whichever thread is running. The handler unwinds the
+ * interrupted stack from the .eh_frame tables, so frame pointers are not
+ * needed, and copies the raw addresses into a preallocated arena: no names,
+ * no locks, no malloc. At exit identical stacks are counted and written one
+ * per line as "main;mul;... count", root first, the folded form that
+ * flamegraph.pl and speedscope read.
+ *
+ * Set in the environment:
+ *   HPC_PROFILE=1           sample (anything but unset, empty or 0)
+ *   HPC_PROFILE_FILE=path   default profile.folded
+ *   HPC_PROFILE_HZ=n        samples per CPU second, default 997
+ *
+ * A timer signal rather than perf_event_open, which perf_event_paranoid
+ * often forbids. Unwinding in the handler relies on glibc's lock-free
+ * _dl_find_object (gcc 12 and up); an older libgcc takes the loader lock.
+ */
+
+#define MAX_FRAMES 64
+// words of the sample arena (mapped lazily, only what is written is ever touched)
+#define ARENA_WORDS (UINT64_C(1) << 24)
+#define DEFAULT_HZ 997
+
+static uintptr_t* arena; // per sample: frame count, then the frames leaf first
+static _Atomic uint64_t used, dropped;
+static const char* path;
+static int hz;
+
+static void on_sigprof(int sig, siginfo_t* info, void* uctx)
+{
+  (void)sig;
+  (void)info;
+
+  void* frames[MAX_FRAMES + 2];
+  int n = backtrace(frames, MAX_FRAMES + 2);
+
+  // frames of this handler and the signal trampoline come first: start at the
+  // interrupted instruction itself
+  uintptr_t pc = ((ucontext_t*)uctx)->uc_mcontext.gregs[REG_RIP];
+  int from = 0;
+  while(from < n && (uintptr_t)frames[from] != pc) from++;
+  if(from == n) {
+    frames[0] = (void*)pc;
+    from = 0;
+    n = 1;
+  }
+  if(n - from > MAX_FRAMES) n = from + MAX_FRAMES;
+
+  uint64_t at = atomic_fetch_add_explicit(&used, n - from + 1, memory_order_relaxed);
+  if(at + n - from + 1 > ARENA_WORDS) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  arena[at] = n - from;
+  for(int i = from; i < n; i++) arena[at + 1 + i - from] = (uintptr_t)frames[i];
+}
+
+__attribute__((constructor))
+static void profile_start(void)
+{
+  const char* on = getenv("HPC_PROFILE");
+  if(on == NULL || *on == '\0' || strcmp(on, "0") == 0) return;
+
+  path = getenv("HPC_PROFILE_FILE");
+  if(path == NULL || *path == '\0') path = "profile.folded";
+  const char* v = getenv("HPC_PROFILE_HZ");
+  hz = (v != NULL ? atoi(v) : DEFAULT_HZ);
+  if(hz < 1 || hz > 100000) hz = DEFAULT_HZ;
+
+  arena = mmap(NULL, ARENA_WORDS * sizeof(uintptr_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(arena == MAP_FAILED) {
+    fprintf(stderr, "hpc_profile: cannot map the sample buffer\n");
+    return;
+  }
+
+  // the first backtrace() loads libgcc_s, which must not happen in the handler
+  void* warm[4];
+  backtrace(warm, 4);
+
+  struct sigaction sa = { 0 };
+  sa.sa_sigaction = on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  struct itimerval timer = { { 0, 1000000 / hz }, { 0, 1000000 / hz } };
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// ------------------------ output ------------------------
+
+static int by_stack(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// "root;...;leaf" of one sample
+static char* fold(const uintptr_t* sample)
+{
+  size_t len = 0, cap = 256;
+  char* s = malloc(cap);
+  s[0] = '\0';
+
+  for(int i = (int)sample[0] - 1; i >= 0; i--) {
+    // return addresses point after the call, which may be another function
+    // already; the leaf is the interrupted instruction itself
+    uintptr_t addr = sample[1 + i] - (i > 0 ? 1 : 0);
+    // a local symbol of a stripped library goes by the library: "[libc.so.6]"
+    char unknown[PATH_MAX + 2];
+    const char* name = hpc_symbol((void*)addr, NULL);
+    if(name == NULL) {
+      const char* module = hpc_module((void*)addr);
+      if(module != NULL) snprintf(unknown, sizeof(unknown), "[%s]", module);
+      else snprintf(unknown, sizeof(unknown), "%#lx", (unsigned long)addr);
+      name = unknown;
+    }
+
+    size_t n = strlen(name);
+    if(len + n + 2 > cap) {
+      while(len + n + 2 > cap) cap *= 2;
+      s = realloc(s, cap);
+    }
+    if(len > 0) s[len++] = ';';
+    memcpy(&s[len], name, n + 1);
+    len += n;
+  }
+  return s;
+}
+
+__attribute__((destructor))
+static void profile_write(void)
+{
+  if(arena == NULL || arena == MAP_FAILED) return;
+
+  struct itimerval off = { { 0, 0 }, { 0, 0 } };
+  setitimer(ITIMER_PROF, &off, NULL);
+  signal(SIGPROF, SIG_IGN);
+
+  uint64_t end = atomic_load(&used);
+  if(end > ARENA_WORDS) end = ARENA_WORDS;
+
+  size_t samples = 0;
+  for(uint64_t at = 0; at < end && arena[at] > 0 && at + 1 + arena[at] <= end; at += 1 + arena[at]) samples++;
+
+  char** stacks = malloc(sizeof(char*) * (samples > 0 ? samples : 1));
+  size_t i = 0;
+  for(uint64_t at = 0; i < samples; at += 1 + arena[at], i++) stacks[i] = fold(&arena[at]);
+  qsort(stacks, samples, sizeof(char*), by_stack);
+
+  FILE* fh = fopen(path, "w");
+  if(fh == NULL) {
+    fprintf(stderr, "hpc_profile: cannot write '%s'\n", path);
+  }
+  else {
+    // sorted, so equal stacks are neighbours
+    size_t distinct = 0;
+    for(size_t a = 0; a < samples; ) {
+      size_t b = a + 1;
+      while(b < samples && strcmp(stacks[a], stacks[b]) == 0) b++;
+      fprintf(fh, "%s %zu\n", stacks[a], b - a);
+      distinct++;
+      a = b;
+    }
+    fclose(fh);
+
+    fprintf(stderr, "hpc_profile: %zu samples at %d Hz (%zu distinct stacks) written to %s", samples, hz, distinct, path);
+    if(atomic_load(&dropped) > 0) fprintf(stderr, " (%lu dropped, buffer full)", (unsigned long)atomic_load(&dropped));
+    fprintf(stderr, "\n");
+  }
+
+  for(i = 0; i < samples; i++) free(stacks[i]);
+  free(stacks);
+  munmap(arena, ARENA_WORDS * sizeof(uintptr_t));
+  arena = NULL;
+}
@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <cpuid.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "region.h"
+
+#define MAX_DEPTH 32
+#define MAX_REGIONS 64
+#define CACHE(id, result) ((id) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+// FP_ARITH_INST_RETIRED (event 0xC7) with a umask
+#define FP_ARITH(umask) (0xC7 | ((umask) << 8))
+
+typedef enum { GROUP_CORE, GROUP_FP, GROUP_SW, GROUPS } group_id_t;
+
+typedef enum {
+  EV_CYCLES, EV_INSTRUCTIONS, EV_L1D, EV_LLC, EV_DTLB,
+  EV_FP_SCALAR, EV_FP_128, EV_FP_256, EV_FP_512,
+  EV_FAULTS, EV_SWITCHES,
+  EVENTS
+} event_id_t;
+
+static const struct {
+  const char* name;
+  group_id_t group; // the first event of a group leads it
+  uint32_t type;
+  uint64_t config;
+  double flops; // per count, FP events only
+} events[EVENTS] = {
+  { "cycles",       GROUP_CORE, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0 },
+  { "instructions", GROUP_CORE, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0 },
+  { "l1d-misses",   GROUP_CORE, PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS), 0 },
+  { "llc-misses",   GROUP_CORE, PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS), 0 },
+  { "dtlb-misses",  GROUP_CORE, PERF_TYPE_HW_CACHE, CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS), 0 },
+  // scalar single and double, then packed single only: the labs are float
+  { "fp-scalar",    GROUP_FP,   PERF_TYPE_RAW, FP_ARITH(0x03), 1 },
+  { "fp-128s",      GROUP_FP,   PERF_TYPE_RAW, FP_ARITH(0x08), 4 },
+  { "fp-256s",      GROUP_FP,   PERF_TYPE_RAW, FP_ARITH(0x20), 8 },
+  { "fp-512s",      GROUP_FP,   PERF_TYPE_RAW, FP_ARITH(0x80), 16 },
+  { "page-faults",  GROUP_SW,   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 0 },
+  { "ctx-switches", GROUP_SW,   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0 },
+};
+
+typedef struct {
+  double count[EVENTS];
+  double ns, flops; // flops: from hpc_region_flops
+} totals_t;
+
+typedef struct {
+  const char* name;
+  uint64_t calls;
+  totals_t sum;
+} region_t;
+
+typedef struct {
+  int fd; // leader, -1 if the group could not be opened
+  int members;
+  event_id_t ids[EVENTS]; // the group's events in read order
+} group_t;
+
+// this thread's counters and open regions
+static __thread struct {
+  bool opened;
+  group_t groups[GROUPS];
+  int depth;
+  struct {
+    const char* name;
+    totals_t start;
+  } stack[MAX_DEPTH];
+} self;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static region_t regions[MAX_REGIONS];
+static int regionCount;
+static bool seen[EVENTS];     // opened by some thread
+static int missingErr[EVENTS]; // errno of the first failed open
+static int enabled = -1;       // HPC_REGIONS, read on first use
+// libhpcalloc.so's, when it is preloaded: told the innermost region (alloc.c)
+static void (*allocPhase)(const char* name);
+
+// ------------------------ counters ------------------------
+
+static bool is_intel(void)
+{
+  unsigned a, b, c, d;
+  if(!__get_cpuid(0, &a, &b, &c, &d)) return false;
+  return b == 0x756e6547 && d == 0x49656e69 && c == 0x6c65746e; // "GenuineIntel"
+}
+
+static int perf_open(event_id_t ev, int leader)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = events[ev].type;
+  attr.config = events[ev].config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1; // all perf_event_paranoid <= 2 allows
+  attr.exclude_hv = 1;
+
+  // this thread only, on any CPU
+  return syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void open_counters(void)
+{
+  bool intel = is_intel();
+  bool opened[EVENTS] = { false };
+  int err[EVENTS] = { 0 };
+
+  for(int g = 0; g < GROUPS; g++) {
+    group_t* group = &self.groups[g];
+    group->fd = -1;
+    group->members = 0;
+
+    for(int ev = 0; ev < EVENTS; ev++) {
+      if(events[ev].group != (group_id_t)g) continue;
+      if(g == GROUP_FP && !intel) {
+        err[ev] = ENOENT;
+        continue;
+      }
+
+      // a missing member only loses itself, a missing leader its whole group
+      int fd = perf_open(ev, group->fd);
+      if(fd < 0) {
+        err[ev] = errno;
+        if(group->fd < 0) {
+          for(int rest = ev + 1; rest < EVENTS; rest++) {
+            if(events[rest].group == (group_id_t)g) err[rest] = errno;
+          }
+          break;
+        }
+        continue;
+      }
+
+      if(group->fd < 0) group->fd = fd;
+      group->ids[group->members++] = ev;
+      opened[ev] = true;
+    }
+  }
+
+  pthread_mutex_lock(&lock);
+  for(int ev = 0; ev < EVENTS; ev++) {
+    if(opened[ev]) seen[ev] = true;
+    else if(missingErr[ev] == 0) missingErr[ev] = err[ev];
+  }
+  pthread_mutex_unlock(&lock);
+
+  self.opened = true;
+}
+
+// counts so far, scaled up for any time the kernel had a group switched out
+static void read_counters(totals_t* t)
+{
+  memset(t, 0, sizeof(*t));
+
+  for(int g = 0; g < GROUPS; g++) {
+    group_t* group = &self.groups[g];
+    if(group->fd < 0) continue;
+
+    uint64_t buf[3 + EVENTS];
+    if(read(group->fd, buf, sizeof(uint64_t) * (3 + group->members)) < 0) continue;
+
+    // nr, time enabled, time running, then the values in opening order
+    double scale = (buf[2] > 0 && buf[2] < buf[1] ? (double)buf[1] / buf[2] : 1.0);
+    for(int i = 0; i < group->members && i < (int)buf[0]; i++) t->count[group->ids[i]] = buf[3 + i] * scale;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  t->ns = now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// ------------------------ regions ------------------------
+
+static bool regions_on(void)
+{
+  if(enabled < 0) {
+    const char* v = getenv("HPC_REGIONS");
+    enabled = (v != NULL && *v != '\0' && strcmp(v, "0") != 0);
+    allocPhase = (void (*)(const char*))dlsym(RTLD_DEFAULT, "hpc_alloc_phase");
+  }
+  return enabled;
+}
+
+void hpc_region_begin(const char* name)
+{
+  if(!regions_on()) return;
+  if(!self.opened) open_counters();
+
+  if(self.depth == MAX_DEPTH) {
+    fprintf(stderr, "hpc_region_begin(\"%s\"): regions nested more than %d deep\n", name, MAX_DEPTH);
+    exit(1);
+  }
+
+  if(allocPhase != NULL) allocPhase(name);
+  self.stack[self.depth].name = name;
+  read_counters(&self.stack[self.depth].start); // last, so the setup is not counted
+  self.depth++;
+}
+
+void hpc_region_flops(double flops)
+{
+  if(!regions_on() || self.depth == 0) return;
+  self.stack[self.depth - 1].start.flops += flops;
+}
+
+void hpc_region_end(const char* name)
+{
+  if(!regions_on()) return;
+
+  totals_t now;
+  read_counters(&now); // first, so the bookkeeping is not counted
+
+  if(self.depth == 0 || strcmp(self.stack[self.depth - 1].name, name) != 0) {
+    fprintf(stderr, "hpc_region_end(\"%s\"): the open region is \"%s\"\n", name,
+            self.depth > 0 ? self.stack[self.depth - 1].name : "(none)");
+    exit(1);
+  }
+  totals_t* start = &self.stack[--self.depth].start;
+  if(allocPhase != NULL) allocPhase(self.depth > 0 ? self.stack[self.depth - 1].name : NULL);
+
+  pthread_mutex_lock(&lock);
+  int r = 0;
+  while(r < regionCount && strcmp(regions[r].name, name) != 0) r++;
+  if(r == regionCount) {
+    if(regionCount == MAX_REGIONS) {
+      pthread_mutex_unlock(&lock);
+      fprintf(stderr, "hpc_region_end(\"%s\"): more than %d regions\n", name, MAX_REGIONS);
+      exit(1);
+    }
+    regions[regionCount++].name = strdup(name);
+  }
+
+  region_t* region = &regions[r];
+  region->calls++;
+  for(int ev = 0; ev < EVENTS; ev++) region->sum.count[ev] += now.count[ev] - start->count[ev];
+  region->sum.ns += now.ns - start->ns;
+  region->sum.flops += start->flops; // hpc_region_flops() adds to the start
+  pthread_mutex_unlock(&lock);
+}
+
+// ------------------------ report ------------------------
+
+// value formatted into a column, or "-" when one of its counters is missing
+static void column(char* buf, size_t n, bool have, const char* fmt, double value)
+{
+  if(have) snprintf(buf, n, fmt, value);
+  else snprintf(buf, n, "-");
+}
+
+__attribute__((destructor))
+static void region_report(void)
+{
+  if(regionCount == 0) return;
+
+  bool haveCore = seen[EV_CYCLES] && seen[EV_INSTRUCTIONS];
+  bool haveFp = seen[EV_FP_SCALAR] && seen[EV_FP_128] && seen[EV_FP_256];
+
+  fprintf(stderr, "hpc_region: counted");
+  for(int ev = 0; ev < EVENTS; ev++) if(seen[ev]) fprintf(stderr, " %s", events[ev].name);
+  fprintf(stderr, "\n");
+  // one reason for each run of events that failed the same way
+  bool missing = false;
+  for(int ev = 0; ev < EVENTS; ev++) {
+    if(seen[ev]) continue;
+    fprintf(stderr, "%s %s", missing ? "" : "hpc_region: missing", events[ev].name);
+    missing = true;
+
+    int next = ev + 1;
+    while(next < EVENTS && seen[next]) next++;
+    if(next == EVENTS || missingErr[next] != missingErr[ev]) fprintf(stderr, " (%s)", strerror(missingErr[ev]));
+  }
+  if(missing) fprintf(stderr, "\n");
+
+  fprintf(stderr, "%-16s %7s %11s %6s %9s %9s %9s %9s %8s %8s\n",
+          "region", "calls", "time ms", "IPC", "L1D MPKI", "LLC MPKI", "dTLB MPKI", "GFLOP/s", "B/flop", "faults");
+
+  for(int r = 0; r < regionCount; r++) {
+    totals_t* s = &regions[r].sum;
+    double kinstr = s->count[EV_INSTRUCTIONS] / 1000.0;
+
+    // measured flops when there are FP counters, the nominal ones otherwise
+    double flops = s->flops;
+    if(haveFp) {
+      flops = 0.0;
+      for(int ev = EV_FP_SCALAR; ev <= EV_FP_512; ev++) flops += s->count[ev] * events[ev].flops;
+    }
+
+    char ipc[16], l1d[16], llc[16], dtlb[16], gflops[16], bpf[16], faults[16];
+    column(ipc, sizeof(ipc), haveCore && s->count[EV_CYCLES] > 0, "%.2f", s->count[EV_INSTRUCTIONS] / s->count[EV_CYCLES]);
+    column(l1d, sizeof(l1d), seen[EV_L1D] && kinstr > 0, "%.2f", s->count[EV_L1D] / kinstr);
+    column(llc, sizeof(llc), seen[EV_LLC] && kinstr > 0, "%.3f", s->count[EV_LLC] / kinstr);
+    column(dtlb, sizeof(dtlb), seen[EV_DTLB] && kinstr > 0, "%.3f", s->count[EV_DTLB] / kinstr);
+    column(gflops, sizeof(gflops), flops > 0 && s->ns > 0, "%.2f", flops / s->ns);
+    column(bpf, sizeof(bpf), seen[EV_LLC] && flops > 0, "%.4f", s->count[EV_LLC] * 64.0 / flops);
+    column(faults, sizeof(faults), seen[EV_FAULTS], "%.0f", s->count[EV_FAULTS]);
+
+    fprintf(stderr, "%-16s %7lu %11.3f %6s %9s %9s %9s %9s %8s %8s\n", regions[r].name, (unsigned long)regions[r].calls,
+            s->ns * 1e-6, ipc, l1d, llc, dtlb, gflops, bpf, faults);
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef HPC_REGION_H
+#define HPC_REGION_H
+
+/**
+ * Hardware counters over named regions of code, per thread:
+ *
+ *   hpc_region_begin("mul");
+ *   hpc_region_flops(2.0 * M * N * K);   // optional, see below
+ *   C = mul(A, B);
+ *   hpc_region_end("mul");
+ *
+ * Each thread opens its own perf_event counter groups the first time it
+ * begins a region: {cycles, instructions, L1D read misses, LLC read misses,
+ * dTLB read misses}, the FP_ARITH_INST_RETIRED counts on Intel (scalar and
+ * 128/256/512-bit packed single, weighted by lanes; an FMA counts twice),
+ * and the page faults and context switches. A group is scheduled as a unit,
+ * so ratios inside it are exact; when the kernel has to time-share groups
+ * the counts are scaled by the fraction of time each one ran.
+ *
+ * At exit every region is reported to stderr, summed over its calls and
+ * threads: time, IPC, misses per 1000 instructions, GFLOP/s and the bytes of
+ * memory traffic (LLC misses x 64) per flop. Counters that cannot be opened
+ * (no PMU in a VM, perf_event_paranoid, another vendor's FP events) are left
+ * out of the report, down to only the time; hpc_region_flops() gives the
+ * flop count to use in place of missing FP counters.
+ *
+ * Regions nest. They are also the phases the allocation profiler
+ * (libhpcalloc.so, see alloc.c) reports by when it is preloaded.
+ * They are no-ops, with no report, unless HPC_REGIONS=1 is set in the
+ * environment (anything but unset, empty or 0).
+ * Link with -lhpctools (common/hpctools).
+ */
+
+void hpc_region_begin(const char* name);
+
+// name must be the innermost open region's
+void hpc_region_end(const char* name);
+
+// nominal flops of the innermost open region, added to its total
+void hpc_region_flops(double flops);
+
+#endif
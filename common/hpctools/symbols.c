@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <link.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbols.h"
+
+typedef struct {
+  uintptr_t start, end;
+  const char* name;
+} sym_t;
+
+static sym_t* syms;
+static size_t symCount, symCap;
+
+// the loaded objects' executable segments, in the same form
+static sym_t* mods;
+static size_t modCount, modCap;
+static pthread_once_t loaded = PTHREAD_ONCE_INIT;
+
+static void add(sym_t** list, size_t* count, size_t* cap, uintptr_t start, uintptr_t size, const char* name)
+{
+  if(*count == *cap) {
+    *cap = (*cap == 0 ? 4096 : *cap * 2);
+    *list = realloc(*list, sizeof(sym_t) * *cap);
+  }
+  // a size of 0 (hand written assembly) still names the address itself
+  (*list)[(*count)++] = (sym_t){ start, start + (size > 0 ? size : 1), strdup(name) };
+}
+
+// the function symbols of one ELF file mapped at bias
+static void load_elf(const char* path, uintptr_t bias)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+    close(fd);
+    return;
+  }
+
+  const char* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) return;
+
+  const Elf64_Ehdr* eh = (const Elf64_Ehdr*)base;
+  if(memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+     eh->e_shoff == 0 || eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) > (size_t)st.st_size) {
+    munmap((void*)base, st.st_size);
+    return;
+  }
+
+  // .symtab has everything .dynsym has and the static functions besides
+  const Elf64_Shdr* sh = (const Elf64_Shdr*)(base + eh->e_shoff);
+  const Elf64_Shdr* table = NULL;
+  for(int i = 0; i < eh->e_shnum; i++) {
+    if(sh[i].sh_type == SHT_SYMTAB) table = &sh[i];
+    else if(sh[i].sh_type == SHT_DYNSYM && table == NULL) table = &sh[i];
+  }
+
+  if(table != NULL && table->sh_link < eh->e_shnum) {
+    const Elf64_Sym* sym = (const Elf64_Sym*)(base + table->sh_offset);
+    const char* names = base + sh[table->sh_link].sh_offset;
+    size_t count = table->sh_size / sizeof(Elf64_Sym);
+
+    for(size_t i = 0; i < count; i++) {
+      if(ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || sym[i].st_shndx == SHN_UNDEF || sym[i].st_value == 0) continue;
+      add(&syms, &symCount, &symCap, bias + sym[i].st_value, sym[i].st_size, names + sym[i].st_name);
+    }
+  }
+
+  munmap((void*)base, st.st_size);
+}
+
+static int load_object(struct dl_phdr_info* info, size_t size, void* data)
+{
+  (void)size;
+  (void)data;
+
+  // the executable comes first, with no name
+  const char* path = info->dlpi_name;
+  if(path == NULL || path[0] == '\0') path = "/proc/self/exe";
+  load_elf(path, info->dlpi_addr);
+
+  const char* file = strrchr(info->dlpi_name, '/');
+  file = (file != NULL ? file + 1 : info->dlpi_name[0] != '\0' ? info->dlpi_name : program_invocation_short_name);
+  for(int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+    if(ph->p_type == PT_LOAD && (ph->p_flags & PF_X)) add(&mods, &modCount, &modCap, info->dlpi_addr + ph->p_vaddr, ph->p_memsz, file);
+  }
+
+  return 0;
+}
+
+static int by_start(const void* a, const void* b)
+{
+  uintptr_t x = ((const sym_t*)a)->start, y = ((const sym_t*)b)->start;
+  return (x > y) - (x < y);
+}
+
+static void load_all(void)
+{
+  dl_iterate_phdr(load_object, NULL);
+  if(symCount > 0) qsort(syms, symCount, sizeof(sym_t), by_start);
+  if(modCount > 0) qsort(mods, modCount, sizeof(sym_t), by_start);
+}
+
+// the entry of list containing a, NULL if none
+static const sym_t* find(const sym_t* list, size_t count, uintptr_t a)
+{
+  // last one starting at or before a
+  size_t lo = 0, hi = count;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(list[mid].start <= a) lo = mid + 1;
+    else hi = mid;
+  }
+  return (lo > 0 && a < list[lo - 1].end ? &list[lo - 1] : NULL);
+}
+
+const char* hpc_symbol(const void* addr, uintptr_t* offset)
+{
+  pthread_once(&loaded, load_all);
+
+  uintptr_t a = (uintptr_t)addr;
+  const sym_t* sym = find(syms, symCount, a);
+  if(sym != NULL) {
+    if(offset != NULL) *offset = a - sym->start;
+    return sym->name;
+  }
+
+  // loaded after the table was built
+  Dl_info dl;
+  if(dladdr(addr, &dl) != 0 && dl.dli_sname != NULL) {
+    if(offset != NULL) *offset = a - (uintptr_t)dl.dli_saddr;
+    return dl.dli_sname;
+  }
+
+  return NULL;
+}
+
+const char* hpc_module(const void* addr)
+{
+  pthread_once(&loaded, load_all);
+
+  const sym_t* mod = find(mods, modCount, (uintptr_t)addr);
+  return (mod != NULL ? mod->name : NULL);
+}
@@ -0,0 +1,24 @@
+#ifndef HPC_SYMBOLS_H
+#define HPC_SYMBOLS_H
+
+#include <stdint.h>
+
+/**
+ * Function names for code addresses, for the tools in this directory that
+ * record raw addresses while the program runs and name them afterwards.
+ *
+ * On first use the function symbols of the executable and of every shared
+ * object loaded at that point are read from their ELF files (.symtab, or
+ * .dynsym when stripped) into one sorted table, so static functions are
+ * named too, with or without -rdynamic. Anything else falls back to dladdr.
+ */
+
+// name of the function containing addr, NULL if unknown; *offset (if given)
+// is addr's distance from the function's start. Names live until exit.
+const char* hpc_symbol(const void* addr, uintptr_t* offset);
+
+// file name (without the directory) of the executable or shared object
+// mapping addr, NULL if none; for naming what hpc_symbol() cannot
+const char* hpc_module(const void* addr);
+
+#endif
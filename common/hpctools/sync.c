@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "symbols.h"
+
+/**
+ * Load imbalance of pthread programs: pthread_create, pthread_join,
+ * pthread_barrier_* and pthread_mutex_lock are interposed on an unmodified
+ * binary.
+ *
+ *   HPC_SYNC=1 LD_PRELOAD=../common/hpctools/libhpcsync.so ./approx_pi_parallel 100000000 4
+ *
+ * Threads are numbered in the order they are created, the main thread 0.
+ * Each one's time from its start to its end is split into waiting (in a
+ * barrier, in a join, or for a mutex another thread holds) and busy, the
+ * rest. A barrier's episodes are the phases: a thread's busy time in one is
+ * from when it left the barrier last (or started) to when it arrived, the
+ * arrival skew is the last arrival less the first, and the imbalance is the
+ * max/mean of the threads' busy times, the slowest thread the one with the
+ * max. A balanced phase is 1.0; at 1.5 the slowest thread worked half again
+ * the mean and the rest spent that difference waiting for it.
+ *
+ * At exit the report goes to stderr: per thread its busy time and its waits,
+ * and the busy max/mean over the threads; per barrier (named by where it was
+ * initialized) the episodes' mean and worst skew and imbalance and how often
+ * each thread was the slowest; then the worst episodes. Imbalance that moves
+ * from thread to thread is noise to steal work from; the same thread slowest
+ * every time is a partition to fix.
+ *
+ * Set in the environment:
+ *   HPC_SYNC=1             record (anything but unset, empty or 0)
+ *   HPC_SYNC_EPISODES=n    worst episodes to list per barrier, default 10
+ *
+ * An uncontended mutex is taken with a trylock and not timed. Only the first
+ * MAX_BARRIERS barriers initialized are followed, destroyed ones included;
+ * past that a warning goes to stderr once and the report counts the rest.
+ */
+
+#define MAX_THREADS 256
+#define MAX_BARRIERS 32
+#define DEFAULT_EPISODES 10
+
+typedef enum { WAIT_BARRIER, WAIT_JOIN, WAIT_MUTEX, WAITS } wait_t;
+
+typedef struct {
+  double start, end; // ns; end 0 while it runs
+  double wait[WAITS];
+  uint64_t waits[WAITS];
+} thread_t;
+
+typedef struct {
+  size_t index;
+  double skew, ratio; // ns, busy max/mean
+  int slowest;
+} episode_t;
+
+typedef struct {
+  const pthread_barrier_t* b; // NULL once destroyed
+  const void* site;           // return address of its pthread_barrier_init
+  unsigned count;
+  atomic_flag lock;
+  // the episode the threads are arriving at
+  unsigned arrived;
+  double first, last, sumBusy, maxBusy;
+  int slowest;
+  // the ones all threads have arrived at
+  episode_t* episodes;
+  size_t episodeCount, episodeCap;
+  uint64_t slowestCount[MAX_THREADS];
+} barrier_t;
+
+static int (*real_create)(pthread_t*, const pthread_attr_t*, void* (*)(void*), void*);
+static int (*real_join)(pthread_t, void**);
+static int (*real_barrier_init)(pthread_barrier_t*, const pthread_barrierattr_t*, unsigned);
+static int (*real_barrier_wait)(pthread_barrier_t*);
+static int (*real_barrier_destroy)(pthread_barrier_t*);
+static int (*real_mutex_lock)(pthread_mutex_t*);
+static int (*real_mutex_trylock)(pthread_mutex_t*);
+
+static bool on;
+static int topEpisodes;
+static thread_t threads[MAX_THREADS];
+static _Atomic int threadCount;
+static barrier_t barriers[MAX_BARRIERS];
+static _Atomic int barrierCount;
+static _Atomic int untracked; // barriers initialized past MAX_BARRIERS
+static pthread_key_t exitKey;
+
+static __thread int id = 0;             // -1 past MAX_THREADS
+static __thread double lastBarrier = 0; // when this thread left one last, or started
+
+static double now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void resolve(void)
+{
+  if(real_mutex_lock != NULL) return;
+  real_create = dlsym(RTLD_NEXT, "pthread_create");
+  real_join = dlsym(RTLD_NEXT, "pthread_join");
+  real_barrier_init = dlsym(RTLD_NEXT, "pthread_barrier_init");
+  real_barrier_wait = dlsym(RTLD_NEXT, "pthread_barrier_wait");
+  real_barrier_destroy = dlsym(RTLD_NEXT, "pthread_barrier_destroy");
+  real_mutex_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+  real_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+}
+
+static void add_wait(wait_t kind, double ns)
+{
+  if(id < 0) return;
+  threads[id].wait[kind] += ns;
+  threads[id].waits[kind]++;
+}
+
+// ------------------------ threads ------------------------
+
+typedef struct {
+  void* (*fn)(void*);
+  void* arg;
+  int id;
+} start_t;
+
+static void thread_exit(void* arg)
+{
+  threads[(intptr_t)arg - 1].end = now_ns();
+}
+
+static void* thread_start(void* arg)
+{
+  start_t start = *(start_t*)arg;
+  free(arg);
+
+  id = start.id;
+  if(id >= 0) {
+    lastBarrier = threads[id].start = now_ns();
+    pthread_setspecific(exitKey, (void*)(intptr_t)(id + 1)); // its end, however it ends
+  }
+  return start.fn(start.arg);
+}
+
+int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*fn)(void*), void* arg)
+{
+  resolve();
+  if(!on) return real_create(thread, attr, fn, arg);
+
+  start_t* start = malloc(sizeof(start_t));
+  if(start == NULL) return real_create(thread, attr, fn, arg);
+  start->fn = fn;
+  start->arg = arg;
+  start->id = atomic_fetch_add(&threadCount, 1);
+  if(start->id >= MAX_THREADS) start->id = -1;
+
+  int err = real_create(thread, attr, thread_start, start);
+  if(err != 0) free(start);
+  return err;
+}
+
+int pthread_join(pthread_t thread, void** result)
+{
+  resolve();
+  if(!on) return real_join(thread, result);
+
+  double t = now_ns();
+  int err = real_join(thread, result);
+  add_wait(WAIT_JOIN, now_ns() - t);
+  return err;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+  resolve();
+  if(!on) return real_mutex_lock(mutex);
+  if(real_mutex_trylock(mutex) == 0) return 0;
+
+  double t = now_ns();
+  int err = real_mutex_lock(mutex);
+  add_wait(WAIT_MUTEX, now_ns() - t);
+  return err;
+}
+
+// ------------------------ barriers ------------------------
+
+static void lock(barrier_t* b)
+{
+  while(atomic_flag_test_and_set_explicit(&b->lock, memory_order_acquire)) sched_yield();
+}
+
+static void unlock(barrier_t* b)
+{
+  atomic_flag_clear_explicit(&b->lock, memory_order_release);
+}
+
+static barrier_t* find(const pthread_barrier_t* barrier)
+{
+  int n = atomic_load(&barrierCount);
+  for(int i = n - 1; i >= 0; i--) {
+    if(barriers[i].b == barrier) return &barriers[i];
+  }
+  return NULL;
+}
+
+int pthread_barrier_init(pthread_barrier_t* barrier, const pthread_barrierattr_t* attr, unsigned count)
+{
+  resolve();
+  int err = real_barrier_init(barrier, attr, count);
+  if(!on || err != 0) return err;
+
+  int i = atomic_fetch_add(&barrierCount, 1);
+  if(i >= MAX_BARRIERS) {
+    atomic_store(&barrierCount, MAX_BARRIERS);
+    if(atomic_fetch_add(&untracked, 1) == 0) {
+      fprintf(stderr, "hpc_sync: more than %d barriers, the rest are not tracked\n", MAX_BARRIERS);
+    }
+    return 0;
+  }
+  barriers[i].site = __builtin_return_address(0);
+  barriers[i].count = count;
+  atomic_flag_clear(&barriers[i].lock);
+  barriers[i].b = barrier;
+  return 0;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t* barrier)
+{
+  resolve();
+  barrier_t* b = (on ? find(barrier) : NULL);
+  if(b != NULL) b->b = NULL; // the address may be a new barrier's next
+  return real_barrier_destroy(barrier);
+}
+
+// the last thread in closes the episode, before any thread can leave it
+static void arrive(barrier_t* b, double t)
+{
+  double busy = t - lastBarrier;
+
+  lock(b);
+  if(b->arrived == 0) {
+    b->first = t;
+    b->sumBusy = b->maxBusy = 0.0;
+    b->slowest = id;
+  }
+  b->arrived++;
+  b->last = t;
+  b->sumBusy += busy;
+  if(busy > b->maxBusy) {
+    b->maxBusy = busy;
+    b->slowest = id;
+  }
+
+  if(b->arrived == b->count) {
+    if(b->episodeCount == b->episodeCap) {
+      size_t cap = (b->episodeCap > 0 ? 2 * b->episodeCap : 64);
+      episode_t* grown = realloc(b->episodes, sizeof(episode_t) * cap);
+      if(grown != NULL) {
+        b->episodes = grown;
+        b->episodeCap = cap;
+      }
+    }
+    if(b->episodeCount < b->episodeCap) {
+      double mean = b->sumBusy / b->count;
+      b->episodes[b->episodeCount] = (episode_t){ b->episodeCount, b->last - b->first, mean > 0 ? b->maxBusy / mean : 1.0, b->slowest };
+      b->episodeCount++;
+    }
+    if(b->slowest >= 0) b->slowestCount[b->slowest]++;
+    b->arrived = 0;
+  }
+  unlock(b);
+}
+
+int pthread_barrier_wait(pthread_barrier_t* barrier)
+{
+  resolve();
+  barrier_t* b = (on ? find(barrier) : NULL);
+  if(b == NULL) return real_barrier_wait(barrier);
+
+  double t = now_ns();
+  arrive(b, t);
+  int err = real_barrier_wait(barrier);
+  lastBarrier = now_ns();
+  add_wait(WAIT_BARRIER, lastBarrier - t);
+  return err;
+}
+
+__attribute__((constructor))
+static void sync_start(void)
+{
+  resolve();
+  const char* v = getenv("HPC_SYNC");
+  if(v == NULL || *v == '\0' || strcmp(v, "0") == 0) return;
+
+  v = getenv("HPC_SYNC_EPISODES");
+  topEpisodes = (v != NULL ? atoi(v) : DEFAULT_EPISODES);
+  if(topEpisodes < 0) topEpisodes = DEFAULT_EPISODES;
+
+  pthread_key_create(&exitKey, thread_exit);
+  atomic_store(&threadCount, 1);
+  lastBarrier = threads[0].start = now_ns();
+  on = true;
+}
+
+// ------------------------ report ------------------------
+
+static int by_ratio(const void* a, const void* b)
+{
+  const episode_t* x = a;
+  const episode_t* y = b;
+  return (x->ratio < y->ratio) - (x->ratio > y->ratio);
+}
+
+// where a barrier was initialized: "function+offset"
+static void site_name(char* buf, size_t n, const void* site)
+{
+  uintptr_t offset;
+  const char* fn = hpc_symbol((const char*)site - 1, &offset);
+  if(fn != NULL) snprintf(buf, n, "%s+%#lx", fn, (unsigned long)offset + 1);
+  else snprintf(buf, n, "%p", site);
+}
+
+__attribute__((destructor))
+static void sync_report(void)
+{
+  if(!on) return;
+  on = false;
+
+  double end = now_ns();
+  int n = atomic_load(&threadCount);
+  if(n > MAX_THREADS) n = MAX_THREADS;
+
+  fprintf(stderr, "hpc_sync: %d thread%s\n", n, n == 1 ? "" : "s");
+  fprintf(stderr, "%-8s %11s %11s %11s %11s %11s %7s\n", "thread", "time ms", "busy ms", "barrier ms", "join ms", "mutex ms", "wait %");
+
+  double maxBusy = 0.0, sumBusy = 0.0;
+  int slowest = 0;
+  for(int t = 0; t < n; t++) {
+    thread_t* th = &threads[t];
+    double life = (th->end > 0 ? th->end : end) - th->start;
+    double waited = th->wait[WAIT_BARRIER] + th->wait[WAIT_JOIN] + th->wait[WAIT_MUTEX];
+    double busy = life - waited;
+    sumBusy += busy;
+    if(busy > maxBusy) {
+      maxBusy = busy;
+      slowest = t;
+    }
+
+    fprintf(stderr, "%-8d %11.3f %11.3f %11.3f %11.3f %11.3f %6.1f%%\n", t, life * 1e-6, busy * 1e-6,
+            th->wait[WAIT_BARRIER] * 1e-6, th->wait[WAIT_JOIN] * 1e-6, th->wait[WAIT_MUTEX] * 1e-6,
+            life > 0 ? 100.0 * waited / life : 0.0);
+  }
+  if(n > 1 && sumBusy > 0) {
+    fprintf(stderr, "hpc_sync: busy max/mean %.2f, slowest thread %d\n", maxBusy / (sumBusy / n), slowest);
+  }
+
+  int count = atomic_load(&barrierCount);
+  if(count > MAX_BARRIERS) count = MAX_BARRIERS;
+  int missed = atomic_load(&untracked);
+  if(missed > 0) fprintf(stderr, "hpc_sync: %d barrier%s past the first %d not tracked\n", missed, missed == 1 ? "" : "s", MAX_BARRIERS);
+  for(int i = 0; i < count; i++) {
+    barrier_t* b = &barriers[i];
+    if(b->episodeCount == 0) continue;
+
+    double skew = 0.0, maxSkew = 0.0, ratio = 0.0;
+    for(size_t e = 0; e < b->episodeCount; e++) {
+      skew += b->episodes[e].skew;
+      ratio += b->episodes[e].ratio;
+      if(b->episodes[e].skew > maxSkew) maxSkew = b->episodes[e].skew;
+    }
+
+    char where[64];
+    site_name(where, sizeof(where), b->site);
+    fprintf(stderr, "barrier %s (%u threads): %zu episodes, skew mean %.3f max %.3f ms, busy max/mean mean %.2f\n",
+            where, b->count, b->episodeCount, skew / b->episodeCount * 1e-6, maxSkew * 1e-6, ratio / b->episodeCount);
+    fprintf(stderr, "  slowest:");
+    for(int t = 0; t < n; t++) {
+      if(b->slowestCount[t] > 0) fprintf(stderr, " thread %d x%lu", t, (unsigned long)b->slowestCount[t]);
+    }
+    fprintf(stderr, "\n");
+
+    // the worst phases, by imbalance
+    size_t show = (b->episodeCount < (size_t)topEpisodes ? b->episodeCount : (size_t)topEpisodes);
+    if(show == 0) continue;
+    qsort(b->episodes, b->episodeCount, sizeof(episode_t), by_ratio);
+
+    fprintf(stderr, "  %8s %9s %9s %8s\n", "episode", "skew ms", "max/mean", "slowest");
+    for(size_t e = 0; e < show; e++) {
+      episode_t* ep = &b->episodes[e];
+      fprintf(stderr, "  %8zu %9.3f %9.2f %8d\n", ep->index, ep->skew * 1e-6, ep->ratio, ep->slowest);
+    }
+  }
+}
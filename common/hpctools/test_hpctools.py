@@ -0,0 +1,327 @@
+import pytest
+
+import json
+import os
+import subprocess
+from collections import Counter
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# src compiled against the libraries here, each test program in a directory of its own
+def build(tmp_path_factory, src, cflags, libs):
+  subprocess.run(['make', '-C', HERE], check=True, capture_output=True)
+
+  path = tmp_path_factory.mktemp('prog') / 'prog.c'
+  path.write_text(src)
+  exe = path.with_suffix('')
+  subprocess.run(['gcc', *cflags, '-I' + os.path.dirname(HERE), str(path), '-o', str(exe), '-L' + HERE, *libs], check=True)
+  return exe
+
+# two threads calling a cheap leaf under outer, and one slow call
+TRACEE = r'''
+#include <pthread.h>
+#include <unistd.h>
+
+int leaf(int x) { return x * 3 + 1; }
+
+int outer(int n) {
+  int sum = 0;
+  for(int i = 0; i < n; i++) sum += leaf(i);
+  return sum;
+}
+
+void slow(void) { usleep(3000); }
+
+void* work(void* arg) { outer(1000); return arg; }
+
+int main(void) {
+  pthread_t t;
+  pthread_create(&t, NULL, work, NULL);
+  work(NULL);
+  pthread_join(t, NULL);
+  slow();
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def tracee(tmp_path_factory):
+  return build(tmp_path_factory, TRACEE, ['-O0', '-finstrument-functions', '-pthread'], ['-lhpctrace', '-ldl'])
+
+def run(tracee, tmp_path, **env):
+  path = tmp_path / 'trace.json'
+  env = dict(os.environ, HPC_TRACE_FILE=str(path), **{'HPC_TRACE_' + k: str(v) for k, v in env.items()})
+  result = subprocess.run([str(tracee)], env=env, capture_output=True, text=True, check=True)
+  assert 'written to' in result.stderr
+
+  with open(path) as fh:
+    trace = json.load(fh)
+  calls = [e for e in trace['traceEvents'] if e['ph'] == 'X']
+  return trace, calls, Counter(e['name'] for e in calls)
+
+def test_all_calls(tracee, tmp_path):
+  trace, calls, counts = run(tracee, tmp_path)
+
+  assert counts['leaf'] == 2000
+  assert counts['outer'] == 2 and counts['work'] == 2 and counts['slow'] == 1
+  assert len({e['tid'] for e in calls}) == 2
+  assert trace['otherData']['overwritten'] == 0
+
+  # outer spans its leaves
+  outer = next(e for e in calls if e['name'] == 'outer')
+  leaves = [e for e in calls if e['name'] == 'leaf' and e['tid'] == outer['tid']]
+  assert all(outer['ts'] <= e['ts'] and e['ts'] + e['dur'] <= outer['ts'] + outer['dur'] + 0.01 for e in leaves)
+
+  slow = next(e for e in calls if e['name'] == 'slow')
+  assert slow['dur'] >= 3000
+
+def test_filter(tracee, tmp_path):
+  _, _, counts = run(tracee, tmp_path, FILTER='^(outer|slow)$')
+
+  assert counts == Counter({'outer': 2, 'slow': 1})
+
+def test_sample(tracee, tmp_path):
+  _, _, counts = run(tracee, tmp_path, FILTER='^leaf$', SAMPLE=10)
+
+  assert counts == Counter({'leaf': 200})
+
+def test_min_duration(tracee, tmp_path):
+  _, _, counts = run(tracee, tmp_path, MIN_NS=2000000)
+
+  assert counts['slow'] == 1 and counts['leaf'] == 0
+
+def test_ring_overwrites(tracee, tmp_path):
+  trace, calls, counts = run(tracee, tmp_path, FILTER='^leaf$', BUFFER=100)
+
+  # 128 per thread: the last of each thread's calls
+  assert counts['leaf'] == 256
+  assert trace['otherData']['overwritten'] == 2000 - 256
+
+# -O2 and no hooks: the profiler works on the binary as shipped
+PROFILEE = r'''
+#include <stdlib.h>
+
+__attribute__((noinline)) double burn(long n) {
+  double x = 0.0;
+  for(long i = 0; i < n; i++) x += (double)i / (double)(i + 1);
+  return x;
+}
+
+int main(int argc, char* argv[]) {
+  return burn(atol(argv[1])) < 0.0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def profilee(tmp_path_factory):
+  return build(tmp_path_factory, PROFILEE, ['-O2'], [])
+
+def test_profile(profilee, tmp_path):
+  path = tmp_path / 'profile.folded'
+  env = dict(os.environ, HPC_PROFILE='1', HPC_PROFILE_FILE=str(path), LD_PRELOAD=os.path.join(HERE, 'libhpcprof.so'))
+  result = subprocess.run([str(profilee), '200000000'], env=env, capture_output=True, text=True, check=True)
+  assert 'written to' in result.stderr
+
+  stacks = {}
+  for line in path.read_text().splitlines():
+    stack, count = line.rsplit(' ', 1)
+    stacks[stack] = int(count)
+
+  # root first, and nearly all of the time in burn
+  burning = sum(count for stack, count in stacks.items() if stack.endswith('main;burn'))
+  assert burning >= 0.9 * sum(stacks.values()) and burning >= 20
+
+REGIONS = r'''
+#include <stdlib.h>
+#include "hpctools/region.h"
+
+int main(int argc, char* argv[]) {
+  volatile float x = 0.0f;
+  for(int r = 0; r < 3; r++) {
+    hpc_region_begin("outer");
+    hpc_region_begin("inner");
+    for(int i = 0; i < 100000; i++) x += 1.0f;
+    hpc_region_flops(100000);
+    hpc_region_end("inner");
+    hpc_region_end(argc > 1 ? argv[1] : "outer");
+  }
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def regions(tmp_path_factory):
+  return build(tmp_path_factory, REGIONS, ['-O2'], ['-lhpctools'])
+
+def test_regions(regions):
+  result = subprocess.run([str(regions)], env=dict(os.environ, HPC_REGIONS='1'), capture_output=True, text=True, check=True)
+
+  # whichever counters this machine has, every region gets its calls, time and GFLOP/s
+  rows = {line.split()[0]: line.split() for line in result.stderr.splitlines() if line.split()[:1] in (['inner'], ['outer'])}
+  assert set(rows) == {'inner', 'outer'}
+  assert rows['inner'][1] == '3' and rows['outer'][1] == '3'
+  assert float(rows['outer'][2]) >= float(rows['inner'][2]) > 0
+
+  # region calls time IPC L1D LLC dTLB GFLOP/s ...
+  assert rows['inner'][7] != '-'
+
+def test_region_mismatch(regions):
+  result = subprocess.run([str(regions), 'other'], env=dict(os.environ, HPC_REGIONS='1'), capture_output=True, text=True)
+
+  assert result.returncode == 1
+  assert 'the open region is "outer"' in result.stderr
+
+ALLOCEE = r'''
+#include <stdlib.h>
+#include <pthread.h>
+#include "hpctools/region.h"
+
+char* rows[2][100];
+
+__attribute__((noinline)) void make_rows(char** r) {
+  for(int i = 0; i < 100; i++) r[i] = malloc(1000);
+}
+
+void* work(void* arg) {
+  char** r = arg;
+  hpc_region_begin("rows");
+  make_rows(r);
+  hpc_region_end("rows");
+  hpc_region_begin("free");
+  for(int i = 0; i < 100; i++) free(r[i]);
+  hpc_region_end("free");
+  return NULL;
+}
+
+int main(void) {
+  pthread_t t;
+  pthread_create(&t, NULL, work, rows[1]);
+  work(rows[0]);
+  pthread_join(t, NULL);
+  free(realloc(malloc(10), 5000));
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def allocee(tmp_path_factory):
+  return build(tmp_path_factory, ALLOCEE, ['-O2', '-pthread'], ['-lhpctools'])
+
+def test_alloc(allocee):
+  env = dict(os.environ, HPC_ALLOC='1', HPC_REGIONS='1', LD_PRELOAD=os.path.join(HERE, 'libhpcalloc.so'))
+  result = subprocess.run([str(allocee)], env=env, capture_output=True, text=True, check=True)
+  lines = result.stderr.splitlines()
+
+  # phase malloc calloc realloc free bytes freed ...
+  start = next(i for i, line in enumerate(lines) if line.startswith('phase'))
+  phases = {line.split()[0]: line.split() for line in lines[start + 1:] if line.split()[:1] in (['rows'], ['free'])}
+  assert phases['rows'][1:5] == ['200', '0', '0', '0'] and phases['rows'][5] == '200.0kB'
+  assert phases['free'][1:5] == ['0', '0', '0', '200']
+  assert 'hpc_alloc: 2 threads' in result.stderr
+
+  # the realloc outside any region
+  none = next(line for line in lines[start + 1:] if line.startswith('(no region)'))[len('(no region)'):].split()
+  assert int(none[2]) >= 1
+
+  # biggest call site first: in make_rows, under rows
+  sites = next(i for i, line in enumerate(lines) if line.startswith('call site'))
+  site = lines[sites + 1].split()
+  assert site[0].startswith('make_rows+') and site[1:4] == ['rows', '200', '200.0kB']
+
+# thread 2 works 4x as long as 0 and 1 before each of 20 barriers
+SYNCEE = r'''
+#include <pthread.h>
+#include <unistd.h>
+
+pthread_barrier_t barrier;
+
+void* work(void* arg) {
+  long id = (long)arg;
+  for(int i = 0; i < 20; i++) {
+    usleep(id == 2 ? 2000 : 500);
+    pthread_barrier_wait(&barrier);
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t t[3];
+  pthread_barrier_init(&barrier, NULL, 3);
+  for(long i = 1; i < 3; i++) pthread_create(&t[i], NULL, work, (void*)i);
+  work(0);
+  for(int i = 1; i < 3; i++) pthread_join(t[i], NULL);
+  pthread_barrier_destroy(&barrier);
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def syncee(tmp_path_factory):
+  return build(tmp_path_factory, SYNCEE, ['-O2', '-pthread'], [])
+
+def test_sync(syncee):
+  env = dict(os.environ, HPC_SYNC='1', HPC_SYNC_EPISODES='3', LD_PRELOAD=os.path.join(HERE, 'libhpcsync.so'))
+  result = subprocess.run([str(syncee)], env=env, capture_output=True, text=True, check=True)
+  lines = result.stderr.splitlines()
+
+  # thread time busy barrier join mutex wait%
+  start = next(i for i, line in enumerate(lines) if line.startswith('thread'))
+  rows = {line.split()[0]: [float(x.rstrip('%')) for x in line.split()[1:]] for line in lines[start + 1:start + 4]}
+  assert set(rows) == {'0', '1', '2'}
+  assert rows['2'][1] > 3 * rows['1'][1]
+  assert rows['0'][2] > rows['2'][2] and rows['1'][2] > rows['2'][2]
+
+  barrier = next(line for line in lines if line.startswith('barrier main+'))
+  assert '(3 threads): 20 episodes' in barrier
+  assert float(barrier.split('busy max/mean mean ')[1]) > 1.5
+  assert 'slowest: thread 2 x20' in result.stderr
+
+  # the 3 worst episodes, all thread 2's
+  at = next(i for i, line in enumerate(lines) if line.split()[:1] == ['episode'])
+  worst = [line.split() for line in lines[at + 1:at + 4]]
+  assert len(worst) == 3 and all(w[3] == '2' for w in worst)
+
+
+# a barrier per round, as a loop building one for each step would
+MANY_BARRIERS = r'''
+#include <pthread.h>
+
+int main(void) {
+  for(int i = 0; i < 40; i++) {
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, 1);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_destroy(&barrier);
+  }
+  return 0;
+}
+'''
+
+def test_sync_barrier_limit(tmp_path_factory):
+  exe = build(tmp_path_factory, MANY_BARRIERS, ['-O2', '-pthread'], [])
+  env = dict(os.environ, HPC_SYNC='1', LD_PRELOAD=os.path.join(HERE, 'libhpcsync.so'))
+  result = subprocess.run([str(exe)], env=env, capture_output=True, text=True, check=True)
+
+  assert result.stderr.count('more than 32 barriers, the rest are not tracked') == 1
+  assert 'hpc_sync: 8 barriers past the first 32 not tracked' in result.stderr
+  assert result.stderr.count('barrier main+') == 32
+
+# switched off, every tool stays silent and writes nothing: None unsets a variable
+@pytest.mark.parametrize('program, args, env, preload', [
+  ('tracee', [], {'HPC_TRACE': '0', 'HPC_TRACE_FILE': 'out'}, None),
+  ('profilee', ['1000'], {'HPC_PROFILE': None, 'HPC_PROFILE_FILE': 'out'}, 'libhpcprof.so'),
+  ('regions', ['other'], {'HPC_REGIONS': None}, None),
+  ('allocee', [], {'HPC_ALLOC': None, 'HPC_REGIONS': None}, 'libhpcalloc.so'),
+  ('syncee', [], {'HPC_SYNC': None}, 'libhpcsync.so'),
+])
+def test_off(request, tmp_path, program, args, env, preload):
+  exe = request.getfixturevalue(program)
+  run_env = dict(os.environ)
+  for key, value in env.items():
+    if value is None: run_env.pop(key, None)
+    else: run_env[key] = str(tmp_path / value) if value == 'out' else value
+  if preload is not None: run_env['LD_PRELOAD'] = os.path.join(HERE, preload)
+  result = subprocess.run([str(exe), *args], env=run_env, capture_output=True, text=True)
+
+  assert result.returncode == 0 and result.stderr == ''
+  assert list(tmp_path.iterdir()) == []
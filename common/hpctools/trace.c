@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <regex.h>
+#include <x86intrin.h>
+#include <sys/syscall.h>
+
+#include "fastout.h"
+#include "symbols.h"
+#include "trace.h"
+
+// deeper calls are still counted so enter and exit stay paired, but not recorded
+#define MAX_DEPTH 256
+#define FILTER_BITS 10
+#define FILTER_SLOTS (1 << FILTER_BITS)
+#define DEFAULT_RECORDS (1 << 16)
+
+typedef struct {
+  const void* fn;
+  uint64_t start, dur; // TSC ticks
+} record_t;
+
+typedef struct {
+  const void* fn;
+  uint64_t start;
+  bool keep;
+} frame_t;
+
+typedef struct buffer {
+  struct buffer* next; // every thread's buffer, for the writer at exit
+  pid_t tid;
+  _Atomic uint64_t head; // records ever written; the ring keeps the last `records`
+  uint64_t skip;         // calls passing the filter before the next one sampled
+  int depth;
+  frame_t stack[MAX_DEPTH];
+  struct {
+    const void* fn;
+    bool match;
+  } filter[FILTER_SLOTS]; // open addressing, by function address
+  record_t ring[];
+} buffer_t;
+
+static struct {
+  bool ready; // configured; the hooks do nothing before (other constructors)
+  bool hasFilter;
+  regex_t filter;
+  uint64_t minTicks, sample, records;
+  const char* path;
+  uint64_t tsc0;
+  struct timespec t0;
+} cfg;
+
+static atomic_bool on;
+static _Atomic(buffer_t*) buffers;
+static __thread buffer_t* mine;
+
+static buffer_t* new_buffer(void)
+{
+  buffer_t* b = calloc(1, sizeof(buffer_t) + sizeof(record_t) * cfg.records);
+  if(b == NULL) return NULL;
+  b->tid = syscall(SYS_gettid);
+
+  // the only write any thread shares, once per thread
+  b->next = atomic_load(&buffers);
+  while(!atomic_compare_exchange_weak(&buffers, &b->next, b));
+
+  return b;
+}
+
+static bool matches(buffer_t* b, const void* fn)
+{
+  size_t slot = ((uintptr_t)fn * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - FILTER_BITS);
+  for(int probe = 0; probe < FILTER_SLOTS; probe++, slot = (slot + 1) & (FILTER_SLOTS - 1)) {
+    if(b->filter[slot].fn == fn) return b->filter[slot].match;
+    if(b->filter[slot].fn == NULL) break;
+  }
+
+  const char* name = hpc_symbol(fn, NULL);
+  bool match = (name != NULL && regexec(&cfg.filter, name, 0, NULL, 0) == 0);
+
+  // a full table just means asking again next time
+  if(b->filter[slot].fn == NULL) {
+    b->filter[slot].fn = fn;
+    b->filter[slot].match = match;
+  }
+  return match;
+}
+
+static inline bool wanted(buffer_t* b, const void* fn)
+{
+  if(!atomic_load_explicit(&on, memory_order_relaxed)) return false;
+  if(cfg.hasFilter && !matches(b, fn)) return false;
+  if(b->skip > 0) {
+    b->skip--;
+    return false;
+  }
+  b->skip = cfg.sample - 1;
+  return true;
+}
+
+// ------------------------ hooks ------------------------
+
+void __cyg_profile_func_enter(void* fn, void* site)
+{
+  (void)site;
+
+  buffer_t* b = mine;
+  if(b == NULL) {
+    if(!atomic_load_explicit(&on, memory_order_relaxed) || (b = mine = new_buffer()) == NULL) return;
+  }
+
+  if(b->depth >= MAX_DEPTH) {
+    b->depth++;
+    return;
+  }
+
+  frame_t* f = &b->stack[b->depth++];
+  f->fn = fn;
+  f->keep = wanted(b, fn);
+  if(f->keep) f->start = __rdtsc(); // last, so the filter is not part of the time
+}
+
+void __cyg_profile_func_exit(void* fn, void* site)
+{
+  (void)site;
+
+  buffer_t* b = mine;
+  if(b == NULL || b->depth == 0) return;
+  if(--b->depth >= MAX_DEPTH) return;
+
+  // a different function means the stack was unwound past its hooks (longjmp)
+  frame_t* f = &b->stack[b->depth];
+  if(!f->keep || f->fn != fn) return;
+
+  uint64_t dur = __rdtsc() - f->start;
+  if(dur < cfg.minTicks) return;
+
+  uint64_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+  b->ring[head & (cfg.records - 1)] = (record_t){ fn, f->start, dur };
+  atomic_store_explicit(&b->head, head + 1, memory_order_release);
+}
+
+void hpc_trace_enable(bool enable)
+{
+  atomic_store(&on, enable && cfg.ready);
+}
+
+// ------------------------ setup ------------------------
+
+// TSC ticks per ns, measured from startup over at least 10 ms
+static double ticks_per_ns(void)
+{
+  struct timespec now;
+  double ns;
+  uint64_t tsc;
+  do {
+    tsc = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - cfg.t0.tv_sec) * 1e9 + (now.tv_nsec - cfg.t0.tv_nsec);
+  } while(ns < 1e7);
+
+  return (double)(tsc - cfg.tsc0) / ns;
+}
+
+static uint64_t env_uint(const char* name, uint64_t fallback)
+{
+  const char* v = getenv(name);
+  return (v != NULL && *v != '\0' ? strtoull(v, NULL, 10) : fallback);
+}
+
+__attribute__((constructor(101)))
+static void trace_init(void)
+{
+  const char* v = getenv("HPC_TRACE");
+  if(v != NULL && strcmp(v, "0") == 0) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &cfg.t0);
+  cfg.tsc0 = __rdtsc();
+
+  cfg.path = getenv("HPC_TRACE_FILE");
+  if(cfg.path == NULL || *cfg.path == '\0') cfg.path = "trace.json";
+
+  const char* filter = getenv("HPC_TRACE_FILTER");
+  if(filter != NULL && *filter != '\0') {
+    if(regcomp(&cfg.filter, filter, REG_EXTENDED | REG_NOSUB) != 0) {
+      fprintf(stderr, "hpc_trace: invalid HPC_TRACE_FILTER '%s'\n", filter);
+      exit(1);
+    }
+    cfg.hasFilter = true;
+  }
+
+  cfg.sample = env_uint("HPC_TRACE_SAMPLE", 1);
+  if(cfg.sample < 1) cfg.sample = 1;
+
+  // ring indices wrap by mask
+  uint64_t records = env_uint("HPC_TRACE_BUFFER", DEFAULT_RECORDS);
+  for(cfg.records = 1; cfg.records < records; cfg.records *= 2);
+
+  uint64_t minNs = env_uint("HPC_TRACE_MIN_NS", 0);
+  if(minNs > 0) cfg.minTicks = (uint64_t)(minNs * ticks_per_ns());
+
+  cfg.ready = true;
+  atomic_store(&on, true);
+}
+
+// ------------------------ output ------------------------
+
+// ticks after startup as µs with 3 decimals, the unit of trace events
+static void out_micros(out_t* out, uint64_t ticks, double perNs)
+{
+  uint64_t ns = (uint64_t)(ticks / perNs);
+  out_uint(out, ns / 1000);
+  out_char(out, '.');
+  out_char(out, '0' + ns / 100 % 10);
+  out_char(out, '0' + ns / 10 % 10);
+  out_char(out, '0' + ns % 10);
+}
+
+static void out_event_head(out_t* out, const char* name, const char* ph, pid_t pid, pid_t tid, bool* first)
+{
+  out_str(out, *first ? "\n" : ",\n");
+  *first = false;
+
+  out_str(out, "{\"name\":\"");
+  out_str(out, name); // C identifiers, nothing to escape
+  out_str(out, "\",\"ph\":\"");
+  out_str(out, ph);
+  out_str(out, "\",\"pid\":");
+  out_uint(out, pid);
+  out_str(out, ",\"tid\":");
+  out_uint(out, tid);
+}
+
+__attribute__((destructor(101)))
+static void trace_write(void)
+{
+  if(!cfg.ready) return;
+  atomic_store(&on, false);
+
+  int fd = open(cfg.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    fprintf(stderr, "hpc_trace: cannot write '%s'\n", cfg.path);
+    return;
+  }
+
+  double perNs = ticks_per_ns();
+  pid_t pid = getpid();
+  uint64_t events = 0, overwritten = 0;
+  int threads = 0;
+  bool first = true;
+
+  out_t out;
+  out_init(&out, fd, OUT_BUF_SIZE);
+  out_str(&out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  for(buffer_t* b = atomic_load(&buffers); b != NULL; b = b->next) {
+    uint64_t head = atomic_load_explicit(&b->head, memory_order_acquire);
+    uint64_t from = (head > cfg.records ? head - cfg.records : 0);
+    overwritten += from;
+    threads++;
+
+    out_event_head(&out, "thread_name", "M", pid, b->tid, &first);
+    out_str(&out, ",\"args\":{\"name\":\"");
+    out_str(&out, b->tid == pid ? "main" : "thread ");
+    if(b->tid != pid) out_uint(&out, b->tid);
+    out_str(&out, "\"}}");
+
+    for(uint64_t i = from; i < head; i++) {
+      record_t* r = &b->ring[i & (cfg.records - 1)];
+      char addr[32];
+      const char* name = hpc_symbol(r->fn, NULL);
+      if(name == NULL) {
+        snprintf(addr, sizeof(addr), "%p", r->fn);
+        name = addr;
+      }
+
+      out_event_head(&out, name, "X", pid, b->tid, &first);
+      out_str(&out, ",\"ts\":");
+      out_micros(&out, r->start > cfg.tsc0 ? r->start - cfg.tsc0 : 0, perNs);
+      out_str(&out, ",\"dur\":");
+      out_micros(&out, r->dur, perNs);
+      out_char(&out, '}');
+      events++;
+    }
+  }
+
+  out_str(&out, "\n],\"otherData\":{\"overwritten\":");
+  out_uint(&out, overwritten);
+  out_str(&out, "}}\n");
+  out_close(&out);
+  close(fd);
+
+  fprintf(stderr, "hpc_trace: %lu calls from %d threads written to %s", (unsigned long)events, threads, cfg.path);
+  if(overwritten > 0) fprintf(stderr, " (%lu older ones overwritten, see HPC_TRACE_BUFFER)", (unsigned long)overwritten);
+  fprintf(stderr, "\n");
+}
@@ -0,0 +1,34 @@
+#ifndef HPC_TRACE_H
+#define HPC_TRACE_H
+
+#include <stdbool.h>
+
+/**
+ * Function tracing through the -finstrument-functions hooks
+ * (__cyg_profile_func_enter/exit), in place of hpc-lib's: build a lab with
+ * `make TRACE=1` to link libhpctrace.a instead of -lhpc.
+ *
+ * A hook costs a TSC read and a few stores. Each thread has a shadow stack of
+ * entry times and a ring buffer of fixed size records {function address,
+ * start, duration}, both its own, so there are no locks or atomics per call;
+ * a full ring overwrites its oldest records (and says how many at exit).
+ * Addresses are only turned into names when the trace is written at exit,
+ * as Chrome trace events (open in chrome://tracing or ui.perfetto.dev).
+ *
+ * Set in the environment:
+ *   HPC_TRACE=0              no tracing at all
+ *   HPC_TRACE_FILE=path      default trace.json
+ *   HPC_TRACE_FILTER=regex   only functions whose name matches (POSIX extended)
+ *   HPC_TRACE_MIN_NS=n       drop calls shorter than n ns
+ *   HPC_TRACE_SAMPLE=n       keep 1 call in n (of those passing the filter)
+ *   HPC_TRACE_BUFFER=n       records per thread, default 65536
+ *
+ * The filter is matched once per function and thread and the answer cached,
+ * so a filtered out function costs one table lookup per call. Timestamps are
+ * raw TSC ticks, scaled to time at exit, so this assumes an invariant TSC.
+ */
+
+// stops or restarts recording in every thread, e.g. around setup code
+void hpc_trace_enable(bool on);
+
+#endif
@@ -7,6 +7,8 @@
 
 #include <hpc-lib/timing/timing.h>
 
+#include "fastout.h"
+
 typedef struct {
   int threshold;
   int maxIters;
@@ -135,15 +137,19 @@ void free_info(info_t* info) {
 }
 
 void  disp_mat(info_t* info) {
-  // loop through and print the matrix
-  printf("------------\n");
+  // loop through and print the matrix into one buffer, written out at the end
+  out_t out;
+  out_init(&out, STDOUT_FILENO, 12 * (size_t)info->rows * info->cols + 32);
+  out_str(&out, "------------\n");
   for(int row = 0; row < info->rows; row++) {
     for(int col = 0; col < info->cols; col++) {
-      printf("%d ", info->mat[row][col]);
+      out_int(&out, info->mat[row][col]);
+      out_char(&out, ' ');
     }
-    printf("\n");
+    out_char(&out, '\n');
   }
-  printf("------------\n");
+  out_str(&out, "------------\n");
+  out_close(&out);
 }
 
 
@@ -26,6 +26,8 @@
 #include <string.h>
 #include <stdbool.h> 
 
+#include "fastout.h"
+
 typedef struct {
   int gens;
   int rows, cols;
@@ -70,13 +72,18 @@ pos_t pindex(int x, int y) {
 
 __attribute__((no_instrument_function))
 void  disp_mat(info_t* info) {
+  // cells are 0/1, so two bytes each plus the newlines
+  out_t out;
+  out_init(&out, STDOUT_FILENO, (2 * (size_t)info->cols + 1) * info->rows);
   for(int row = 0; row < info->rows; row++) {
     for(int col = 0; col < info->cols; col++) {
       pos_t pos = pindex(col, row);
-      printf("%d ", info->mat[pos.y][pos.x]);
+      out_int(&out, info->mat[pos.y][pos.x]);
+      out_char(&out, ' ');
     }
-    printf("\n");
+    out_char(&out, '\n');
   }
+  out_close(&out);
 }
 
 __attribute__((no_instrument_function))
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sgemm.h"
+
+/**
+ * Outline:
+ * 1. parse argv:
+ *  1. <?--quick> <?--dry-run> <?path to config file, default=sgemm_config_path()>
+ * 2. for each size class, on random matrices of a representative size:
+ *  1. time the built-in blocking
+ *  2. line search each of kc, mc, nc, the micro-kernel and the thread grid in
+ *     turn, keeping whichever value is fastest, twice over
+ * 3. print the winners against the built-in blocking
+ * 4. save them under this host's CPU model (unless --dry-run); sgemm reads
+ *    them on its first multiply, so they apply to what goes through sgemm or
+ *    mat_mul: batch, chain and the mixed-form fallback of mul(). The SIMD
+ *    loops matrixrow, matrixcol and matrixrow256 run on same-form dense
+ *    inputs do not use them, nor do the sparse kernels (sparse.h).
+ */
+
+#define TUNE_PASSES 2
+
+// one representative product per class: full sizes, and --quick ones for checking the tuner itself
+static const int sizes[SGEMM_CLASSES] = { 128, 512, 1536 };
+static const int quickSizes[SGEMM_CLASSES] = { 96, 256, 800 };
+
+static const int mcs[] = { 48, 96, 144, 192, 288, 384 };
+static const int kcs[] = { 128, 192, 256, 384, 512, 768 };
+static const int ncs[] = { 516, 1020, 2052, 3072, 6144 };
+
+typedef struct {
+  bool quick, dryRun;
+  const char* path;
+  int cores;
+} info_t;
+
+typedef struct {
+  int n;
+  float *A, *B, *C;
+} problem_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+sgemm_config_t tune(info_t* info, sgemm_class_t cls, problem_t* p, double* builtinRate, double* bestRate);
+
+// ------------------------ main ------------------------
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  printf("tuning sgemm for '%s' (%d cores)\n", sgemm_cpu_model(), info->cores);
+
+  sgemm_config_t best[SGEMM_CLASSES];
+  for(int cls = 0; cls < SGEMM_CLASSES; cls++) {
+    int n = (info->quick ? quickSizes : sizes)[cls];
+    problem_t p = { n, malloc(sizeof(float) * n * n), malloc(sizeof(float) * n * n), malloc(sizeof(float) * n * n) };
+    for(int i = 0; i < n * n; i++) {
+      p.A[i] = (float)rand() / RAND_MAX - 0.5f;
+      p.B[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+
+    double builtinRate, bestRate;
+    best[cls] = tune(info, cls, &p, &builtinRate, &bestRate);
+    printf("%-6s (%4d): mc=%d kc=%d nc=%d kernel=%s grid=%dx%d  %.1f GFLOP/s (built-in %.1f, %+.0f%%)\n",
+           sgemm_class_names[cls], n, best[cls].mc, best[cls].kc, best[cls].nc, sgemm_kernel_names[best[cls].kernel],
+           best[cls].gridM, best[cls].gridN, bestRate, builtinRate, 100.0 * (bestRate / builtinRate - 1.0));
+
+    free(p.A);
+    free(p.B);
+    free(p.C);
+  }
+
+  if(!info->dryRun) {
+    if(info->path == NULL || !sgemm_save_config(info->path, best)) {
+      fprintf(stderr, "Failed to save the config to '%s'\n", info->path ? info->path : "(no path)");
+      exit(1);
+    }
+    printf("saved to %s\n", info->path);
+  }
+
+  free_info(info);
+}
+
+// ------------------------ main ------------------------
+
+__attribute__((no_instrument_function))
+info_t* parse_args(int argc, char* argv[])
+{
+  info_t* info = calloc(1, sizeof(*info));
+
+  int arg = 1;
+  for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if(strcmp(argv[arg], "--quick") == 0) info->quick = true;
+    else if(strcmp(argv[arg], "--dry-run") == 0) info->dryRun = true;
+    else break;
+  }
+
+  if(argc - arg > 1 || (arg < argc && strncmp(argv[arg], "--", 2) == 0)) {
+    printf("usage: %s <?--quick> <?--dry-run> <?path to config file, default=$SGEMM_CONFIG or ~/.sgemm.conf>\n", argv[0]);
+    free(info);
+    exit(0);
+  }
+
+  info->path = (arg < argc ? argv[arg] : sgemm_config_path());
+  info->cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if(info->cores < 1) info->cores = 1;
+  srand(40);
+
+  return info;
+}
+
+__attribute__((no_instrument_function))
+void free_info(info_t* info)
+{
+  free(info);
+}
+
+// ------------------------ tuning ------------------------
+
+// GFLOP/s of cfg on p, best of a few runs
+__attribute__((no_instrument_function))
+static double measure(info_t* info, sgemm_class_t cls, sgemm_config_t cfg, problem_t* p)
+{
+  sgemm_set_config(cls, cfg);
+
+  double best = 0.0;
+  int runs = (info->quick ? 2 : 4);
+  for(int r = 0; r < runs; r++) {
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sgemm('N', 'N', p->n, p->n, p->n, 1.0f, p->A, p->n, p->B, p->n, 0.0f, p->C, p->n);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+    double rate = 2.0 * p->n * p->n * p->n / secs * 1e-9;
+    if(rate > best) best = rate;
+  }
+  return best;
+}
+
+// tries every candidate for one field of *cfg, leaving the fastest in place
+__attribute__((no_instrument_function))
+static void search(info_t* info, sgemm_class_t cls, problem_t* p, sgemm_config_t* cfg, double* rate,
+                   int* field, const int* values, int count)
+{
+  for(int v = 0; v < count; v++) {
+    int old = *field;
+    if(values[v] == old) continue;
+
+    *field = values[v];
+    double r = measure(info, cls, *cfg, p);
+    if(r > *rate) *rate = r;
+    else *field = old;
+  }
+}
+
+sgemm_config_t tune(info_t* info, sgemm_class_t cls, problem_t* p, double* builtinRate, double* bestRate)
+{
+  sgemm_config_t cfg = sgemm_default_config();
+  measure(info, cls, cfg, p); // warm up the caches and the pack buffers
+  *builtinRate = measure(info, cls, cfg, p);
+  double rate = *builtinRate;
+
+  int kernels[sgemm_kernels];
+  for(int k = 0; k < sgemm_kernels; k++) kernels[k] = k;
+
+  for(int pass = 0; pass < TUNE_PASSES; pass++) {
+    search(info, cls, p, &cfg, &rate, &cfg.kc, kcs, sizeof(kcs) / sizeof(kcs[0]));
+    search(info, cls, p, &cfg, &rate, &cfg.mc, mcs, sizeof(mcs) / sizeof(mcs[0]));
+    search(info, cls, p, &cfg, &rate, &cfg.nc, ncs, sizeof(ncs) / sizeof(ncs[0]));
+    search(info, cls, p, &cfg, &rate, &cfg.kernel, kernels, sgemm_kernels);
+
+    // one core, or every split of all of them into a grid
+    for(int gm = 0; gm <= info->cores; gm++) {
+      if(gm > 0 && info->cores % gm != 0) continue;
+      sgemm_config_t grid = cfg;
+      grid.gridM = (gm == 0 ? 1 : gm);
+      grid.gridN = (gm == 0 ? 1 : info->cores / gm);
+      if(grid.gridM == cfg.gridM && grid.gridN == cfg.gridN) continue;
+
+      double r = measure(info, cls, grid, p);
+      if(r > rate) {
+        rate = r;
+        cfg = grid;
+      }
+    }
+  }
+
+  sgemm_set_config(cls, cfg);
+  *bestRate = rate;
+  return cfg;
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mat.h"
+#include "matbin.h"
+#include "matcache.h"
+#include "verify.h"
+
+/**
+ * Batch mode: every (A, B, out) job in a manifest multiplied in one process.
+ *
+ * Manifest: one job per line, "<path A> <path B> <path out>"; blank lines and
+ * lines starting with '#' are skipped. An output path ending in ".bin" is
+ * written in the binary format (see matbin.h), anything else as text with the
+ * same "rows cols" header as the inputs.
+ *
+ * All buffers come from BATCH_SLOTS slots sized to the largest job before the
+ * first multiply, so there are no allocations or fresh page faults per job.
+ * A slot goes around
+ *   free -> loader thread -> ready -> main thread (mul) -> done -> writer thread -> free
+ * so loading the next pair and writing the last result overlap the multiply.
+ * matbin inputs are mapped in place instead of being copied into the slot.
+ *
+ * B operands go through a mat_cache_t (--cache-mb, 0 turns it off), so jobs
+ * that share a B only pack it for the first of them.
+ */
+
+#define BATCH_CACHE_MB 256
+
+// one slot loading, one multiplying, one writing
+#define BATCH_SLOTS 3
+
+typedef struct {
+  char *pathA, *pathB, *pathOut;
+} job_t;
+
+typedef struct {
+  int job;
+  mat_t *bufA, *bufB, *bufC; // owned by the slot, reused for every job
+  mat_t *A, *B;              // bufA/bufB, or a mapped matbin file
+} slot_t;
+
+// blocking FIFO of slots; NULL is pushed to tell the consumer there is no more work
+typedef struct {
+  slot_t* items[BATCH_SLOTS + 1];
+  int head, count;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} queue_t;
+
+typedef struct {
+  job_t* jobs;
+  int numJobs;
+  slot_t slots[BATCH_SLOTS];
+  queue_t free, ready, done;
+  mat_cache_t* cache; // NULL when --cache-mb=0
+  verify_t verify;
+} info_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+void* load_jobs(void* arg);
+void* write_jobs(void* arg);
+int run_jobs(info_t* info);
+
+// ------------------------ main ------------------------
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pthread_t loader, writer;
+  pthread_create(&loader, NULL, load_jobs, info);
+  pthread_create(&writer, NULL, write_jobs, info);
+
+  int failed = run_jobs(info);
+
+  pthread_join(loader, NULL);
+  pthread_join(writer, NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+
+  printf("%d jobs in %.3f s (%.1f jobs/s)\n", info->numJobs, secs, info->numJobs / secs);
+  if(info->cache) {
+    printf("B cache: %ld hits, %ld misses, %ld evictions\n", info->cache->hits, info->cache->misses, info->cache->evictions);
+  }
+  if(info->verify.enabled) printf( failed == 0 ? "passed\n" : "failed\n" );
+
+  free_info(info);
+
+  return failed == 0 ? 0 : 1;
+}
+
+// ------------------------ main ------------------------
+
+__attribute__((no_instrument_function))
+static void queue_init(queue_t* queue)
+{
+  queue->head = queue->count = 0;
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->changed, NULL);
+}
+
+__attribute__((no_instrument_function))
+static void queue_destroy(queue_t* queue)
+{
+  pthread_mutex_destroy(&queue->lock);
+  pthread_cond_destroy(&queue->changed);
+}
+
+// never blocks: there are only BATCH_SLOTS slots and one NULL in flight
+__attribute__((no_instrument_function))
+static void queue_push(queue_t* queue, slot_t* slot)
+{
+  pthread_mutex_lock(&queue->lock);
+  queue->items[(queue->head + queue->count) % (BATCH_SLOTS + 1)] = slot;
+  queue->count++;
+  pthread_cond_signal(&queue->changed);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+__attribute__((no_instrument_function))
+static slot_t* queue_pop(queue_t* queue)
+{
+  pthread_mutex_lock(&queue->lock);
+  while(queue->count == 0) pthread_cond_wait(&queue->changed, &queue->lock);
+  slot_t* slot = queue->items[queue->head];
+  queue->head = (queue->head + 1) % (BATCH_SLOTS + 1);
+  queue->count--;
+  pthread_mutex_unlock(&queue->lock);
+  return slot;
+}
+
+__attribute__((no_instrument_function))
+static bool ends_with(char* str, char* suffix)
+{
+  size_t n = strlen(str), m = strlen(suffix);
+  return n >= m && strcmp(str + n - m, suffix) == 0;
+}
+
+// floats a row form rows x cols matrix takes, padding included (see mat_alloc)
+__attribute__((no_instrument_function))
+static size_t padded(int rows, int cols)
+{
+  int perLine = MAT_ALIGN / sizeof(float);
+  return (size_t)rows * ((cols + perLine - 1) / perLine * perLine);
+}
+
+__attribute__((no_instrument_function))
+static job_t* read_manifest(char* path, int* numJobs)
+{
+  FILE* file = fopen(path, "r");
+  if(!file) {
+    fprintf(stderr, "Failed to open '%s'\n", path);
+    exit(1);
+  }
+
+  int cap = 16;
+  job_t* jobs = malloc(sizeof(*jobs) * cap);
+  *numJobs = 0;
+
+  char* line = NULL;
+  size_t len = 0;
+  for(int lineNo = 1; getline(&line, &len, file) != -1; lineNo++) {
+    char* paths[3];
+    int found = 0;
+    for(char* tok = strtok(line, " \t\r\n"); tok != NULL && found < 4; tok = strtok(NULL, " \t\r\n")) {
+      if(found == 0 && tok[0] == '#') break;
+      if(found < 3) paths[found] = tok;
+      found++;
+    }
+    if(found == 0) continue;
+    if(found != 3) {
+      fprintf(stderr, "%s:%d: expected '<path A> <path B> <path out>'\n", path, lineNo);
+      exit(1);
+    }
+
+    if(*numJobs == cap) jobs = realloc(jobs, sizeof(*jobs) * (cap *= 2));
+    jobs[*numJobs] = (job_t){ strdup(paths[0]), strdup(paths[1]), strdup(paths[2]) };
+    (*numJobs)++;
+  }
+
+  free(line);
+  fclose(file);
+
+  return jobs;
+}
+
+__attribute__((no_instrument_function))
+info_t* parse_args(int argc, char* argv[])
+{
+  verify_t verify;
+  argc = parse_verify_args(argc, argv, &verify);
+
+  long cacheMB = BATCH_CACHE_MB;
+  if(argc == 3 && strncmp(argv[1], "--cache-mb=", 11) == 0) {
+    cacheMB = atol(argv[1] + 11);
+    argv[1] = argv[2];
+    argc--;
+  }
+
+  if(argc != 2) {
+    printf("usage: %s <?--verify [--rounds=k] [--tol=relative | --ulps=n]> <?--cache-mb=n, default=%d> <manifest: lines of '<path A> <path B> <path out>'>\n", argv[0], BATCH_CACHE_MB);
+    exit(0);
+  }
+
+  info_t* info = malloc(sizeof(*info));
+  info->verify = verify;
+  info->cache = (cacheMB > 0 ? mat_cache_new((size_t)cacheMB << 20) : NULL);
+  info->jobs = read_manifest(argv[1], &info->numJobs);
+
+  // size the slots for the largest job from the headers alone, so a bad job
+  // fails here instead of halfway through the batch
+  size_t maxA = 1, maxB = 1, maxC = 1;
+  for(int i = 0; i < info->numJobs; i++) {
+    job_t* job = &info->jobs[i];
+    int rowsA, colsA, rowsB, colsB;
+    if(!read_dims(job->pathA, &rowsA, &colsA) || !read_dims(job->pathB, &rowsB, &colsB)) {
+      fprintf(stderr, "job %d: cannot read '%s' or '%s'\n", i + 1, job->pathA, job->pathB);
+      exit(1);
+    }
+    if(colsA != rowsB) {
+      fprintf(stderr, "job %d: invalid matrix multiplication of %dx%d * %dx%d\n", i + 1, rowsA, colsA, rowsB, colsB);
+      exit(1);
+    }
+
+    // mapped matbin inputs never touch the slot buffers
+    if(!is_bin_file(job->pathA) && padded(rowsA, colsA) > maxA) maxA = padded(rowsA, colsA);
+    if(!is_bin_file(job->pathB) && padded(rowsB, colsB) > maxB) maxB = padded(rowsB, colsB);
+    if(padded(rowsA, colsB) > maxC) maxC = padded(rowsA, colsB);
+  }
+
+  queue_init(&info->free);
+  queue_init(&info->ready);
+  queue_init(&info->done);
+
+  // a 1 x n buffer holds n floats, enough for any shape whose padded size fits
+  for(int s = 0; s < BATCH_SLOTS; s++) {
+    slot_t* slot = &info->slots[s];
+    slot->bufA = mat_alloc(1, maxA, true);
+    slot->bufB = mat_alloc(1, maxB, true);
+    slot->bufC = mat_alloc(1, maxC, true);
+    queue_push(&info->free, slot);
+  }
+
+  return info;
+}
+
+__attribute__((no_instrument_function))
+void free_info(info_t* info)
+{
+  for(int s = 0; s < BATCH_SLOTS; s++) {
+    free_mat(info->slots[s].bufA, true);
+    free_mat(info->slots[s].bufB, true);
+    free_mat(info->slots[s].bufC, true);
+  }
+  for(int i = 0; i < info->numJobs; i++) {
+    free(info->jobs[i].pathA);
+    free(info->jobs[i].pathB);
+    free(info->jobs[i].pathOut);
+  }
+  free(info->jobs);
+  mat_cache_free(info->cache);
+
+  queue_destroy(&info->free);
+  queue_destroy(&info->ready);
+  queue_destroy(&info->done);
+  free(info);
+}
+
+// ------------------- pipeline stages ---------------
+
+__attribute__((no_instrument_function))
+static mat_t* load(char* path, mat_t* buf)
+{
+  if(is_bin_file(path)) return read_bin(path);
+
+  return read_text_into(path, true, buf);
+}
+
+__attribute__((no_instrument_function))
+void* load_jobs(void* arg)
+{
+  info_t* info = arg;
+
+  for(int i = 0; i < info->numJobs; i++) {
+    slot_t* slot = queue_pop(&info->free);
+    slot->job = i;
+    slot->A = load(info->jobs[i].pathA, slot->bufA);
+    slot->B = load(info->jobs[i].pathB, slot->bufB);
+    queue_push(&info->ready, slot);
+  }
+  queue_push(&info->ready, NULL);
+
+  return NULL;
+}
+
+__attribute__((no_instrument_function))
+void* write_jobs(void* arg)
+{
+  info_t* info = arg;
+
+  slot_t* slot;
+  while((slot = queue_pop(&info->done)) != NULL) {
+    char* path = info->jobs[slot->job].pathOut;
+
+    if(ends_with(path, ".bin")) write_bin(slot->bufC, path);
+    else {
+      FILE* file = fopen(path, "w");
+      if(!file) {
+        fprintf(stderr, "Failed to open '%s'\n", path);
+        exit(1);
+      }
+      fprintf(file, "%d %d\n", slot->bufC->rows, slot->bufC->cols);
+      mat_fprint(file, slot->bufC);
+      fclose(file);
+    }
+
+    queue_push(&info->free, slot);
+  }
+
+  return NULL;
+}
+
+// multiplies whatever the loader has ready, returns the number of jobs that failed --verify
+int run_jobs(info_t* info)
+{
+  int failed = 0;
+
+  slot_t* slot;
+  while((slot = queue_pop(&info->ready)) != NULL) {
+    if(info->cache) {
+      mat_prepared_t* B = mat_cache_get(info->cache, slot->B, true);
+      mat_mul_prepared_into(slot->A, B, slot->bufC);
+      mat_cache_release(info->cache, B);
+    }
+    else mat_mul_into(slot->A, slot->B, slot->bufC);
+
+    if(info->verify.enabled && !verify_mul(slot->A, slot->B, slot->bufC, &info->verify)) {
+      fprintf(stderr, "job %d (%s * %s) failed verification\n", slot->job + 1,
+              info->jobs[slot->job].pathA, info->jobs[slot->job].pathB);
+      failed++;
+    }
+
+    // the inputs are done with, only C goes on to the writer
+    if(slot->A != slot->bufA) free_mat(slot->A, true);
+    if(slot->B != slot->bufB) free_mat(slot->B, true);
+    queue_push(&info->done, slot);
+  }
+  queue_push(&info->done, NULL);
+
+  return failed;
+}
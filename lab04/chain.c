@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "mat.h"
+#include "matchain.h"
+
+/**
+ * Outline:
+ * 1. parse argv:
+ *  1. <?--plan> <path mat1> <path mat2> ... <path matN>
+ * 2. parse files (same format as the other lab04 programs)
+ * 3. print A1 * A2 * ... * AN, multiplied in the order with the fewest flops
+ *    (--plan also prints that order and its cost against left to right on stderr)
+ * 4. cleanup memory
+ */
+
+typedef struct {
+  mat_t** mats;
+  int n;
+  bool plan;
+} info_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+
+// ------------------------ main ------------------------
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  if(info->plan) {
+    mat_chain_plan_t* plan = mat_chain_plan(info->mats, info->n);
+    if(plan != NULL) {
+      mat_chain_plan_fprint(stderr, plan);
+      fprintf(stderr, "\n%.0f flops (left to right: %.0f, %.1fx)\n", plan->flops, plan->naiveFlops,
+              plan->naiveFlops / (plan->flops > 0 ? plan->flops : 1));
+      mat_chain_plan_free(plan);
+    }
+  }
+
+  mat_t* C = mat_chain_mul(info->mats, info->n, true, NULL);
+  int status = (C != NULL ? 0 : 1);
+  if(C != NULL) mat_print(C);
+
+  free_mat(C, true);
+  free_info(info);
+
+  return status;
+}
+
+// ------------------------ main ------------------------
+
+__attribute__((no_instrument_function))
+info_t* parse_args(int argc, char* argv[])
+{
+  info_t* info = malloc(sizeof(*info));
+  info->plan = (argc > 1 && strcmp(argv[1], "--plan") == 0);
+
+  int first = (info->plan ? 2 : 1);
+  info->n = argc - first;
+  if(info->n < 1) {
+    printf("usage: %s <?--plan> <path to matrix 1> <path to matrix 2> ... <path to matrix n>\n", argv[0]);
+    free(info);
+    exit(0);
+  }
+
+  info->mats = malloc(sizeof(*info->mats) * info->n);
+  for(int i = 0; i < info->n; i++) info->mats[i] = read_file(argv[first + i], true);
+
+  return info;
+}
+
+__attribute__((no_instrument_function))
+void free_info(info_t* info)
+{
+  for(int i = 0; i < info->n; i++) free_mat(info->mats[i], true);
+  free(info->mats);
+  free(info);
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include "half.h"
+#include "sgemm.h"
+
+// ------------------------ conversion ------------------------
+
+// n floats -> n half or bfloat16 values, 8 at a time
+__attribute__((no_instrument_function))
+static void narrow(mat_dtype_t dtype, const float* src, uint16_t* dst, int n)
+{
+  int i = 0;
+
+  if(dtype == MAT_F16) {
+    for(; i + 8 <= n; i += 8) {
+      _mm_storeu_si128((__m128i*)&dst[i], _mm256_cvtps_ph(_mm256_loadu_ps(&src[i]), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for(; i < n; i++) dst[i] = _cvtss_sh(src[i], _MM_FROUND_TO_NEAREST_INT);
+    return;
+  }
+
+  // bfloat16 is the top half of a float: add 0x7fff plus the lowest kept bit
+  // to round to nearest even, and keep NaNs NaN by forcing the quiet bit
+  const __m256i half = _mm256_set1_epi32(0x7fff), one = _mm256_set1_epi32(1);
+  const __m256i quiet = _mm256_set1_epi32(0x400000);
+  for(; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(&src[i]);
+    __m256i bits = _mm256_castps_si256(v);
+    __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(half, _mm256_and_si256(_mm256_srli_epi32(bits, 16), one)));
+    __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    bits = _mm256_blendv_epi8(rounded, _mm256_or_si256(bits, quiet), nan);
+    bits = _mm256_srli_epi32(bits, 16);
+    // 8 x 32 -> 8 x 16, packus works per 128-bit lane
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1));
+    _mm_storeu_si128((__m128i*)&dst[i], packed);
+  }
+  for(; i < n; i++) {
+    uint32_t bits;
+    memcpy(&bits, &src[i], sizeof(bits));
+    if(isnan(src[i])) bits |= 0x400000;
+    else bits += 0x7fff + ((bits >> 16) & 1);
+    dst[i] = bits >> 16;
+  }
+}
+
+__attribute__((no_instrument_function))
+static float widen(mat_dtype_t dtype, uint16_t h)
+{
+  if(dtype == MAT_F16) return _cvtsh_ss(h);
+
+  uint32_t bits = (uint32_t)h << 16;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+__attribute__((no_instrument_function))
+mat16_t* mat_quantize(mat_t* mat, mat_dtype_t dtype)
+{
+  mat16_t* q = malloc(sizeof(*q));
+  q->dtype = dtype;
+  q->isRowForm = mat->isRowForm;
+  q->rows = mat->rows;
+  q->cols = mat->cols;
+
+  int inner = (mat->isRowForm ? mat->cols:mat->rows);
+  int outer = (mat->isRowForm ? mat->rows:mat->cols);
+  int perLine = MAT_ALIGN / sizeof(uint16_t);
+  q->ld = (inner + perLine - 1) / perLine * perLine;
+
+  size_t bytes = sizeof(uint16_t) * (size_t)q->ld * outer;
+  q->data = aligned_alloc(MAT_ALIGN, bytes > 0 ? bytes : MAT_ALIGN);
+  memset(q->data, 0, bytes);
+
+  for(int i = 0; i < outer; i++) narrow(dtype, MAT_VEC(mat, i), &q->data[(size_t)i*q->ld], inner);
+
+  return q;
+}
+
+__attribute__((no_instrument_function))
+mat_t* mat_dequantize(mat16_t* q)
+{
+  mat_t* mat = mat_alloc(q->rows, q->cols, q->isRowForm);
+  int inner = (q->isRowForm ? q->cols:q->rows);
+  int outer = (q->isRowForm ? q->rows:q->cols);
+
+  for(int i = 0; i < outer; i++) {
+    float* vec = MAT_VEC(mat, i);
+    for(int j = 0; j < inner; j++) vec[j] = widen(q->dtype, q->data[(size_t)i*q->ld + j]);
+  }
+
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+void free_mat16(mat16_t* mat)
+{
+  if(mat != NULL) {
+    free(mat->data);
+    free(mat);
+  }
+}
+
+// ------------------------ multiply ------------------------
+
+// same form to trans flag mapping as mat_mul_into
+mat_t* mat_mul16(mat16_t* A, mat16_t* B, bool isRowForm)
+{
+  if(A->cols != B->rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->rows, A->cols, B->rows, B->cols);
+    return NULL;
+  }
+
+  mat_t* C = mat_alloc(A->rows, B->cols, isRowForm);
+  sgemm_type_t typeA = (A->dtype == MAT_F16 ? SGEMM_F16 : SGEMM_BF16);
+  sgemm_type_t typeB = (B->dtype == MAT_F16 ? SGEMM_F16 : SGEMM_BF16);
+
+  if(!isRowForm) {
+    sgemm_ex(A->isRowForm ? 'T':'N', B->isRowForm ? 'T':'N', C->rows, C->cols, A->cols,
+             1.0f, typeA, A->data, A->ld, typeB, B->data, B->ld, 0.0f, C->data, C->ld);
+  }
+  else {
+    sgemm_ex(B->isRowForm ? 'N':'T', A->isRowForm ? 'N':'T', C->cols, C->rows, A->cols,
+             1.0f, typeB, B->data, B->ld, typeA, A->data, A->ld, 0.0f, C->data, C->ld);
+  }
+
+  return C;
+}
+
+// ------------------------ error report ------------------------
+
+typedef struct {
+  double maxAbs, maxRef, sumSq;
+  size_t count;
+} error_sum_t;
+
+__attribute__((no_instrument_function))
+static void add_error(error_sum_t* sum, double ref, double approx)
+{
+  double err = fabs(ref - approx);
+  if(err > sum->maxAbs || isnan(err)) sum->maxAbs = err;
+  if(fabs(ref) > sum->maxRef) sum->maxRef = fabs(ref);
+  sum->sumSq += err * err;
+  sum->count++;
+}
+
+__attribute__((no_instrument_function))
+static mat_error_t finish_error(error_sum_t* sum)
+{
+  return (mat_error_t){
+    .maxAbs = sum->maxAbs,
+    .maxRel = (sum->maxRef > 0.0 ? sum->maxAbs / sum->maxRef : sum->maxAbs),
+    .rms = (sum->count > 0 ? sqrt(sum->sumSq / sum->count) : 0.0),
+  };
+}
+
+__attribute__((no_instrument_function))
+mat_error_t mat_error(mat_t* ref, mat_t* approx)
+{
+  error_sum_t sum = { 0 };
+  for(int row = 0; row < ref->rows; row++) {
+    for(int col = 0; col < ref->cols; col++) add_error(&sum, MAT_AT(ref, row, col), MAT_AT(approx, row, col));
+  }
+  return finish_error(&sum);
+}
+
+__attribute__((no_instrument_function))
+mat_error_t quantize_error(mat_t* mat, mat16_t* q)
+{
+  error_sum_t sum = { 0 };
+  int inner = (mat->isRowForm ? mat->cols:mat->rows);
+  int outer = (mat->isRowForm ? mat->rows:mat->cols);
+
+  for(int i = 0; i < outer; i++) {
+    const float* vec = MAT_VEC(mat, i);
+    // q keeps mat's form, so the vectors line up
+    for(int j = 0; j < inner; j++) add_error(&sum, vec[j], widen(q->dtype, q->data[(size_t)i*q->ld + j]));
+  }
+  return finish_error(&sum);
+}
@@ -0,0 +1,48 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mat.h"
+#include "matbin.h"
+
+/**
+ * Reduced precision storage for the float programs.
+ *
+ * Past 1024 the float kernels wait on memory, not on the FMAs, so storing A
+ * and B in 16 bits (MAT_F16: IEEE half, MAT_BF16: bfloat16) halves the bytes
+ * they stream. The values are widened back to float while sgemm packs them
+ * (sgemm_ex) and C is accumulated in fp32, so only the inputs are rounded:
+ *  - half:     11 significant bits, |x| up to 65504 (integers exact to 2048)
+ *  - bfloat16:  8 significant bits, the whole float range (integers exact to 256)
+ * Layout is mat_t's with 16-bit elements; ld is padded to MAT_ALIGN bytes.
+ */
+
+typedef struct {
+  mat_dtype_t dtype; // MAT_F16 or MAT_BF16
+  bool isRowForm;
+  int rows, cols;
+  int ld;
+  uint16_t* data;
+} mat16_t;
+
+typedef struct {
+  double maxAbs;   // largest |ref - approx|
+  double maxRel;   // maxAbs relative to the largest |ref|
+  double rms;      // root mean square of ref - approx
+} mat_error_t;
+
+// rounds to nearest even; values past the half range become +-inf
+mat16_t* mat_quantize(mat_t* mat, mat_dtype_t dtype);
+mat_t* mat_dequantize(mat16_t* mat);
+void free_mat16(mat16_t* mat);
+
+// A * B into a new fp32 matrix of the given form, whatever forms A and B are in
+mat_t* mat_mul16(mat16_t* A, mat16_t* B, bool isRowForm);
+
+mat_error_t mat_error(mat_t* ref, mat_t* approx);
+// what quantizing mat lost: mat against its 16-bit copy, element by element
+mat_error_t quantize_error(mat_t* mat, mat16_t* quantized);
+
+#endif
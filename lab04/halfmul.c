@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "mat.h"
+#include "half.h"
+
+/**
+ * Outline:
+ * 1. parse argv:
+ *  1. <--fp16 | --bf16> <?--report> <path mat1> <path mat2> <?path debug mat>
+ * 2. parse files, quantizing each to 16 bits as soon as it is read (the fp32
+ *    copy is dropped unless --report needs it) and printing on stderr what
+ *    the rounding cost
+ * 3. print A * B computed from the 16-bit copies with fp32 accumulation
+ *    (--report also multiplies in fp32 and prints the difference on stderr)
+ * 4. cleanup memory
+ */
+
+typedef struct {
+  mat16_t *matA, *matB; // required
+  mat_t *fullA, *fullB; // fp32 inputs, kept for --report only
+  mat_t *debug; // optional
+  mat_dtype_t dtype;
+  bool report;
+} info_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+bool debug(info_t* info, mat_t* C);
+
+// ------------------------ main ------------------------
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  mat_t* C = mat_mul16(info->matA, info->matB, true);
+
+  if(info->report && C != NULL) {
+    mat_t* ref = mat_mul(info->fullA, info->fullB, true);
+    mat_error_t err = mat_error(ref, C);
+    fprintf(stderr, "C: max abs error %g, max rel error %g, rms %g against fp32\n", err.maxAbs, err.maxRel, err.rms);
+    free_mat(ref, true);
+  }
+
+  if(info->debug != NULL) {
+    printf( debug(info, C) ? "passed\n" : "failed\n" );
+  } else if(C != NULL) {
+    mat_print(C);
+  }
+
+  free_mat(C, true);
+
+  free_info(info);
+}
+
+// ------------------------ main ------------------------
+
+// reads path and keeps only its 16-bit copy (plus the fp32 one when reporting)
+__attribute__((no_instrument_function))
+static mat16_t* load(char* path, info_t* info, mat_t** full)
+{
+  mat_t* mat = read_file(path, true);
+  mat16_t* q = mat_quantize(mat, info->dtype);
+
+  mat_error_t err = quantize_error(mat, q);
+  fprintf(stderr, "%s: max abs error %g, max rel error %g, rms %g from %s storage\n",
+          path, err.maxAbs, err.maxRel, err.rms, info->dtype == MAT_F16 ? "fp16" : "bf16");
+
+  if(info->report) *full = mat;
+  else {
+    free_mat(mat, true);
+    *full = NULL;
+  }
+
+  return q;
+}
+
+__attribute__((no_instrument_function))
+info_t* parse_args(int argc, char* argv[])
+{
+  info_t* info = calloc(1, sizeof(*info));
+
+  int arg = 1;
+  for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if(strcmp(argv[arg], "--fp16") == 0) info->dtype = MAT_F16;
+    else if(strcmp(argv[arg], "--bf16") == 0) info->dtype = MAT_BF16;
+    else if(strcmp(argv[arg], "--report") == 0) info->report = true;
+    else break;
+  }
+
+  if(info->dtype == 0 || (argc - arg != 2 && argc - arg != 3)) {
+    printf("usage: %s <--fp16 | --bf16> <?--report> <path to matrix 1> <path to matrix 2> <?path to debug matrix>\n", argv[0]);
+    free(info);
+    exit(0);
+  }
+
+  info->matA = load(argv[arg], info, &info->fullA);
+  info->matB = load(argv[arg + 1], info, &info->fullB);
+
+  if(argc - arg == 3) info->debug = read_file(argv[arg + 2], true);
+  else info->debug = NULL;
+
+  return info;
+}
+
+  __attribute__((no_instrument_function))
+void free_info(info_t* info)
+{
+  free_mat16(info->matA);
+  free_mat16(info->matB);
+  free_mat(info->fullA, true);
+  free_mat(info->fullB, true);
+  free_mat(info->debug, true);
+  free(info);
+}
+
+  __attribute__((no_instrument_function))
+bool debug(info_t* info, mat_t* C)
+{
+  return C != NULL && mat_equal(info->debug, C);
+}
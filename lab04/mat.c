@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mat.h"
+#include "matbin.h"
+#include "sgemm.h"
+#include "sparse.h"
+
+#include "fastout.h"
+
+// ld for the inner dimension rounded up to whole MAT_ALIGN byte lines
+__attribute__((no_instrument_function))
+static int mat_ld(int rows, int cols, bool isRowForm)
+{
+  int inner = (isRowForm ? cols:rows);
+  int perLine = MAT_ALIGN / sizeof(float);
+  return (inner + perLine - 1) / perLine * perLine;
+}
+
+__attribute__((no_instrument_function))
+mat_t* mat_alloc(int rows, int cols, bool isRowForm)
+{
+  mat_t* mat = malloc(sizeof(*mat));
+  mat->isRowForm = isRowForm;
+  mat->rows = rows;
+  mat->cols = cols;
+  mat->ld = mat_ld(rows, cols, isRowForm);
+
+  // one allocation for the whole matrix, zeroed so kernels can run into the padding
+  int outer = (isRowForm ? rows:cols);
+  mat->capacity = (size_t)mat->ld * outer;
+  size_t bytes = sizeof(float) * mat->capacity;
+  mat->data = aligned_alloc(MAT_ALIGN, bytes > 0 ? bytes : MAT_ALIGN);
+  memset(mat->data, 0, bytes);
+  mat->mapping = NULL;
+  mat->mappingSize = 0;
+  mat->nnz = -1;
+
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+void free_mat(mat_t* mat, bool freePtr)
+{
+  if(mat != NULL) {
+    if(mat->mapping != NULL) munmap(mat->mapping, mat->mappingSize);
+    else free(mat->data);
+    if(freePtr) free(mat);
+  }
+}
+
+__attribute__((no_instrument_function))
+void mat_resize(mat_t* mat, int rows, int cols, bool isRowForm)
+{
+  int ld = mat_ld(rows, cols, isRowForm);
+  size_t needed = (size_t)ld * (isRowForm ? rows:cols);
+
+  if(needed > mat->capacity) {
+    // too small (or mapped): swap in a fresh buffer
+    mat_t* tmp = mat_alloc(rows, cols, isRowForm);
+    free_mat(mat, false);
+    *mat = *tmp;
+    free(tmp);
+    return;
+  }
+
+  mat->isRowForm = isRowForm;
+  mat->rows = rows;
+  mat->cols = cols;
+  mat->ld = ld;
+  mat->nnz = -1;
+  memset(mat->data, 0, sizeof(float) * needed);
+}
+
+__attribute__((no_instrument_function))
+mat_t* read_file(char* path, bool isRowForm)
+{
+  if(is_bin_file(path)) return read_bin(path);
+
+  return read_text(path, isRowForm);
+}
+
+// ------------------ parallel text parser ----------------
+// the text is split into one byte range per thread on whitespace boundaries.
+// pass 1 counts the values in each range, a prefix sum turns the counts into
+// each range's first element index, and pass 2 parses the values into place.
+
+// below this many bytes a single thread is faster than starting more
+#define PARSE_CHUNK (256*1024)
+#define PARSE_MAX_THREADS 16
+
+typedef struct {
+  const char *start, *end;
+  size_t first, count; // element index of the first value, number of values
+  size_t nonzeros;     // of those values, counted while parsing for mat_density
+  mat_t* mat;
+  bool countOnly;
+} parse_t;
+
+// strtof is locale aware and slow; the files are plain decimal so parse those
+// directly and only hand anything else (exponents, inf, nan) to strtof
+__attribute__((no_instrument_function))
+static const char* parse_float(const char* p, const char* end, float* out)
+{
+  const char* start = p;
+  bool neg = false;
+  if(p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+  double val = 0.0;
+  const char* digits = p;
+  while(p < end && *p >= '0' && *p <= '9') val = val*10.0 + (*p++ - '0');
+
+  if(p < end && *p == '.') {
+    // keep the fraction as an integer so only one rounding happens
+    static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+    uint64_t frac = 0;
+    int places = 0;
+    for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      if(places < 18) { frac = frac*10 + (*p - '0'); places++; }
+    }
+    val += frac / pow10[places];
+  }
+
+  if(p == digits || (p < end && !isspace((unsigned char)*p))) {
+    char buf[64];
+    const char* tok = start;
+    while(p < end && !isspace((unsigned char)*p)) p++;
+    size_t len = (size_t)(p - tok) < sizeof(buf) - 1 ? (size_t)(p - tok) : sizeof(buf) - 1;
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    *out = strtof(buf, NULL);
+    return p;
+  }
+
+  *out = (float)(neg ? -val : val);
+  return p;
+}
+
+__attribute__((no_instrument_function))
+static void* parse_range(void* arg)
+{
+  parse_t* job = arg;
+  const char* p = job->start;
+  size_t idx = job->first, total = (size_t)job->mat->rows * job->mat->cols;
+  size_t count = 0, nonzeros = 0;
+
+  while(true) {
+    while(p < job->end && isspace((unsigned char)*p)) p++;
+    if(p >= job->end) break;
+
+    if(job->countOnly) {
+      while(p < job->end && !isspace((unsigned char)*p)) p++;
+    }
+    else {
+      float val;
+      p = parse_float(p, job->end, &val);
+      if(idx < total) {
+        MAT_AT(job->mat, idx / job->mat->cols, idx % job->mat->cols) = val;
+        nonzeros += (val != 0.0f);
+      }
+      idx++;
+    }
+    count++;
+  }
+
+  job->count = count;
+  job->nonzeros = nonzeros;
+  return NULL;
+}
+
+__attribute__((no_instrument_function))
+static void run_parse(parse_t* jobs, int n)
+{
+  pthread_t threads[PARSE_MAX_THREADS];
+  for(int t = 1; t < n; t++) pthread_create(&threads[t], NULL, parse_range, &jobs[t]);
+  parse_range(&jobs[0]);
+  for(int t = 1; t < n; t++) pthread_join(threads[t], NULL);
+}
+
+__attribute__((no_instrument_function))
+mat_t* read_text(char* path, bool isRowForm)
+{
+  return read_text_into(path, isRowForm, NULL);
+}
+
+__attribute__((no_instrument_function))
+mat_t* read_text_into(char* path, bool isRowForm, mat_t* mat)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open '%s'\n", path);
+    exit(1);
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  char* text = (st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED);
+  close(fd);
+  if(text == MAP_FAILED) {
+    fprintf(stderr, "Failed to read '%s'\n", path);
+    exit(1);
+  }
+  madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+  // header: rows cols
+  const char* end = text + st.st_size;
+  char* body;
+  long rows = strtol(text, &body, 10);
+  long cols = strtol(body, &body, 10);
+  if(rows <= 0 || cols <= 0) {
+    fprintf(stderr, "'%s' does not start with '<rows> <cols>'\n", path);
+    exit(1);
+  }
+
+  if(mat == NULL) mat = mat_alloc(rows, cols, isRowForm);
+  else mat_resize(mat, rows, cols, isRowForm);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = (end - body) / PARSE_CHUNK + 1;
+  if(n > cpus) n = cpus;
+  if(n > PARSE_MAX_THREADS) n = PARSE_MAX_THREADS;
+  if(n < 1) n = 1;
+
+  parse_t jobs[PARSE_MAX_THREADS];
+  const char* p = body;
+  for(int t = 0; t < n; t++) {
+    const char* stop = (t == n-1 ? end : body + (end - body) / n * (t+1));
+    // never split a value: move the cut to the next whitespace
+    while(stop < end && !isspace((unsigned char)*stop)) stop++;
+    if(stop < p) stop = p;
+    jobs[t] = (parse_t){ p, stop, 0, 0, 0, mat, true };
+    p = stop;
+  }
+
+  if(n > 1) {
+    run_parse(jobs, n);
+    for(int t = 1; t < n; t++) jobs[t].first = jobs[t-1].first + jobs[t-1].count;
+  }
+  for(int t = 0; t < n; t++) jobs[t].countOnly = false;
+  run_parse(jobs, n);
+
+  size_t found = jobs[n-1].first + jobs[n-1].count;
+  munmap(text, st.st_size);
+
+  mat->nnz = 0;
+  for(int t = 0; t < n; t++) mat->nnz += jobs[t].nonzeros;
+
+  // like the old fscanf loop, anything past rows*cols values is ignored
+  if(found < (size_t)rows * cols) {
+    fprintf(stderr, "'%s' has %zu values for a %ldx%ld matrix\n", path, found, rows, cols);
+    exit(1);
+  }
+
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+bool read_dims(char* path, int* rows, int* cols)
+{
+  FILE* file = fopen(path, "rb");
+  if(!file) return false;
+
+  matbin_header_t hdr;
+  bool found;
+  if(fread(&hdr, sizeof(hdr), 1, file) == 1 && memcmp(hdr.magic, MATBIN_MAGIC, 4) == 0) {
+    *rows = hdr.rows;
+    *cols = hdr.cols;
+    found = true;
+  }
+  else {
+    rewind(file);
+    found = fscanf(file, "%d %d", rows, cols) == 2;
+  }
+  fclose(file);
+
+  return found && *rows > 0 && *cols > 0;
+}
+
+// --------------------------------------------------------
+
+__attribute__((no_instrument_function))
+void mat_print(mat_t* mat)
+{
+  mat_fprint(stdout, mat);
+}
+
+__attribute__((no_instrument_function))
+static void print_row(out_t* out, void* ctx, int row)
+{
+  mat_t* mat = ctx;
+  for(int col = 0; col < mat->cols; col++) {
+    out_float(out, MAT_AT(mat, row, col));
+    out_char(out, ' ');
+  }
+  out_char(out, '\n');
+}
+
+__attribute__((no_instrument_function))
+void mat_fprint(FILE* file, mat_t* mat)
+{
+  // whatever is already buffered in file goes out before our write()s
+  fflush(file);
+
+  out_t out;
+  out_init(&out, fileno(file), OUT_BUF_SIZE);
+  out_rows(&out, mat->rows, print_row, mat, 12 * (size_t)mat->cols);
+  out_close(&out);
+}
+
+__attribute__((no_instrument_function))
+bool mat_equal(mat_t* A, mat_t* B)
+{
+  if(A->rows != B->rows || A->cols != B->cols) return false;
+
+  for(int row = 0; row < A->rows; row++) {
+    for(int col = 0; col < A->cols; col++) {
+      if(MAT_AT(A, row, col) != MAT_AT(B, row, col)) return false;
+    }
+  }
+
+  return true;
+}
+
+__attribute__((no_instrument_function))
+double mat_density(mat_t* mat)
+{
+  size_t total = (size_t)mat->rows * mat->cols;
+  if(total == 0) return 1.0;
+
+  if(mat->nnz < 0) {
+    int outer = (mat->isRowForm ? mat->rows:mat->cols);
+    int inner = (mat->isRowForm ? mat->cols:mat->rows);
+    long nnz = 0;
+    for(int i = 0; i < outer; i++) {
+      const float* vec = MAT_VEC(mat, i);
+      for(int j = 0; j < inner; j++) nnz += (vec[j] != 0.0f);
+    }
+    mat->nnz = nnz;
+  }
+
+  return (double)mat->nnz / total;
+}
+
+// A * B into a new matrix of the given form, whatever forms A and B are in
+mat_t* mat_mul(mat_t* A, mat_t* B, bool isRowForm)
+{
+  if(A->cols != B->rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->rows, A->cols, B->rows, B->cols);
+    return NULL;
+  }
+
+  return mat_mul_into(A, B, mat_alloc(A->rows, B->cols, isRowForm));
+}
+
+// a column form mat_t is a BLAS matrix as is and a row form one is the
+// transpose of one, so the forms become sgemm trans flags instead of copies.
+// C keeps its buffer when the shape already fits, for callers that reuse it
+mat_t* mat_mul_into(mat_t* A, mat_t* B, mat_t* C)
+{
+  if(A->cols != B->rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->rows, A->cols, B->rows, B->cols);
+    return NULL;
+  }
+
+  if(C->rows != A->rows || C->cols != B->cols || C->mapping != NULL) mat_resize(C, A->rows, B->cols, C->isRowForm);
+
+  C->nnz = -1;
+
+  // mostly zeros: skip the dense work (see sparse.h)
+  if(mat_density(A) <= SPARSE_DENSITY || mat_density(B) <= SPARSE_DENSITY) {
+    sparse_mul_into(A, B, C);
+    return C;
+  }
+
+  if(!C->isRowForm) {
+    sgemm(A->isRowForm ? 'T':'N', B->isRowForm ? 'T':'N', C->rows, C->cols, A->cols,
+          1.0f, A->data, A->ld, B->data, B->ld, 0.0f, C->data, C->ld);
+  }
+  else {
+    // row form C is column form C^T = B^T * A^T
+    sgemm(B->isRowForm ? 'N':'T', A->isRowForm ? 'N':'T', C->cols, C->rows, A->cols,
+          1.0f, B->data, B->ld, A->data, A->ld, 0.0f, C->data, C->ld);
+  }
+
+  return C;
+}
+
+// ------------------------ views ------------------------
+
+__attribute__((no_instrument_function))
+mat_view_t mat_view(mat_t* mat)
+{
+  return (mat_view_t){ mat->isRowForm, mat->rows, mat->cols, mat->ld, mat->data };
+}
+
+// rows x cols window whose top left corner is (row, col) of view
+__attribute__((no_instrument_function))
+mat_view_t mat_subview(mat_view_t view, int row, int col, int rows, int cols)
+{
+  mat_view_t sub = view;
+  sub.rows = rows;
+  sub.cols = cols;
+  sub.data = &MAT_AT(&view, row, col);
+  return sub;
+}
@@ -0,0 +1,58 @@
+#ifndef MAT_H
+#define MAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "matlayout.h"
+
+/**
+ * Shared matrix storage for the lab04 float programs, in the layout of
+ * matlayout.h (MAT_VEC and MAT_AT index it).
+ */
+
+typedef struct {
+  bool isRowForm;
+  int rows, cols;
+  int ld; // floats between the start of consecutive rows (row form) or cols (col form)
+  float* data;
+  size_t capacity; // floats allocated at data, 0 when it is mapped
+  long nnz;        // nonzero elements as counted by the loader, -1 when not known
+  // set when data points into an mmap'd file (see matbin.h) instead of aligned_alloc
+  void* mapping;
+  size_t mappingSize;
+} mat_t;
+
+// a zero-copy window into a matrix; it never owns (or frees) its data
+typedef struct {
+  bool isRowForm;
+  int rows, cols;
+  int ld;
+  float* data;
+} mat_view_t;
+
+mat_t* mat_alloc(int rows, int cols, bool isRowForm);
+void free_mat(mat_t* mat, bool freePtr);
+// reshapes (and zeroes) mat for reuse, only reallocating when its buffer is too small
+void mat_resize(mat_t* mat, int rows, int cols, bool isRowForm);
+// text or matbin file; a matbin file is mapped in place and keeps the form it was written in
+mat_t* read_file(char* path, bool isRowForm);
+mat_t* read_text(char* path, bool isRowForm);
+// read_text into mat's buffer (resized as needed), or a new matrix when mat is NULL
+mat_t* read_text_into(char* path, bool isRowForm, mat_t* mat);
+// rows and cols from a text or matbin header without reading the data
+bool read_dims(char* path, int* rows, int* cols);
+void mat_print(mat_t* mat);
+void mat_fprint(FILE* file, mat_t* mat);
+bool mat_equal(mat_t* A, mat_t* B);
+// fraction of nonzero elements, counted (and remembered) when the loader did not
+double mat_density(mat_t* mat);
+mat_t* mat_mul(mat_t* A, mat_t* B, bool isRowForm);
+// mat_mul into C, resized to the product and kept in its form
+mat_t* mat_mul_into(mat_t* A, mat_t* B, mat_t* C);
+
+mat_view_t mat_view(mat_t* mat);
+mat_view_t mat_subview(mat_view_t view, int row, int col, int rows, int cols);
+
+#endif
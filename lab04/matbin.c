@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matbin.h"
+
+__attribute__((no_instrument_function))
+bool is_bin_file(char* path)
+{
+  char magic[4];
+  FILE* file = fopen(path, "rb");
+  if(!file) return false;
+
+  bool isBin = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MATBIN_MAGIC, 4) == 0;
+  fclose(file);
+
+  return isBin;
+}
+
+__attribute__((no_instrument_function))
+static bool valid_header(matbin_header_t* hdr, off_t fileSize)
+{
+  int inner = (hdr->isRowForm ? hdr->cols:hdr->rows), outer = (hdr->isRowForm ? hdr->rows:hdr->cols);
+  // the same shape rules as mat_alloc, or the kernels index past the mapping
+  return memcmp(hdr->magic, MATBIN_MAGIC, 4) == 0 && hdr->version == MATBIN_VERSION && hdr->dtype == MAT_F32
+         && hdr->rows > 0 && hdr->cols > 0
+         && hdr->ld >= inner && hdr->ld % (MAT_ALIGN / sizeof(float)) == 0
+         && hdr->dataOffset % MAT_ALIGN == 0
+         && hdr->dataBytes == sizeof(float) * (uint64_t)hdr->ld * outer
+         && hdr->dataOffset + hdr->dataBytes <= (uint64_t)fileSize;
+}
+
+// maps the file private and writable, so in-place transposes only touch our pages
+__attribute__((no_instrument_function))
+mat_t* read_bin(char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open '%s'\n", path);
+    exit(1);
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+
+  void* map = (st.st_size >= (off_t)sizeof(matbin_header_t) ?
+               mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED);
+  close(fd);
+  if(map == MAP_FAILED) {
+    fprintf(stderr, "Failed to map '%s'\n", path);
+    exit(1);
+  }
+
+  matbin_header_t* hdr = map;
+  if(!valid_header(hdr, st.st_size)) {
+    fprintf(stderr, "'%s' is not a float matrix this build can read\n", path);
+    munmap(map, st.st_size);
+    exit(1);
+  }
+
+  mat_t* mat = malloc(sizeof(*mat));
+  mat->isRowForm = hdr->isRowForm;
+  mat->rows = hdr->rows;
+  mat->cols = hdr->cols;
+  mat->ld = hdr->ld;
+  mat->data = (float*)((char*)map + hdr->dataOffset);
+  mat->capacity = 0;
+  mat->nnz = -1;
+  mat->mapping = map;
+  mat->mappingSize = st.st_size;
+
+  // the whole file is about to be streamed through the kernels
+  madvise(map, st.st_size, MADV_WILLNEED);
+
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+void write_bin(mat_t* mat, char* path)
+{
+  FILE* file = fopen(path, "wb");
+  if(!file) {
+    fprintf(stderr, "Failed to open '%s'\n", path);
+    exit(1);
+  }
+
+  int outer = (mat->isRowForm ? mat->rows:mat->cols);
+  matbin_header_t hdr = {
+    .magic = MATBIN_MAGIC,
+    .version = MATBIN_VERSION,
+    .dtype = MAT_F32,
+    .isRowForm = mat->isRowForm,
+    .rows = mat->rows, .cols = mat->cols, .ld = mat->ld,
+    .dataOffset = sizeof(matbin_header_t),
+    .dataBytes = sizeof(float) * (uint64_t)mat->ld * outer,
+  };
+
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  fwrite(mat->data, 1, hdr.dataBytes, file);
+
+  if(fclose(file) != 0) {
+    fprintf(stderr, "Failed to write '%s'\n", path);
+    exit(1);
+  }
+}
+
+__attribute__((no_instrument_function))
+int open_bin(char* path, matbin_header_t* hdr)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open '%s'\n", path);
+    exit(1);
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  if(pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) || !valid_header(hdr, st.st_size)) {
+    fprintf(stderr, "'%s' is not a float matrix this build can read\n", path);
+    exit(1);
+  }
+
+  return fd;
+}
+
+__attribute__((no_instrument_function))
+int create_bin(char* path, int rows, int cols, bool isRowForm, matbin_header_t* hdr)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open '%s'\n", path);
+    exit(1);
+  }
+
+  // same ld rule as mat_alloc
+  int perLine = MAT_ALIGN / sizeof(float);
+  int inner = (isRowForm ? cols:rows), outer = (isRowForm ? rows:cols);
+  *hdr = (matbin_header_t){
+    .magic = MATBIN_MAGIC,
+    .version = MATBIN_VERSION,
+    .dtype = MAT_F32,
+    .isRowForm = isRowForm,
+    .rows = rows, .cols = cols, .ld = (inner + perLine - 1) / perLine * perLine,
+    .dataOffset = sizeof(matbin_header_t),
+  };
+  hdr->dataBytes = sizeof(float) * (uint64_t)hdr->ld * outer;
+
+  // the data (padding included) reads as zeros until it is written
+  if(pwrite(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) || ftruncate(fd, hdr->dataOffset + hdr->dataBytes) != 0) {
+    fprintf(stderr, "Failed to write '%s'\n", path);
+    exit(1);
+  }
+
+  return fd;
+}
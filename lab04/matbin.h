@@ -0,0 +1,46 @@
+#ifndef MATBIN_H
+#define MATBIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mat.h"
+
+/**
+ * Binary matrix container, loaded with mmap and used in place:
+ *
+ *   [matbin_header_t: 64 bytes][padding up to dataOffset][data: dataBytes]
+ *
+ * data is the matrix exactly as mat_t stores it (form, ld and zeroed
+ * padding included), in host byte order. dataOffset is a multiple of
+ * MAT_ALIGN, and mmap is page aligned, so the mapped data is aligned too.
+ */
+
+#define MATBIN_MAGIC "MATB"
+#define MATBIN_VERSION 1
+
+typedef enum { MAT_F32 = 1, MAT_I32 = 2, MAT_F16 = 3, MAT_BF16 = 4 } mat_dtype_t;
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t dtype;      // mat_dtype_t
+  uint32_t isRowForm;
+  int32_t rows, cols, ld;
+  uint32_t dataOffset; // bytes from the start of the file
+  uint64_t dataBytes;
+  uint8_t reserved[24];
+} matbin_header_t;
+
+_Static_assert(sizeof(matbin_header_t) == 64, "matbin header must stay 64 bytes");
+
+bool is_bin_file(char* path);
+mat_t* read_bin(char* path);
+void write_bin(mat_t* mat, char* path);
+
+// for reading and writing parts of a file with pread/pwrite instead of mapping all of it
+int open_bin(char* path, matbin_header_t* hdr);
+// a zero filled file of the given shape, opened read/write
+int create_bin(char* path, int rows, int cols, bool isRowForm, matbin_header_t* hdr);
+
+#endif
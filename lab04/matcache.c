@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "matcache.h"
+
+// ------------------------ hashing ------------------------
+
+__attribute__((no_instrument_function))
+static inline uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+  h ^= v * 0x9E3779B97F4A7C15ull;
+  h = (h << 31 | h >> 33) * 0xBF58476D1CE4E5B9ull;
+  return h;
+}
+
+// the whole buffer, padding included (ld follows from the shape, and the
+// padding is zero). hashing is a full pass over B, as long as packing it, so
+// it runs as an xxh3-style AVX2 accumulate that keeps up with memory: every
+// 64-bit lane adds lo32 * hi32 of (data ^ key) plus the swapped data
+__attribute__((no_instrument_function))
+uint64_t mat_hash(mat_t* mat)
+{
+  // ld is a multiple of 16 floats, so the buffer is whole 64-byte lines
+  size_t lines = sizeof(float) * (size_t)mat->ld * (mat->isRowForm ? mat->rows:mat->cols) / 64;
+  const __m256i* data = (const __m256i*)mat->data;
+
+  const __m256i key0 = _mm256_set_epi64x(0x1CAD21F72C81017Cll, 0xDB979083E96DD4DEll, 0x1F67B3B7A4A44072ll, 0x78E5C0CC4EE679CBll);
+  const __m256i key1 = _mm256_set_epi64x(0x2172FFCC7DD05A82ll, 0x8E2443F7744608B8ll, 0x4C263A81E69035E0ll, 0xCB00C391BB52283Cll);
+  __m256i acc0 = _mm256_set1_epi64x(1), acc1 = _mm256_set1_epi64x(2);
+
+  for(size_t i = 0; i < lines; i++) {
+    __m256i d0 = _mm256_load_si256(&data[2*i]), d1 = _mm256_load_si256(&data[2*i + 1]);
+    __m256i k0 = _mm256_xor_si256(d0, key0), k1 = _mm256_xor_si256(d1, key1);
+    acc0 = _mm256_add_epi64(acc0, _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32)));
+    acc1 = _mm256_add_epi64(acc1, _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32)));
+    acc0 = _mm256_add_epi64(acc0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc1 = _mm256_add_epi64(acc1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    // scramble now and then so a lane cannot just sum away
+    if((i & 63) == 63) {
+      acc0 = _mm256_xor_si256(acc0, _mm256_srli_epi64(acc0, 47));
+      acc1 = _mm256_xor_si256(acc1, _mm256_srli_epi64(acc1, 47));
+      acc0 = _mm256_add_epi64(_mm256_mul_epu32(acc0, key1), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(acc0, 32), key1), 32));
+      acc1 = _mm256_add_epi64(_mm256_mul_epu32(acc1, key0), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(acc1, 32), key0), 32));
+    }
+  }
+
+  uint64_t lanes[8];
+  _mm256_storeu_si256((__m256i*)&lanes[0], acc0);
+  _mm256_storeu_si256((__m256i*)&lanes[4], acc1);
+
+  uint64_t h = ((uint64_t)mat->rows << 33) ^ ((uint64_t)mat->cols << 1) ^ mat->isRowForm;
+  for(int l = 0; l < 8; l++) h = hash_mix(h, lanes[l]);
+
+  // splitmix64 finalizer
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+  h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+  return h ^ (h >> 31);
+}
+
+// ------------------- prepared operands -------------------
+
+__attribute__((no_instrument_function))
+static mat_prepared_t* prepare(mat_t* B, bool isRowForm, uint64_t hash)
+{
+  mat_prepared_t* prepared = calloc(1, sizeof(*prepared));
+  prepared->hash = hash;
+  prepared->rows = B->rows;
+  prepared->cols = B->cols;
+  prepared->isRowForm = isRowForm;
+
+  // same operand placement as mat_mul_into
+  if(!isRowForm) prepared->pack = sgemm_pack_b(B->isRowForm ? 'T':'N', B->rows, B->cols, B->data, B->ld);
+  else prepared->pack = sgemm_pack_a(B->isRowForm ? 'N':'T', B->cols, B->rows, B->data, B->ld);
+
+  return prepared;
+}
+
+__attribute__((no_instrument_function))
+mat_prepared_t* mat_prepare(mat_t* B, bool isRowForm)
+{
+  return prepare(B, isRowForm, mat_hash(B));
+}
+
+__attribute__((no_instrument_function))
+void mat_unprepare(mat_prepared_t* prepared)
+{
+  if(prepared != NULL) {
+    sgemm_pack_free(prepared->pack);
+    free(prepared);
+  }
+}
+
+mat_t* mat_mul_prepared(mat_t* A, mat_prepared_t* B)
+{
+  if(A->cols != B->rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->rows, A->cols, B->rows, B->cols);
+    return NULL;
+  }
+
+  return mat_mul_prepared_into(A, B, mat_alloc(A->rows, B->cols, B->isRowForm));
+}
+
+mat_t* mat_mul_prepared_into(mat_t* A, mat_prepared_t* B, mat_t* C)
+{
+  if(A->cols != B->rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->rows, A->cols, B->rows, B->cols);
+    return NULL;
+  }
+
+  if(C->rows != A->rows || C->cols != B->cols || C->isRowForm != B->isRowForm || C->mapping != NULL) {
+    mat_resize(C, A->rows, B->cols, B->isRowForm);
+  }
+
+  if(!C->isRowForm) {
+    sgemm_packed(A->isRowForm ? 'T':'N', 'N', C->rows, C->cols, A->cols,
+                 1.0f, A->data, A->ld, NULL, NULL, 0, B->pack, 0.0f, C->data, C->ld);
+  }
+  else {
+    sgemm_packed('N', A->isRowForm ? 'N':'T', C->cols, C->rows, A->cols,
+                 1.0f, NULL, 0, B->pack, A->data, A->ld, NULL, 0.0f, C->data, C->ld);
+  }
+
+  return C;
+}
+
+// ------------------------ LRU cache ------------------------
+
+__attribute__((no_instrument_function))
+mat_cache_t* mat_cache_new(size_t budget)
+{
+  mat_cache_t* cache = calloc(1, sizeof(*cache));
+  cache->budget = budget;
+  pthread_mutex_init(&cache->lock, NULL);
+  return cache;
+}
+
+__attribute__((no_instrument_function))
+void mat_cache_free(mat_cache_t* cache)
+{
+  if(cache == NULL) return;
+
+  mat_prepared_t* next;
+  for(mat_prepared_t* entry = cache->head; entry != NULL; entry = next) {
+    next = entry->next;
+    mat_unprepare(entry);
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+__attribute__((no_instrument_function))
+static void unlink_entry(mat_cache_t* cache, mat_prepared_t* entry)
+{
+  if(entry->prev) entry->prev->next = entry->next;
+  else cache->head = entry->next;
+  if(entry->next) entry->next->prev = entry->prev;
+  else cache->tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+__attribute__((no_instrument_function))
+static void push_front(mat_cache_t* cache, mat_prepared_t* entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if(cache->head) cache->head->prev = entry;
+  else cache->tail = entry;
+  cache->head = entry;
+}
+
+// drops unheld entries from the cold end until the cache fits its budget
+__attribute__((no_instrument_function))
+static void evict(mat_cache_t* cache)
+{
+  mat_prepared_t* prev;
+  for(mat_prepared_t* entry = cache->tail; entry != NULL && cache->used > cache->budget; entry = prev) {
+    prev = entry->prev;
+    if(entry->refs > 0) continue;
+
+    unlink_entry(cache, entry);
+    cache->used -= entry->pack->bytes;
+    cache->evictions++;
+    mat_unprepare(entry);
+  }
+}
+
+__attribute__((no_instrument_function))
+static mat_prepared_t* find(mat_cache_t* cache, uint64_t hash, mat_t* B, bool isRowForm)
+{
+  for(mat_prepared_t* entry = cache->head; entry != NULL; entry = entry->next) {
+    if(entry->hash == hash && entry->rows == B->rows && entry->cols == B->cols && entry->isRowForm == isRowForm) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+__attribute__((no_instrument_function))
+mat_prepared_t* mat_cache_get(mat_cache_t* cache, mat_t* B, bool isRowForm)
+{
+  uint64_t hash = mat_hash(B);
+
+  pthread_mutex_lock(&cache->lock);
+  mat_prepared_t* entry = find(cache, hash, B, isRowForm);
+  if(entry != NULL) {
+    unlink_entry(cache, entry);
+    push_front(cache, entry);
+    entry->refs++;
+    cache->hits++;
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+  }
+  cache->misses++;
+  pthread_mutex_unlock(&cache->lock);
+
+  // pack without holding the lock, then check nobody else got there first
+  mat_prepared_t* prepared = prepare(B, isRowForm, hash);
+  prepared->refs = 1;
+
+  pthread_mutex_lock(&cache->lock);
+  if((entry = find(cache, hash, B, isRowForm)) != NULL) {
+    entry->refs++;
+    pthread_mutex_unlock(&cache->lock);
+    mat_unprepare(prepared);
+    return entry;
+  }
+
+  // bigger than the whole budget: hand it out uncached, it goes on release
+  if(prepared->pack->bytes <= cache->budget) {
+    prepared->cached = true;
+    push_front(cache, prepared);
+    cache->used += prepared->pack->bytes;
+    evict(cache);
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  return prepared;
+}
+
+__attribute__((no_instrument_function))
+void mat_cache_release(mat_cache_t* cache, mat_prepared_t* prepared)
+{
+  if(prepared == NULL) return;
+
+  pthread_mutex_lock(&cache->lock);
+  bool drop = (--prepared->refs == 0 && !prepared->cached);
+  // entries held during an earlier insert may have kept the cache over budget
+  if(prepared->cached) evict(cache);
+  pthread_mutex_unlock(&cache->lock);
+
+  if(drop) mat_unprepare(prepared);
+}
@@ -0,0 +1,60 @@
+#ifndef MATCACHE_H
+#define MATCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "mat.h"
+#include "sgemm.h"
+
+/**
+ * Prepared right hand operands, for multiplying one B by a stream of A's.
+ *
+ * mat_prepare() packs B once into the sgemm panel layout, after which
+ * mat_mul_prepared() only packs A: B is never re-read, re-packed or
+ * transposed again. Which side of sgemm B lands on depends on the form of C
+ * (a row form C is computed as C^T = B^T A^T), so a prepared operand is made
+ * for one form of C.
+ *
+ * mat_cache_t keeps prepared operands keyed by content hash (plus shape and
+ * form), so callers that load the same B again get the packed one back. It
+ * evicts least recently used entries that nobody holds once the packed bytes
+ * go over its budget. A handle from mat_cache_get() stays valid until it is
+ * given back with mat_cache_release(). The 64-bit hash is trusted as is.
+ */
+
+typedef struct mat_prepared {
+  uint64_t hash;
+  int rows, cols;    // of B
+  bool isRowForm;    // the form of C this operand multiplies into
+  sgemm_pack_t* pack;
+  // cache bookkeeping
+  int refs;
+  bool cached;
+  struct mat_prepared *prev, *next; // most recently used first
+} mat_prepared_t;
+
+typedef struct {
+  size_t budget, used; // bytes of packed data
+  mat_prepared_t *head, *tail;
+  long hits, misses, evictions;
+  pthread_mutex_t lock;
+} mat_cache_t;
+
+uint64_t mat_hash(mat_t* mat);
+
+mat_prepared_t* mat_prepare(mat_t* B, bool isRowForm);
+void mat_unprepare(mat_prepared_t* prepared);
+
+// A * B for a prepared B, into a new matrix / into C (resized, in the form B was prepared for)
+mat_t* mat_mul_prepared(mat_t* A, mat_prepared_t* B);
+mat_t* mat_mul_prepared_into(mat_t* A, mat_prepared_t* B, mat_t* C);
+
+mat_cache_t* mat_cache_new(size_t budget);
+void mat_cache_free(mat_cache_t* cache);
+mat_prepared_t* mat_cache_get(mat_cache_t* cache, mat_t* B, bool isRowForm);
+void mat_cache_release(mat_cache_t* cache, mat_prepared_t* prepared);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+
+#include "matchain.h"
+
+// ------------------------ arena ------------------------
+
+__attribute__((no_instrument_function))
+mat_arena_t* mat_arena_new(void)
+{
+  return calloc(1, sizeof(mat_arena_t));
+}
+
+__attribute__((no_instrument_function))
+void mat_arena_free(mat_arena_t* arena)
+{
+  if(arena == NULL) return;
+
+  for(int i = 0; i < arena->count; i++) free_mat(arena->free[i], true);
+  free(arena->free);
+  free(arena);
+}
+
+__attribute__((no_instrument_function))
+mat_t* mat_arena_get(mat_arena_t* arena, int rows, int cols, bool isRowForm)
+{
+  int perLine = MAT_ALIGN / sizeof(float);
+  int inner = (isRowForm ? cols:rows), outer = (isRowForm ? rows:cols);
+  size_t needed = (size_t)(inner + perLine - 1) / perLine * perLine * outer;
+
+  // smallest buffer that fits, else the largest one (which mat_resize grows)
+  int best = -1, largest = -1;
+  for(int i = 0; i < arena->count; i++) {
+    size_t capacity = arena->free[i]->capacity;
+    if(capacity >= needed && (best < 0 || capacity < arena->free[best]->capacity)) best = i;
+    if(largest < 0 || capacity > arena->free[largest]->capacity) largest = i;
+  }
+
+  if(best < 0 && largest < 0) {
+    arena->allocs++;
+    return mat_alloc(rows, cols, isRowForm);
+  }
+
+  int pick = (best >= 0 ? best : largest);
+  mat_t* mat = arena->free[pick];
+  arena->free[pick] = arena->free[--arena->count];
+
+  if(best >= 0) arena->reuses++;
+  else arena->allocs++;
+  mat_resize(mat, rows, cols, isRowForm);
+
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+void mat_arena_put(mat_arena_t* arena, mat_t* mat)
+{
+  if(arena->count == arena->cap) {
+    arena->cap = (arena->cap ? arena->cap * 2 : 8);
+    arena->free = realloc(arena->free, sizeof(*arena->free) * arena->cap);
+  }
+  arena->free[arena->count++] = mat;
+}
+
+// ------------------------ planning ------------------------
+
+__attribute__((no_instrument_function))
+mat_chain_plan_t* mat_chain_plan(mat_t** mats, int n)
+{
+  for(int i = 0; i + 1 < n; i++) {
+    if(mats[i]->cols != mats[i+1]->rows) {
+      printf("Invalid matrix multiplication of %dx%d * %dx%d (matrices %d and %d)\n",
+             mats[i]->rows, mats[i]->cols, mats[i+1]->rows, mats[i+1]->cols, i + 1, i + 2);
+      return NULL;
+    }
+  }
+
+  mat_chain_plan_t* plan = malloc(sizeof(*plan));
+  plan->n = n;
+  plan->dims = malloc(sizeof(int) * (n + 1));
+  plan->split = calloc((size_t)n * n, sizeof(int));
+  for(int i = 0; i < n; i++) plan->dims[i] = mats[i]->rows;
+  plan->dims[n] = mats[n-1]->cols;
+
+  // cost[i*n + j]: fewest flops for A_i..A_j, filled by increasing chain length
+  double* cost = calloc((size_t)n * n, sizeof(double));
+  int* p = plan->dims;
+
+  for(int len = 2; len <= n; len++) {
+    for(int i = 0; i + len - 1 < n; i++) {
+      int j = i + len - 1;
+      cost[i*n + j] = DBL_MAX;
+      for(int s = i; s < j; s++) {
+        double c = cost[i*n + s] + cost[(s+1)*n + j] + 2.0 * p[i] * p[s+1] * p[j+1];
+        if(c < cost[i*n + j]) {
+          cost[i*n + j] = c;
+          plan->split[i*n + j] = s;
+        }
+      }
+    }
+  }
+
+  plan->flops = cost[n-1];
+  plan->naiveFlops = 0.0;
+  for(int j = 1; j < n; j++) plan->naiveFlops += 2.0 * p[0] * p[j] * p[j+1];
+
+  free(cost);
+  return plan;
+}
+
+__attribute__((no_instrument_function))
+void mat_chain_plan_free(mat_chain_plan_t* plan)
+{
+  if(plan != NULL) {
+    free(plan->dims);
+    free(plan->split);
+    free(plan);
+  }
+}
+
+__attribute__((no_instrument_function))
+static void fprint_range(FILE* file, mat_chain_plan_t* plan, int i, int j)
+{
+  if(i == j) {
+    fprintf(file, "A%d", i + 1);
+    return;
+  }
+
+  int s = plan->split[i*plan->n + j];
+  fputc('(', file);
+  fprint_range(file, plan, i, s);
+  fputc(' ', file);
+  fprint_range(file, plan, s + 1, j);
+  fputc(')', file);
+}
+
+__attribute__((no_instrument_function))
+void mat_chain_plan_fprint(FILE* file, mat_chain_plan_t* plan)
+{
+  fprint_range(file, plan, 0, plan->n - 1);
+}
+
+// ------------------------ execution ------------------------
+
+// A_i..A_j; inputs are returned as is, anything else came from the arena
+// (or, for the final product, from mat_alloc so the caller owns it)
+static mat_t* run_range(mat_t** mats, mat_chain_plan_t* plan, int i, int j, bool isRowForm, mat_arena_t* arena)
+{
+  if(i == j) return mats[i];
+
+  int s = plan->split[i*plan->n + j];
+  mat_t* L = run_range(mats, plan, i, s, isRowForm, arena);
+  mat_t* R = run_range(mats, plan, s + 1, j, isRowForm, arena);
+
+  bool isFinal = (i == 0 && j == plan->n - 1);
+  mat_t* C = (isFinal ? mat_alloc(L->rows, R->cols, isRowForm) : mat_arena_get(arena, L->rows, R->cols, isRowForm));
+  mat_mul_into(L, R, C);
+
+  // every intermediate has exactly one consumer, and this was it
+  if(L != mats[i]) mat_arena_put(arena, L);
+  if(R != mats[j]) mat_arena_put(arena, R);
+
+  return C;
+}
+
+mat_t* mat_chain_mul(mat_t** mats, int n, bool isRowForm, mat_arena_t* arena)
+{
+  if(n < 1) return NULL;
+
+  // a lone matrix still comes back as a copy the caller owns
+  if(n == 1) {
+    mat_t* C = mat_alloc(mats[0]->rows, mats[0]->cols, isRowForm);
+    for(int row = 0; row < C->rows; row++) {
+      for(int col = 0; col < C->cols; col++) MAT_AT(C, row, col) = MAT_AT(mats[0], row, col);
+    }
+    return C;
+  }
+
+  mat_chain_plan_t* plan = mat_chain_plan(mats, n);
+  if(plan == NULL) return NULL;
+
+  mat_arena_t* tmp = (arena == NULL ? mat_arena_new() : NULL);
+  mat_t* C = run_range(mats, plan, 0, n - 1, isRowForm, arena ? arena : tmp);
+
+  mat_arena_free(tmp);
+  mat_chain_plan_free(plan);
+
+  return C;
+}
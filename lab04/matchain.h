@@ -0,0 +1,47 @@
+#ifndef MATCHAIN_H
+#define MATCHAIN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "mat.h"
+
+/**
+ * Matrix chain products A1 * A2 * ... * An in the cheapest order.
+ *
+ * mat_chain_plan() runs the classic O(n^3) dynamic program over the shapes
+ * to find the parenthesization with the fewest flops; on rectangular chains
+ * left to right can easily be 10-100x worse. mat_chain_mul() then executes
+ * the plan, taking every intermediate from a mat_arena_t and giving it back
+ * as soon as the one product that consumes it has run.
+ */
+
+// free list of matrix buffers, handed out best fit by capacity and reshaped with mat_resize
+typedef struct {
+  mat_t** free;
+  int count, cap;
+  long allocs, reuses;
+} mat_arena_t;
+
+mat_arena_t* mat_arena_new(void);
+void mat_arena_free(mat_arena_t* arena);
+mat_t* mat_arena_get(mat_arena_t* arena, int rows, int cols, bool isRowForm);
+void mat_arena_put(mat_arena_t* arena, mat_t* mat);
+
+typedef struct {
+  int n;
+  int* dims;    // A_i is dims[i] x dims[i+1]
+  int* split;   // n x n, split[i*n + j]: the last product of A_i..A_j is (A_i..A_s)(A_s+1..A_j)
+  double flops, naiveFlops; // for the plan and for multiplying left to right
+} mat_chain_plan_t;
+
+// NULL when neighbouring shapes do not line up
+mat_chain_plan_t* mat_chain_plan(mat_t** mats, int n);
+void mat_chain_plan_free(mat_chain_plan_t* plan);
+// the parenthesization, e.g. "((A1 A2) A3)"
+void mat_chain_plan_fprint(FILE* file, mat_chain_plan_t* plan);
+
+// the product in the given form; arena may be NULL for a temporary one
+mat_t* mat_chain_mul(mat_t** mats, int n, bool isRowForm, mat_arena_t* arena);
+
+#endif
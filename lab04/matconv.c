@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "mat.h"
+#include "matbin.h"
+
+/**
+ * Converts between the text matrix format and the mmap-able binary one
+ * (see matbin.h). The direction comes from the input file:
+ *  - text in   -> binary out, stored in row form unless "col" is given
+ *  - binary in -> text out, every float in a form that reads back the same
+ */
+
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  if(argc != 3 && argc != 4) {
+    printf("usage: %s <input matrix> <output matrix> <?row|col: form of binary output, default=row>\n", argv[0]);
+    exit(0);
+  }
+
+  bool isRowForm = !(argc == 4 && strcmp(argv[3], "col") == 0);
+
+  if(is_bin_file(argv[1])) {
+    mat_t* mat = read_bin(argv[1]);
+
+    FILE* file = fopen(argv[2], "w");
+    if(!file) {
+      fprintf(stderr, "Failed to open '%s'\n", argv[2]);
+      exit(1);
+    }
+    fprintf(file, "%d %d\n", mat->rows, mat->cols);
+    mat_fprint(file, mat);
+    fclose(file);
+
+    free_mat(mat, true);
+  }
+  else {
+    mat_t* mat = read_text(argv[1], isRowForm);
+    write_bin(mat, argv[2]);
+    free_mat(mat, true);
+  }
+
+  return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef MATLAYOUT_H
+#define MATLAYOUT_H
+
+#include <stddef.h>
+
+/**
+ * The storage layout every lab04 matrix type shares, whatever its element:
+ * mat_t (float, mat.h) and standard_mult's int32 matrices. A matrix is one
+ * MAT_ALIGN aligned buffer with isRowForm, rows, cols, ld and data fields:
+ *  - row form:    element (row, col) is data[row*ld + col]
+ *  - column form: element (row, col) is data[col*ld + row]
+ * ld (the leading dimension) is the inner size rounded up to MAT_ALIGN bytes,
+ * so every row (or column) starts aligned and the padding is zeroed.
+ */
+
+#define MAT_ALIGN 64
+
+// i-th contiguous vector: a row in row form, a column in column form
+#define MAT_VEC(m, i) (&(m)->data[(size_t)(i)*(m)->ld])
+// element (row, col) regardless of the form
+#define MAT_AT(m, row, col) ((m)->data[(m)->isRowForm ? (size_t)(row)*(m)->ld + (col) : (size_t)(col)*(m)->ld + (row)])
+
+#endif
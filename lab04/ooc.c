@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mat.h"
+#include "matbin.h"
+#include "sgemm.h"
+
+/**
+ * Outline:
+ * 1. parse argv:
+ *  1. <--mem=bytes[K|M|G]> <matbin mat1> <matbin mat2> <matbin output>
+ * 2. pick tile sizes that fit --mem, create the output file
+ * 3. multiply tile by tile, reading and writing the files as it goes
+ * 4. print the tile sizes and I/O totals, cleanup
+ *
+ * Out-of-core multiply for matrices that do not fit in memory: A, B and C
+ * stay in matbin files (see matconv) and only tiles of them are resident.
+ *
+ * C is computed one Tm x Tn tile at a time as the sum of Tm x Tk tiles of A
+ * times Tk x Tn tiles of B, each product done by sgemm. With every tile
+ * double buffered the resident set is 2*Tm*Tn + 2*Tk*(Tm + Tn) floats. A is
+ * read N/Tn times and B M/Tm times, so after fixing Tk the C tiles are made
+ * as large as --mem allows.
+ *
+ * Tiles are visited in a snake order: j goes back and forth along each row
+ * of C tiles and k reverses on every tile, so each step starts on the A (or
+ * B) tile the step before it ended on and that read is skipped.
+ *
+ * An I/O thread serves pread/pwrite requests in order. While step s is being
+ * multiplied the tiles for step s+1 are read into the other buffers, and
+ * finished C tiles are written back behind the compute. (io_uring would
+ * save the thread, but liburing is not installed on the lab machines, so this
+ * is the portable pthread version.)
+ */
+
+// smallest useful tile edge, and the k depth tiles aim for
+#define OOC_MIN_TILE 16
+#define OOC_TK 256
+#define OOC_QUEUE 8
+
+typedef struct {
+  int fd;
+  matbin_header_t hdr;
+} binfile_t;
+
+// part of a file matrix held in memory, stored in the file's form
+typedef struct {
+  binfile_t* file;
+  int row, col, rows, cols; // rows < 0: holds nothing yet
+  int ld;
+  float* data;
+  bool busy; // an I/O request for it is queued or running
+} tile_t;
+
+typedef struct {
+  tile_t* tile;
+  bool write;
+} request_t;
+
+typedef struct {
+  request_t queue[OOC_QUEUE];
+  int head, count;
+  bool stop;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_t thread;
+  size_t bytesRead, bytesWritten;
+} io_t;
+
+typedef struct {
+  binfile_t A, B, C;
+  size_t memCap, memUsed;
+  int tm, tn, tk;
+  io_t io;
+} info_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+void multiply(info_t* info);
+
+// ------------------------ main ------------------------
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  multiply(info);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+
+  size_t inputBytes = info->A.hdr.dataBytes + info->B.hdr.dataBytes;
+  printf("tiles %dx%d, k %d: %zu of %zu bytes resident\n", info->tm, info->tn, info->tk, info->memUsed, info->memCap);
+  printf("read %zu bytes (%.2fx A+B), wrote %zu bytes in %.3f s\n", info->io.bytesRead,
+         (double)info->io.bytesRead / inputBytes, info->io.bytesWritten, secs);
+
+  free_info(info);
+}
+
+// ------------------------ main ------------------------
+
+// <number>[K|M|G]
+__attribute__((no_instrument_function))
+static size_t parse_size(char* str)
+{
+  char* end;
+  double val = strtod(str, &end);
+  switch(*end) {
+    case 'G': case 'g': val *= 1024;  // fall through
+    case 'M': case 'm': val *= 1024;  // fall through
+    case 'K': case 'k': val *= 1024;
+  }
+  return (size_t)val;
+}
+
+// whether double buffered t x t C tiles and t x tk A/B tiles fit in cap bytes
+__attribute__((no_instrument_function))
+static bool tile_fits(size_t cap, int t, int tk)
+{
+  size_t pad = (tk + OOC_MIN_TILE - 1) / OOC_MIN_TILE * OOC_MIN_TILE;
+  return sizeof(float) * ((size_t)2*t*t + (size_t)4*pad*t) <= cap;
+}
+
+// the largest square C tile (a multiple of OOC_MIN_TILE) that fits next to the k depth tk
+__attribute__((no_instrument_function))
+static int pick_tile(size_t cap, int tk)
+{
+  int t = OOC_MIN_TILE;
+  while(tile_fits(cap, t + OOC_MIN_TILE, tk)) t += OOC_MIN_TILE;
+  return t;
+}
+
+__attribute__((no_instrument_function))
+info_t* parse_args(int argc, char* argv[])
+{
+  if(argc != 5 || strncmp(argv[1], "--mem=", 6) != 0) {
+    printf("usage: %s <--mem=bytes[K|M|G]> <matbin matrix 1> <matbin matrix 2> <matbin output>\n", argv[0]);
+    exit(0);
+  }
+
+  info_t* info = calloc(1, sizeof(*info));
+  info->memCap = parse_size(argv[1] + 6);
+
+  info->A.fd = open_bin(argv[2], &info->A.hdr);
+  info->B.fd = open_bin(argv[3], &info->B.hdr);
+
+  int M = info->A.hdr.rows, K = info->A.hdr.cols, N = info->B.hdr.cols;
+  if(K != info->B.hdr.rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", M, K, info->B.hdr.rows, N);
+    exit(1);
+  }
+
+  // k deeper than the C tile edge would only take room from the C tiles
+  info->tk = (K < OOC_TK ? K : OOC_TK);
+  int t = pick_tile(info->memCap, info->tk);
+  while(info->tk > t) {
+    info->tk = t;
+    t = pick_tile(info->memCap, info->tk);
+  }
+  if(!tile_fits(info->memCap, t, info->tk)) {
+    fprintf(stderr, "--mem=%s is too small for even %dx%d tiles\n", argv[1] + 6, OOC_MIN_TILE, OOC_MIN_TILE);
+    exit(1);
+  }
+  info->tm = (M < t ? M : t);
+  info->tn = (N < t ? N : t);
+
+  info->C.fd = create_bin(argv[4], M, N, true, &info->C.hdr);
+
+  return info;
+}
+
+__attribute__((no_instrument_function))
+void free_info(info_t* info)
+{
+  close(info->A.fd);
+  close(info->B.fd);
+  if(fsync(info->C.fd) != 0 || close(info->C.fd) != 0) {
+    fprintf(stderr, "Failed to write the output\n");
+    exit(1);
+  }
+  free(info);
+}
+
+// ------------------------ tile I/O ------------------------
+
+__attribute__((no_instrument_function))
+static void full_io(int fd, bool write, float* buf, size_t bytes, off_t offset)
+{
+  char* p = (char*)buf;
+  while(bytes > 0) {
+    ssize_t n = (write ? pwrite(fd, p, bytes, offset) : pread(fd, p, bytes, offset));
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) {
+      fprintf(stderr, "%s failed: %s\n", write ? "pwrite" : "pread", n < 0 ? strerror(errno) : "unexpected end of file");
+      exit(1);
+    }
+    p += n;
+    bytes -= n;
+    offset += n;
+  }
+}
+
+// one transfer per stored vector of the tile, or a single one when the tile spans whole vectors
+__attribute__((no_instrument_function))
+static size_t tile_io(tile_t* tile, bool write)
+{
+  matbin_header_t* hdr = &tile->file->hdr;
+  int outer0 = (hdr->isRowForm ? tile->row : tile->col), outerN = (hdr->isRowForm ? tile->rows : tile->cols);
+  int inner0 = (hdr->isRowForm ? tile->col : tile->row), innerN = (hdr->isRowForm ? tile->cols : tile->rows);
+  int innerAll = (hdr->isRowForm ? hdr->cols : hdr->rows);
+  off_t base = hdr->dataOffset + sizeof(float) * ((off_t)outer0 * hdr->ld + inner0);
+
+  if(inner0 == 0 && innerN == innerAll) {
+    size_t bytes = sizeof(float) * (size_t)outerN * hdr->ld;
+    full_io(tile->file->fd, write, tile->data, bytes, base);
+    return bytes;
+  }
+
+  for(int o = 0; o < outerN; o++) {
+    full_io(tile->file->fd, write, &tile->data[(size_t)o * tile->ld], sizeof(float) * innerN,
+            base + sizeof(float) * (off_t)o * hdr->ld);
+  }
+  return sizeof(float) * (size_t)outerN * innerN;
+}
+
+__attribute__((no_instrument_function))
+static void* io_thread(void* arg)
+{
+  io_t* io = arg;
+
+  pthread_mutex_lock(&io->lock);
+  while(true) {
+    while(io->count == 0 && !io->stop) pthread_cond_wait(&io->changed, &io->lock);
+    if(io->count == 0) break;
+
+    request_t req = io->queue[io->head];
+    io->head = (io->head + 1) % OOC_QUEUE;
+    io->count--;
+    pthread_mutex_unlock(&io->lock);
+
+    size_t bytes = tile_io(req.tile, req.write);
+
+    pthread_mutex_lock(&io->lock);
+    if(req.write) io->bytesWritten += bytes;
+    else io->bytesRead += bytes;
+    req.tile->busy = false;
+    pthread_cond_broadcast(&io->changed);
+  }
+  pthread_mutex_unlock(&io->lock);
+
+  return NULL;
+}
+
+// never blocks: each of the 6 tile buffers has at most one request in flight
+__attribute__((no_instrument_function))
+static void io_submit(io_t* io, tile_t* tile, bool write)
+{
+  pthread_mutex_lock(&io->lock);
+  tile->busy = true;
+  io->queue[(io->head + io->count) % OOC_QUEUE] = (request_t){ tile, write };
+  io->count++;
+  pthread_cond_broadcast(&io->changed);
+  pthread_mutex_unlock(&io->lock);
+}
+
+__attribute__((no_instrument_function))
+static void io_wait(io_t* io, tile_t* tile)
+{
+  pthread_mutex_lock(&io->lock);
+  while(tile->busy) pthread_cond_wait(&io->changed, &io->lock);
+  pthread_mutex_unlock(&io->lock);
+}
+
+// ------------------------ multiply ------------------------
+
+__attribute__((no_instrument_function))
+static void tile_alloc(info_t* info, tile_t* tile, binfile_t* file, int rows, int cols)
+{
+  // room for the largest tile in either form, ld rounded like mat_alloc
+  int perLine = MAT_ALIGN / sizeof(float);
+  size_t bytes = sizeof(float) * (size_t)((rows + perLine - 1) / perLine * perLine) * ((cols + perLine - 1) / perLine * perLine);
+
+  tile->file = file;
+  tile->rows = -1;
+  tile->busy = false;
+  tile->data = aligned_alloc(MAT_ALIGN, bytes);
+  memset(tile->data, 0, bytes);
+  info->memUsed += bytes;
+}
+
+// points tile at rows x cols of its file starting at (row, col)
+__attribute__((no_instrument_function))
+static void tile_place(tile_t* tile, int row, int col, int rows, int cols)
+{
+  int perLine = MAT_ALIGN / sizeof(float);
+  int inner = (tile->file->hdr.isRowForm ? cols : rows);
+  tile->row = row;
+  tile->col = col;
+  tile->rows = rows;
+  tile->cols = cols;
+  tile->ld = (inner + perLine - 1) / perLine * perLine;
+}
+
+__attribute__((no_instrument_function))
+static bool tile_holds(tile_t* tile, int row, int col)
+{
+  return tile->rows >= 0 && tile->row == row && tile->col == col;
+}
+
+typedef struct {
+  int i, j, k; // tile indexes into C rows, C cols and the inner dimension
+} step_t;
+
+// row-by-row snake over C tiles, k reversed on every other tile
+__attribute__((no_instrument_function))
+static step_t* make_steps(int ti, int tj, int tk, int* count)
+{
+  step_t* steps = malloc(sizeof(*steps) * (size_t)ti * tj * tk);
+  int n = 0, tileNo = 0;
+  for(int i = 0; i < ti; i++) {
+    for(int jj = 0; jj < tj; jj++, tileNo++) {
+      int j = (i % 2 == 0 ? jj : tj - 1 - jj);
+      for(int kk = 0; kk < tk; kk++) steps[n++] = (step_t){ i, j, tileNo % 2 == 0 ? kk : tk - 1 - kk };
+    }
+  }
+  *count = n;
+  return steps;
+}
+
+// makes sure the A or B tile at (row, col) is (being) read into one of the pair, returns which
+__attribute__((no_instrument_function))
+static tile_t* fetch(io_t* io, tile_t pair[2], tile_t* keep, int row, int col, int rows, int cols)
+{
+  for(int s = 0; s < 2; s++) if(tile_holds(&pair[s], row, col)) return &pair[s];
+
+  tile_t* tile = (keep == &pair[0] ? &pair[1] : &pair[0]);
+  io_wait(io, tile);
+  tile_place(tile, row, col, rows, cols);
+  io_submit(io, tile, false);
+  return tile;
+}
+
+void multiply(info_t* info)
+{
+  io_t* io = &info->io;
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->changed, NULL);
+  pthread_create(&io->thread, NULL, io_thread, io);
+
+  int M = info->A.hdr.rows, K = info->A.hdr.cols, N = info->B.hdr.cols;
+  int tm = info->tm, tn = info->tn, tk = info->tk;
+  int ti = (M + tm - 1) / tm, tj = (N + tn - 1) / tn, tkN = (K + tk - 1) / tk;
+
+  tile_t A[2], B[2], C[2];
+  for(int s = 0; s < 2; s++) {
+    tile_alloc(info, &A[s], &info->A, tm, tk);
+    tile_alloc(info, &B[s], &info->B, tk, tn);
+    tile_alloc(info, &C[s], &info->C, tm, tn);
+  }
+
+  int count;
+  step_t* steps = make_steps(ti, tj, tkN, &count);
+
+  #define ROWS(idx, t, total) ((idx)*(t) + (t) <= (total) ? (t) : (total) - (idx)*(t))
+  step_t* st = &steps[0];
+  tile_t* a = fetch(io, A, NULL, st->i*tm, st->k*tk, ROWS(st->i, tm, M), ROWS(st->k, tk, K));
+  tile_t* b = fetch(io, B, NULL, st->k*tk, st->j*tn, ROWS(st->k, tk, K), ROWS(st->j, tn, N));
+  tile_t* c = &C[1];
+
+  for(int s = 0; s < count; s++) {
+    st = &steps[s];
+    bool first = (s == 0 || steps[s-1].i != st->i || steps[s-1].j != st->j);
+    bool last = (s == count - 1 || steps[s+1].i != st->i || steps[s+1].j != st->j);
+
+    // queue the next step's reads before waiting on this one, so they overlap the multiply
+    tile_t *nextA = a, *nextB = b;
+    if(s + 1 < count) {
+      step_t* nx = &steps[s+1];
+      nextA = fetch(io, A, a, nx->i*tm, nx->k*tk, ROWS(nx->i, tm, M), ROWS(nx->k, tk, K));
+      nextB = fetch(io, B, b, nx->k*tk, nx->j*tn, ROWS(nx->k, tk, K), ROWS(nx->j, tn, N));
+    }
+
+    if(first) {
+      c = (c == &C[0] ? &C[1] : &C[0]);
+      io_wait(io, c); // its previous tile may still be being written
+      tile_place(c, st->i*tm, st->j*tn, ROWS(st->i, tm, M), ROWS(st->j, tn, N));
+    }
+
+    io_wait(io, a);
+    io_wait(io, b);
+
+    // row form C tile is column form C^T = B^T * A^T, the same mapping as mat_mul_into
+    sgemm(info->B.hdr.isRowForm ? 'N':'T', info->A.hdr.isRowForm ? 'N':'T', c->cols, c->rows, a->cols,
+          1.0f, b->data, b->ld, a->data, a->ld, first ? 0.0f : 1.0f, c->data, c->ld);
+
+    if(last) io_submit(io, c, true);
+
+    a = nextA;
+    b = nextB;
+  }
+  #undef ROWS
+
+  pthread_mutex_lock(&io->lock);
+  io->stop = true;
+  pthread_cond_broadcast(&io->changed);
+  pthread_mutex_unlock(&io->lock);
+  pthread_join(io->thread, NULL);
+
+  for(int s = 0; s < 2; s++) {
+    free(A[s].data);
+    free(B[s].data);
+    free(C[s].data);
+  }
+  free(steps);
+  pthread_mutex_destroy(&io->lock);
+  pthread_cond_destroy(&io->changed);
+}
@@ -0,0 +1,696 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "sgemm.h"
+
+/**
+ * Goto-style blocking:
+ *  - an NC wide panel of op(B) is packed KC rows at a time (stays in L3)
+ *  - an MC x KC block of op(A) is packed against it (stays in L2)
+ *  - the micro-kernel computes MR x NR tiles of C in registers
+ * Both packed layouts are "micro-panel major" so the kernel reads them with
+ * unit stride no matter how A and B were stored. MC, KC and NC (and the
+ * micro-kernel and thread grid) come from the per-host config, see sgemm.h.
+ */
+
+#define MR SGEMM_MR
+#define NR SGEMM_NR
+
+// below this many multiply-adds a grid of threads costs more than it saves
+#define SGEMM_MIN_THREAD_WORK (1L << 22)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+__attribute__((no_instrument_function))
+static bool is_trans(char t) { return t == 'T' || t == 't' || t == 'C' || t == 'c'; }
+
+__attribute__((no_instrument_function))
+static bool is_valid(char t) { return t == 'N' || t == 'n' || is_trans(t); }
+
+// op(X) is rows x cols; as stored it is that or its transpose, and ld has to
+// cover a whole stored column
+__attribute__((no_instrument_function))
+static bool valid_ld(char t, int rows, int cols, int ld) { return ld >= MAX(is_trans(t) ? cols : rows, 1); }
+
+// n elements of X starting at element off, as floats: fp32 data is used where
+// it is, 16-bit data is widened into tmp (F16C for half, a shift for bfloat16)
+__attribute__((no_instrument_function))
+static inline const float* load_run(sgemm_type_t type, const void* X, size_t off, int n, float* tmp)
+{
+  if(type == SGEMM_F32) return (const float*)X + off;
+
+  const uint16_t* h = (const uint16_t*)X + off;
+  int i = 0;
+  if(type == SGEMM_F16) {
+    for(; i + 8 <= n; i += 8) _mm256_storeu_ps(&tmp[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&h[i])));
+    for(; i < n; i++) tmp[i] = _cvtsh_ss(h[i]);
+  }
+  else {
+    for(; i + 8 <= n; i += 8) {
+      __m256i wide = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&h[i])), 16);
+      _mm256_storeu_ps(&tmp[i], _mm256_castsi256_ps(wide));
+    }
+    for(; i < n; i++) {
+      uint32_t bits = (uint32_t)h[i] << 16;
+      memcpy(&tmp[i], &bits, sizeof(bits));
+    }
+  }
+  return tmp;
+}
+
+// op(A)[i0:i0+mc, k0:k0+kc] -> ceil(mc/MR) panels of kc x MR, zero padded past mc
+__attribute__((no_instrument_function))
+static void pack_a(bool trans, sgemm_type_t type, const void* A, int lda, int i0, int k0, int mc, int kc, float* Ap)
+{
+  float tmp[SGEMM_MAX_KC];
+
+  for(int ip = 0; ip < mc; ip += MR) {
+    int m = MIN(MR, mc - ip);
+
+    if(!trans) {
+      // columns of A are contiguous along i
+      for(int k = 0; k < kc; k++) {
+        const float* a = load_run(type, A, (size_t)(k0+k)*lda + i0 + ip, m, tmp);
+        for(int i = 0; i < m; i++) Ap[k*MR + i] = a[i];
+        for(int i = m; i < MR; i++) Ap[k*MR + i] = 0.0f;
+      }
+    }
+    else {
+      // op(A)(i, k) = A[k + i*lda], read each stored column along k
+      for(int i = 0; i < m; i++) {
+        const float* a = load_run(type, A, (size_t)(i0+ip+i)*lda + k0, kc, tmp);
+        for(int k = 0; k < kc; k++) Ap[k*MR + i] = a[k];
+      }
+      for(int i = m; i < MR; i++) {
+        for(int k = 0; k < kc; k++) Ap[k*MR + i] = 0.0f;
+      }
+    }
+
+    Ap += MR*kc;
+  }
+}
+
+// op(B)[k0:k0+kc, j0:j0+nc] -> ceil(nc/NR) panels of kc x NR, zero padded past nc
+__attribute__((no_instrument_function))
+static void pack_b(bool trans, sgemm_type_t type, const void* B, int ldb, int k0, int j0, int kc, int nc, float* Bp)
+{
+  float tmp[SGEMM_MAX_KC];
+
+  for(int jp = 0; jp < nc; jp += NR) {
+    int n = MIN(NR, nc - jp);
+
+    if(!trans) {
+      // op(B)(k, j) = B[k + j*ldb], read each stored column along k
+      for(int j = 0; j < n; j++) {
+        const float* b = load_run(type, B, (size_t)(j0+jp+j)*ldb + k0, kc, tmp);
+        for(int k = 0; k < kc; k++) Bp[k*NR + j] = b[k];
+      }
+      for(int j = n; j < NR; j++) {
+        for(int k = 0; k < kc; k++) Bp[k*NR + j] = 0.0f;
+      }
+    }
+    else {
+      // op(B)(k, j) = B[j + k*ldb], contiguous along j
+      for(int k = 0; k < kc; k++) {
+        const float* b = load_run(type, B, (size_t)(k0+k)*ldb + j0 + jp, n, tmp);
+        for(int j = 0; j < n; j++) Bp[k*NR + j] = b[j];
+        for(int j = n; j < NR; j++) Bp[k*NR + j] = 0.0f;
+      }
+    }
+
+    Bp += NR*kc;
+  }
+}
+
+// one k step of the MR x NR tile: two vectors of A against NR broadcasts of B
+#define KERNEL_STEP(k) do { \
+    __m256 a0 = _mm256_load_ps(&Ap[(k)*MR]); \
+    __m256 a1 = _mm256_load_ps(&Ap[(k)*MR + 8]); \
+    __m256 b; \
+    b = _mm256_broadcast_ss(&Bp[(k)*NR + 0]); \
+    c00 = _mm256_fmadd_ps(a0, b, c00); c01 = _mm256_fmadd_ps(a1, b, c01); \
+    b = _mm256_broadcast_ss(&Bp[(k)*NR + 1]); \
+    c10 = _mm256_fmadd_ps(a0, b, c10); c11 = _mm256_fmadd_ps(a1, b, c11); \
+    b = _mm256_broadcast_ss(&Bp[(k)*NR + 2]); \
+    c20 = _mm256_fmadd_ps(a0, b, c20); c21 = _mm256_fmadd_ps(a1, b, c21); \
+    b = _mm256_broadcast_ss(&Bp[(k)*NR + 3]); \
+    c30 = _mm256_fmadd_ps(a0, b, c30); c31 = _mm256_fmadd_ps(a1, b, c31); \
+    b = _mm256_broadcast_ss(&Bp[(k)*NR + 4]); \
+    c40 = _mm256_fmadd_ps(a0, b, c40); c41 = _mm256_fmadd_ps(a1, b, c41); \
+    b = _mm256_broadcast_ss(&Bp[(k)*NR + 5]); \
+    c50 = _mm256_fmadd_ps(a0, b, c50); c51 = _mm256_fmadd_ps(a1, b, c51); \
+  } while(0)
+
+// C[0:m, 0:n] += alpha * Ap * Bp for one MR x NR tile (m <= MR, n <= NR).
+// unrolled: k four steps at a time, prefetching the A panel 8 steps ahead
+__attribute__((no_instrument_function, always_inline))
+static inline void micro_tile(int kc, const float* Ap, const float* Bp, float alpha, float* C, int ldc, int m, int n, bool unrolled)
+{
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+  int k = 0;
+  if(unrolled) {
+    for(; k + 4 <= kc; k += 4) {
+      _mm_prefetch((const char*)&Ap[(k + 8)*MR], _MM_HINT_T0);
+      _mm_prefetch((const char*)&Ap[(k + 10)*MR], _MM_HINT_T0);
+      KERNEL_STEP(k);
+      KERNEL_STEP(k + 1);
+      KERNEL_STEP(k + 2);
+      KERNEL_STEP(k + 3);
+    }
+  }
+  for(; k < kc; k++) KERNEL_STEP(k);
+
+  __m256 acc[NR][2] = { { c00, c01 }, { c10, c11 }, { c20, c21 },
+                        { c30, c31 }, { c40, c41 }, { c50, c51 } };
+  __m256 va = _mm256_set1_ps(alpha);
+
+  if(m == MR && n == NR) {
+    for(int j = 0; j < NR; j++) {
+      float* c = &C[(size_t)j*ldc];
+      _mm256_storeu_ps(&c[0], _mm256_fmadd_ps(va, acc[j][0], _mm256_loadu_ps(&c[0])));
+      _mm256_storeu_ps(&c[8], _mm256_fmadd_ps(va, acc[j][1], _mm256_loadu_ps(&c[8])));
+    }
+    return;
+  }
+
+  // edge tile: spill and only touch the valid part of C
+  float tmp[NR][MR] __attribute__((aligned(32)));
+  for(int j = 0; j < NR; j++) {
+    _mm256_store_ps(&tmp[j][0], acc[j][0]);
+    _mm256_store_ps(&tmp[j][8], acc[j][1]);
+  }
+  for(int j = 0; j < n; j++) {
+    for(int i = 0; i < m; i++) C[(size_t)j*ldc + i] += alpha * tmp[j][i];
+  }
+}
+
+#undef KERNEL_STEP
+
+typedef void (*kernel_t)(int kc, const float* Ap, const float* Bp, float alpha, float* C, int ldc, int m, int n);
+
+__attribute__((no_instrument_function))
+static void kernel_16x6(int kc, const float* Ap, const float* Bp, float alpha, float* C, int ldc, int m, int n)
+{
+  micro_tile(kc, Ap, Bp, alpha, C, ldc, m, n, false);
+}
+
+__attribute__((no_instrument_function))
+static void kernel_16x6u4(int kc, const float* Ap, const float* Bp, float alpha, float* C, int ldc, int m, int n)
+{
+  micro_tile(kc, Ap, Bp, alpha, C, ldc, m, n, true);
+}
+
+static const kernel_t kernels[] = { kernel_16x6, kernel_16x6u4 };
+const char* const sgemm_kernel_names[] = { "16x6", "16x6u4" };
+const int sgemm_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+// ------------------------ config ------------------------
+
+const char* const sgemm_class_names[SGEMM_CLASSES] = { "small", "medium", "large" };
+
+// the hand picked blocking, kept for any class the config file does not cover
+static const sgemm_config_t builtin = { .mc = 144, .kc = 256, .nc = 3072, .kernel = 0, .gridM = 1, .gridN = 1 };
+
+static sgemm_config_t configs[SGEMM_CLASSES] = { builtin, builtin, builtin };
+static pthread_once_t configOnce = PTHREAD_ONCE_INIT;
+
+__attribute__((no_instrument_function))
+sgemm_config_t sgemm_default_config(void)
+{
+  return builtin;
+}
+
+__attribute__((no_instrument_function))
+static void load_host_config(void)
+{
+  const char* path = sgemm_config_path();
+  if(path != NULL) sgemm_load_config(path);
+}
+
+__attribute__((no_instrument_function))
+sgemm_class_t sgemm_class(int M, int N, int K)
+{
+  double work = (double)M * N * K;
+  if(work < 192.0 * 192 * 192) return SGEMM_SMALL;
+  if(work < 768.0 * 768 * 768) return SGEMM_MEDIUM;
+  return SGEMM_LARGE;
+}
+
+__attribute__((no_instrument_function))
+bool sgemm_valid_config(sgemm_config_t cfg)
+{
+  return cfg.mc > 0 && cfg.mc % MR == 0 && cfg.nc > 0 && cfg.nc % NR == 0
+         && cfg.kc > 0 && cfg.kc <= SGEMM_MAX_KC && cfg.kernel >= 0 && cfg.kernel < sgemm_kernels
+         && cfg.gridM > 0 && cfg.gridN > 0 && cfg.gridM * cfg.gridN <= 1024;
+}
+
+__attribute__((no_instrument_function))
+sgemm_config_t sgemm_get_config(sgemm_class_t cls)
+{
+  pthread_once(&configOnce, load_host_config);
+  return configs[cls];
+}
+
+__attribute__((no_instrument_function))
+bool sgemm_set_config(sgemm_class_t cls, sgemm_config_t cfg)
+{
+  pthread_once(&configOnce, load_host_config);
+  if(cls < 0 || cls >= SGEMM_CLASSES || !sgemm_valid_config(cfg)) return false;
+  configs[cls] = cfg;
+  return true;
+}
+
+__attribute__((no_instrument_function))
+const char* sgemm_cpu_model(void)
+{
+  static char model[256];
+  if(model[0] != '\0') return model;
+
+  strcpy(model, "unknown");
+  FILE* file = fopen("/proc/cpuinfo", "r");
+  if(file == NULL) return model;
+
+  char line[512];
+  while(fgets(line, sizeof(line), file)) {
+    char* colon = strchr(line, ':');
+    if(strncmp(line, "model name", 10) == 0 && colon != NULL) {
+      colon += strspn(colon + 1, " \t") + 1;
+      colon[strcspn(colon, "\n")] = '\0';
+      if(*colon != '\0') snprintf(model, sizeof(model), "%s", colon);
+      break;
+    }
+  }
+  fclose(file);
+  return model;
+}
+
+__attribute__((no_instrument_function))
+const char* sgemm_config_path(void)
+{
+  static char path[4096];
+  const char* env = getenv("SGEMM_CONFIG");
+  if(env != NULL && *env != '\0') return env;
+
+  const char* home = getenv("HOME");
+  if(home == NULL) return NULL;
+  snprintf(path, sizeof(path), "%s/.sgemm.conf", home);
+  return path;
+}
+
+// one config line, cpu pointing into line; false for comments, blank and malformed lines
+__attribute__((no_instrument_function))
+static bool parse_line(char* line, sgemm_class_t* cls, sgemm_config_t* cfg, char** cpu)
+{
+  char clsName[16], kernelName[16];
+  int cpuAt = -1;
+  if(sscanf(line, "%15s mc=%d kc=%d nc=%d kernel=%15s grid=%dx%d cpu=%n", clsName, &cfg->mc, &cfg->kc, &cfg->nc,
+            kernelName, &cfg->gridM, &cfg->gridN, &cpuAt) != 7 || cpuAt < 0) return false;
+
+  *cpu = &line[cpuAt];
+  (*cpu)[strcspn(*cpu, "\n")] = '\0';
+
+  *cls = SGEMM_CLASSES;
+  for(int c = 0; c < SGEMM_CLASSES; c++) if(strcmp(clsName, sgemm_class_names[c]) == 0) *cls = c;
+  cfg->kernel = -1;
+  for(int k = 0; k < sgemm_kernels; k++) if(strcmp(kernelName, sgemm_kernel_names[k]) == 0) cfg->kernel = k;
+
+  return *cls != SGEMM_CLASSES && sgemm_valid_config(*cfg);
+}
+
+__attribute__((no_instrument_function))
+int sgemm_load_config(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if(file == NULL) return -1;
+
+  const char* model = sgemm_cpu_model();
+  char line[1024];
+  int applied = 0;
+  for(int lineNo = 1; fgets(line, sizeof(line), file); lineNo++) {
+    if(line[strspn(line, " \t\n")] == '\0' || line[0] == '#') continue;
+
+    sgemm_class_t cls;
+    sgemm_config_t cfg;
+    char* cpu;
+    if(!parse_line(line, &cls, &cfg, &cpu)) {
+      fprintf(stderr, "%s:%d: ignoring invalid sgemm config line\n", path, lineNo);
+      continue;
+    }
+    if(strcmp(cpu, model) == 0) {
+      configs[cls] = cfg;
+      applied++;
+    }
+  }
+
+  fclose(file);
+  return applied;
+}
+
+__attribute__((no_instrument_function))
+bool sgemm_save_config(const char* path, const sgemm_config_t tuned[SGEMM_CLASSES])
+{
+  char tmpPath[4096];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  FILE* out = fopen(tmpPath, "w");
+  if(out == NULL) return false;
+
+  const char* model = sgemm_cpu_model();
+
+  // keep every line that is not one of this host's
+  FILE* in = fopen(path, "r");
+  if(in != NULL) {
+    char line[1024], copy[1024];
+    while(fgets(line, sizeof(line), in)) {
+      sgemm_class_t cls;
+      sgemm_config_t cfg;
+      char* cpu;
+      strcpy(copy, line);
+      if(parse_line(copy, &cls, &cfg, &cpu) && strcmp(cpu, model) == 0) continue;
+      fputs(line, out);
+    }
+    fclose(in);
+  }
+  else {
+    fprintf(out, "# sgemm blocking per host and size class, written by autotune\n");
+  }
+
+  for(int c = 0; c < SGEMM_CLASSES; c++) {
+    const sgemm_config_t* cfg = &tuned[c];
+    fprintf(out, "%s mc=%d kc=%d nc=%d kernel=%s grid=%dx%d cpu=%s\n", sgemm_class_names[c], cfg->mc, cfg->kc, cfg->nc,
+            sgemm_kernel_names[cfg->kernel], cfg->gridM, cfg->gridN, model);
+  }
+
+  bool ok = (fclose(out) == 0);
+  return ok && rename(tmpPath, path) == 0;
+}
+
+// ------------------------ multiply ------------------------
+
+// the pack buffers only grow with the blocking, so each thread keeps its own
+// pair instead of paying for a fresh (mmap'd, page faulting) allocation per call
+static __thread float* packA;
+static __thread float* packB;
+static __thread size_t packACap, packBCap;
+
+__attribute__((no_instrument_function))
+static float* pack_buffer(float** buf, size_t* cap, size_t floats)
+{
+  if(floats > *cap) {
+    free(*buf);
+    *buf = aligned_alloc(64, (sizeof(float) * floats + 63) / 64 * 64);
+    *cap = floats;
+  }
+  return *buf;
+}
+
+__attribute__((no_instrument_function))
+static void scale_c(int M, int N, float beta, float* C, int ldc)
+{
+  if(beta == 1.0f) return;
+
+  for(int j = 0; j < N; j++) {
+    float* c = &C[(size_t)j*ldc];
+    // beta == 0 overwrites, so NaNs already in C do not survive
+    if(beta == 0.0f) for(int i = 0; i < M; i++) c[i] = 0.0f;
+    else for(int i = 0; i < M; i++) c[i] *= beta;
+  }
+}
+
+// C = alpha * op(A) * op(B) + beta * C on this thread, with either operand
+// optionally coming already packed (pa/pb) instead of being packed from A/B
+// here; a packed operand's kc (and nc) override the config's
+__attribute__((no_instrument_function))
+static void gemm(const sgemm_config_t* cfg, bool ta, bool tb, int M, int N, int K,
+                 float alpha, sgemm_type_t typeA, const void* A, int lda, const sgemm_pack_t* pa,
+                 sgemm_type_t typeB, const void* B, int ldb, const sgemm_pack_t* pb,
+                 float beta, float* C, int ldc)
+{
+  if(M == 0 || N == 0) return;
+
+  scale_c(M, N, beta, C, ldc);
+  if(alpha == 0.0f || K == 0) return;
+
+  int MC = cfg->mc, KC = cfg->kc, NC = cfg->nc;
+  if(pa) KC = pa->kc;
+  if(pb) {
+    KC = pb->kc;
+    NC = pb->nc;
+  }
+  kernel_t kernel = kernels[cfg->kernel];
+
+  // no bigger than the blocks this product has: a small one does not get a whole KC x NC panel
+  int mcMax = MIN(MC, (M + MR - 1) / MR * MR), kcMax = MIN(KC, K), ncMax = MIN(NC, N);
+  float* bufA = (pa ? NULL : pack_buffer(&packA, &packACap, (size_t)mcMax * kcMax));
+  float* bufB = (pb ? NULL : pack_buffer(&packB, &packBCap, (size_t)kcMax * ((ncMax + NR - 1) / NR * NR)));
+  int mPadded = (M + MR - 1) / MR * MR;
+
+  for(int jc = 0; jc < N; jc += NC) {
+    int nc = MIN(NC, N - jc);
+
+    for(int pc = 0; pc < K; pc += KC) {
+      int kc = MIN(KC, K - pc);
+
+      const float* Bp = bufB;
+      if(pb) Bp = &pb->data[(size_t)K*jc + (size_t)pc * ((nc + NR - 1) / NR * NR)];
+      else pack_b(tb, typeB, B, ldb, pc, jc, kc, nc, bufB);
+
+      for(int ic = 0; ic < M; ic += MC) {
+        int mc = MIN(MC, M - ic);
+
+        const float* Ap = bufA;
+        if(pa) Ap = &pa->data[(size_t)pc*mPadded + (size_t)ic*kc];
+        else pack_a(ta, typeA, A, lda, ic, pc, mc, kc, bufA);
+
+        for(int jr = 0; jr < nc; jr += NR) {
+          for(int ir = 0; ir < mc; ir += MR) {
+            kernel(kc, &Ap[ir*kc], &Bp[jr*kc], alpha,
+                   &C[(size_t)(jc+jr)*ldc + ic + ir], ldc,
+                   MIN(MR, mc - ir), MIN(NR, nc - jr));
+          }
+        }
+      }
+    }
+  }
+}
+
+typedef struct {
+  const sgemm_config_t* cfg;
+  bool ta, tb;
+  int M, N, K;
+  float alpha, beta;
+  sgemm_type_t typeA, typeB;
+  const void *A, *B;
+  const sgemm_pack_t *pa, *pb;
+  int lda, ldb, ldc;
+  float* C;
+} block_t;
+
+__attribute__((no_instrument_function))
+static void* gemm_thread(void* arg)
+{
+  block_t* b = arg;
+  gemm(b->cfg, b->ta, b->tb, b->M, b->N, b->K, b->alpha, b->typeA, b->A, b->lda, b->pa, b->typeB, b->B, b->ldb, b->pb, b->beta, b->C, b->ldc);
+
+  // this thread ends here, its pack buffers with it
+  free(packA);
+  free(packB);
+  packA = packB = NULL;
+  packACap = packBCap = 0;
+  return NULL;
+}
+
+__attribute__((no_instrument_function))
+static const void* offset(sgemm_type_t type, const void* X, size_t elements)
+{
+  return (const char*)X + elements * (type == SGEMM_F32 ? sizeof(float) : sizeof(uint16_t));
+}
+
+// gemm() with C split over the config's thread grid, each thread packing its own blocks.
+// A packed operand is shared whole: its offsets follow its own rows (A) or
+// columns (B) only, so with B packed every thread takes rows of C and with A
+// packed columns; with both packed there is nothing left to split
+__attribute__((no_instrument_function))
+static void gemm_grid(bool ta, bool tb, int M, int N, int K,
+                      float alpha, sgemm_type_t typeA, const void* A, int lda, const sgemm_pack_t* pa,
+                      sgemm_type_t typeB, const void* B, int ldb, const sgemm_pack_t* pb,
+                      float beta, float* C, int ldc)
+{
+  pthread_once(&configOnce, load_host_config);
+  const sgemm_config_t* cfg = &configs[sgemm_class(M, N, K)];
+
+  int gridM = cfg->gridM, gridN = cfg->gridN;
+  if(pa && pb) gridM = gridN = 1;
+  else if(pb) {
+    gridM *= gridN;
+    gridN = 1;
+  }
+  else if(pa) {
+    gridN *= gridM;
+    gridM = 1;
+  }
+
+  // rows in whole MR tiles and columns in whole NR tiles per thread
+  int stepM = ((M + gridM - 1) / gridM + MR - 1) / MR * MR;
+  int stepN = ((N + gridN - 1) / gridN + NR - 1) / NR * NR;
+  if((double)M * N * K < SGEMM_MIN_THREAD_WORK || gridM * gridN == 1 || stepM == 0 || stepN == 0) {
+    gemm(cfg, ta, tb, M, N, K, alpha, typeA, A, lda, pa, typeB, B, ldb, pb, beta, C, ldc);
+    return;
+  }
+
+  int count = 0;
+  block_t* blocks = malloc(sizeof(*blocks) * gridM * gridN);
+  for(int i0 = 0; i0 < M; i0 += stepM) {
+    for(int j0 = 0; j0 < N; j0 += stepN) {
+      blocks[count++] = (block_t){
+        .cfg = cfg, .ta = ta, .tb = tb, .M = MIN(stepM, M - i0), .N = MIN(stepN, N - j0), .K = K,
+        .alpha = alpha, .beta = beta, .typeA = typeA, .typeB = typeB, .pa = pa, .pb = pb,
+        // op(A) row i0 and op(B) column j0 as stored (a packed side is never split)
+        .A = (pa ? NULL : offset(typeA, A, ta ? (size_t)i0*lda : (size_t)i0)), .lda = lda,
+        .B = (pb ? NULL : offset(typeB, B, tb ? (size_t)j0 : (size_t)j0*ldb)), .ldb = ldb,
+        .C = &C[(size_t)j0*ldc + i0], .ldc = ldc,
+      };
+    }
+  }
+
+  pthread_t* threads = malloc(sizeof(*threads) * count);
+  for(int t = 1; t < count; t++) pthread_create(&threads[t], NULL, gemm_thread, &blocks[t]);
+  block_t* b = &blocks[0];
+  gemm(cfg, ta, tb, b->M, b->N, K, alpha, typeA, b->A, lda, pa, typeB, b->B, ldb, pb, beta, b->C, ldc);
+  for(int t = 1; t < count; t++) pthread_join(threads[t], NULL);
+
+  free(threads);
+  free(blocks);
+}
+
+void sgemm(char transA, char transB, int M, int N, int K,
+           float alpha, const float* A, int lda,
+           const float* B, int ldb,
+           float beta, float* C, int ldc)
+{
+  if(!is_valid(transA) || !is_valid(transB) || M < 0 || N < 0 || K < 0
+     || !valid_ld(transA, M, K, lda) || !valid_ld(transB, K, N, ldb) || ldc < MAX(M, 1)) {
+    fprintf(stderr, "sgemm: invalid arguments\n");
+    return;
+  }
+
+  gemm_grid(is_trans(transA), is_trans(transB), M, N, K, alpha, SGEMM_F32, A, lda, NULL, SGEMM_F32, B, ldb, NULL, beta, C, ldc);
+}
+
+void sgemm_ex(char transA, char transB, int M, int N, int K,
+              float alpha, sgemm_type_t typeA, const void* A, int lda,
+              sgemm_type_t typeB, const void* B, int ldb,
+              float beta, float* C, int ldc)
+{
+  if(!is_valid(transA) || !is_valid(transB) || M < 0 || N < 0 || K < 0
+     || !valid_ld(transA, M, K, lda) || !valid_ld(transB, K, N, ldb) || ldc < MAX(M, 1)) {
+    fprintf(stderr, "sgemm_ex: invalid arguments\n");
+    return;
+  }
+
+  gemm_grid(is_trans(transA), is_trans(transB), M, N, K, alpha, typeA, A, lda, NULL, typeB, B, ldb, NULL, beta, C, ldc);
+}
+
+// ------------------ pre-packed operands ----------------
+// the packed layouts are every block gemm() would pack, in the order it visits them:
+//  - A: for each pc, for each ic: ceil(mc/MR) panels of kc x MR  -> block at pc*ceil(M/MR)*MR + ic*kc
+//  - B: for each jc, for each pc: ceil(nc/NR) panels of kc x NR  -> block at K*jc + pc*ceil(nc/NR)*NR
+// (mc and nc are multiples of MR and NR, so only the last block in a row is short).
+// A pack's offsets depend on kc and a B pack's on kc and nc, so those are kept
+// with the pack and gemm() follows them whatever the config says by then.
+// Packing takes the blocking of the square product of the packed operand's size.
+
+__attribute__((no_instrument_function))
+static sgemm_pack_t* pack_alloc(char side, int rows, int cols, const sgemm_config_t* cfg, size_t floats)
+{
+  sgemm_pack_t* pack = malloc(sizeof(*pack));
+  pack->side = side;
+  pack->rows = rows;
+  pack->cols = cols;
+  pack->kc = cfg->kc;
+  pack->nc = cfg->nc;
+  pack->bytes = sizeof(float) * floats;
+  // aligned_alloc wants a whole number of alignments
+  pack->data = aligned_alloc(64, (pack->bytes + 63) / 64 * 64 + (pack->bytes == 0 ? 64 : 0));
+  return pack;
+}
+
+sgemm_pack_t* sgemm_pack_a(char transA, int M, int K, const float* A, int lda)
+{
+  if(!is_valid(transA) || M < 0 || K < 0 || !valid_ld(transA, M, K, lda)) {
+    fprintf(stderr, "sgemm_pack_a: invalid arguments\n");
+    return NULL;
+  }
+
+  sgemm_config_t cfg = sgemm_get_config(sgemm_class(M, M, K));
+  int mPadded = (M + MR - 1) / MR * MR;
+  sgemm_pack_t* pack = pack_alloc('A', M, K, &cfg, (size_t)mPadded * K);
+
+  for(int pc = 0; pc < K; pc += cfg.kc) {
+    int kc = MIN(cfg.kc, K - pc);
+    for(int ic = 0; ic < M; ic += cfg.mc) {
+      pack_a(is_trans(transA), SGEMM_F32, A, lda, ic, pc, MIN(cfg.mc, M - ic), kc, &pack->data[(size_t)pc*mPadded + (size_t)ic*kc]);
+    }
+  }
+
+  return pack;
+}
+
+sgemm_pack_t* sgemm_pack_b(char transB, int K, int N, const float* B, int ldb)
+{
+  if(!is_valid(transB) || K < 0 || N < 0 || !valid_ld(transB, K, N, ldb)) {
+    fprintf(stderr, "sgemm_pack_b: invalid arguments\n");
+    return NULL;
+  }
+
+  sgemm_config_t cfg = sgemm_get_config(sgemm_class(N, N, K));
+  sgemm_pack_t* pack = pack_alloc('B', K, N, &cfg, (size_t)K * ((N + NR - 1) / NR * NR));
+
+  for(int jc = 0; jc < N; jc += cfg.nc) {
+    int nc = MIN(cfg.nc, N - jc);
+    for(int pc = 0; pc < K; pc += cfg.kc) {
+      pack_b(is_trans(transB), SGEMM_F32, B, ldb, pc, jc, MIN(cfg.kc, K - pc), nc,
+             &pack->data[(size_t)K*jc + (size_t)pc * ((nc + NR - 1) / NR * NR)]);
+    }
+  }
+
+  return pack;
+}
+
+void sgemm_pack_free(sgemm_pack_t* pack)
+{
+  if(pack != NULL) {
+    free(pack->data);
+    free(pack);
+  }
+}
+
+void sgemm_packed(char transA, char transB, int M, int N, int K,
+                  float alpha, const float* A, int lda, const sgemm_pack_t* packedA,
+                  const float* B, int ldb, const sgemm_pack_t* packedB,
+                  float beta, float* C, int ldc)
+{
+  if((packedA && (packedA->side != 'A' || packedA->rows != M || packedA->cols != K))
+     || (packedB && (packedB->side != 'B' || packedB->rows != K || packedB->cols != N))
+     || (packedA && packedB && packedA->kc != packedB->kc)
+     || (!packedA && (!is_valid(transA) || !valid_ld(transA, M, K, lda)))
+     || (!packedB && (!is_valid(transB) || !valid_ld(transB, K, N, ldb)))
+     || M < 0 || N < 0 || K < 0 || ldc < MAX(M, 1)) {
+    fprintf(stderr, "sgemm_packed: invalid arguments\n");
+    return;
+  }
+
+  gemm_grid(is_trans(transA), is_trans(transB), M, N, K, alpha, SGEMM_F32, A, lda, packedA, SGEMM_F32, B, ldb, packedB, beta, C, ldc);
+}
@@ -0,0 +1,109 @@
+#ifndef SGEMM_H
+#define SGEMM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * BLAS-compatible single precision matrix multiply (column-major):
+ *
+ *   C = alpha * op(A) * op(B) + beta * C
+ *
+ * op(X) is X for trans 'N'/'n' and X^T for 'T'/'t' (or 'C'/'c').
+ * op(A) is M x K, op(B) is K x N and C is M x N; lda/ldb/ldc are the column
+ * strides of the buffers as stored, at least the height of the stored
+ * matrix (invalid arguments are reported and C is left alone). Transposes
+ * are absorbed while packing blocks of A and B, nothing is transposed in
+ * memory. C is caller-owned and is not read when beta == 0.
+ */
+void sgemm(char transA, char transB, int M, int N, int K,
+           float alpha, const float* A, int lda,
+           const float* B, int ldb,
+           float beta, float* C, int ldc);
+
+/**
+ * sgemm() for operands stored in reduced precision: IEEE half or bfloat16
+ * elements (lda/ldb still count elements) are widened to float while being
+ * packed, so the kernel and C stay fp32 and only half the operand bytes are
+ * read from memory.
+ */
+typedef enum { SGEMM_F32, SGEMM_F16, SGEMM_BF16 } sgemm_type_t;
+
+void sgemm_ex(char transA, char transB, int M, int N, int K,
+              float alpha, sgemm_type_t typeA, const void* A, int lda,
+              sgemm_type_t typeB, const void* B, int ldb,
+              float beta, float* C, int ldc);
+
+/**
+ * An operand packed once into the panel layout the kernel reads, for
+ * multiplying the same A or B many times: sgemm_packed() skips packing (and
+ * so any transpose) of whichever side is given packed.
+ */
+typedef struct {
+  char side;       // 'A' (op(A), M x K) or 'B' (op(B), K x N)
+  int rows, cols;  // of op(X)
+  int kc, nc;      // blocking it was packed with, which the multiply then follows
+  size_t bytes;
+  float* data;
+} sgemm_pack_t;
+
+sgemm_pack_t* sgemm_pack_a(char transA, int M, int K, const float* A, int lda);
+sgemm_pack_t* sgemm_pack_b(char transB, int K, int N, const float* B, int ldb);
+void sgemm_pack_free(sgemm_pack_t* pack);
+
+// sgemm() where a non-NULL packedA/packedB stands in for A/B (and its trans flag);
+// on the config's thread grid, all of it splitting rows of C when B is packed
+// and columns when A is, on one thread when both are
+void sgemm_packed(char transA, char transB, int M, int N, int K,
+                  float alpha, const float* A, int lda, const sgemm_pack_t* packedA,
+                  const float* B, int ldb, const sgemm_pack_t* packedB,
+                  float beta, float* C, int ldc);
+
+/**
+ * Blocking and threading, tuned per host (see autotune.c).
+ *
+ * The best block sizes depend on the cache sizes and the best thread grid on
+ * the core count, so they are looked up per size class of the product from a
+ * config file: $SGEMM_CONFIG, or ~/.sgemm.conf. Its lines are
+ *
+ *   <class> mc=<> kc=<> nc=<> kernel=<name> grid=<rows>x<cols> cpu=<model name>
+ *
+ * and only the ones for this host's /proc/cpuinfo model name are used, so one
+ * file can serve several CPU generations. It is read on the first multiply;
+ * classes it does not cover keep the built-in blocking.
+ */
+#define SGEMM_MR 16
+#define SGEMM_NR 6
+// kc is bounded so the packing can widen a run of k elements on the stack
+#define SGEMM_MAX_KC 1024
+
+typedef enum { SGEMM_SMALL, SGEMM_MEDIUM, SGEMM_LARGE, SGEMM_CLASSES } sgemm_class_t;
+
+typedef struct {
+  int mc, kc, nc;   // mc a multiple of SGEMM_MR, nc of SGEMM_NR, kc up to SGEMM_MAX_KC
+  int kernel;       // index into sgemm_kernel_names
+  int gridM, gridN; // threads splitting C: gridM blocks of rows by gridN blocks of columns
+} sgemm_config_t;
+
+extern const char* const sgemm_class_names[SGEMM_CLASSES];
+extern const char* const sgemm_kernel_names[];
+extern const int sgemm_kernels;
+
+// small / medium / large by the geometric mean of M, N and K
+sgemm_class_t sgemm_class(int M, int N, int K);
+sgemm_config_t sgemm_get_config(sgemm_class_t cls);
+// the hand picked blocking every class starts from, before any config file is applied
+sgemm_config_t sgemm_default_config(void);
+// false (and nothing changes) when cfg is not a valid config
+bool sgemm_set_config(sgemm_class_t cls, sgemm_config_t cfg);
+bool sgemm_valid_config(sgemm_config_t cfg);
+
+const char* sgemm_cpu_model(void);
+// $SGEMM_CONFIG or ~/.sgemm.conf, NULL when neither can be formed
+const char* sgemm_config_path(void);
+// applies the lines for this host, returns how many (-1 when path cannot be read)
+int sgemm_load_config(const char* path);
+// replaces this host's lines in path with configs (one per class), keeping other hosts'
+bool sgemm_save_config(const char* path, const sgemm_config_t configs[SGEMM_CLASSES]);
+
+#endif
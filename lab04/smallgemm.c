@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "smallgemm.h"
+
+// floats in one interleaved group of a batch
+#define GROUP(b) ((size_t)(b)->rows * (b)->cols * SMALL_LANES)
+
+__attribute__((no_instrument_function))
+mat_batch_t* mat_batch_alloc(int count, int rows, int cols)
+{
+  mat_batch_t* batch = malloc(sizeof(*batch));
+  batch->count = count;
+  batch->rows = rows;
+  batch->cols = cols;
+
+  int groups = (count + SMALL_LANES - 1) / SMALL_LANES;
+  size_t bytes = sizeof(float) * GROUP(batch) * groups;
+  bytes = (bytes + MAT_ALIGN - 1) / MAT_ALIGN * MAT_ALIGN;
+  batch->data = aligned_alloc(MAT_ALIGN, bytes > 0 ? bytes : MAT_ALIGN);
+  memset(batch->data, 0, bytes);
+
+  return batch;
+}
+
+__attribute__((no_instrument_function))
+void free_mat_batch(mat_batch_t* batch)
+{
+  if(batch != NULL) {
+    free(batch->data);
+    free(batch);
+  }
+}
+
+__attribute__((no_instrument_function))
+void mat_batch_set(mat_batch_t* batch, int i, mat_t* mat)
+{
+  float* group = &batch->data[GROUP(batch) * (i / SMALL_LANES) + i % SMALL_LANES];
+  for(int row = 0; row < batch->rows; row++) {
+    for(int col = 0; col < batch->cols; col++) group[((size_t)row*batch->cols + col) * SMALL_LANES] = MAT_AT(mat, row, col);
+  }
+}
+
+__attribute__((no_instrument_function))
+void mat_batch_get(mat_batch_t* batch, int i, mat_t* mat)
+{
+  float* group = &batch->data[GROUP(batch) * (i / SMALL_LANES) + i % SMALL_LANES];
+  for(int row = 0; row < batch->rows; row++) {
+    for(int col = 0; col < batch->cols; col++) MAT_AT(mat, row, col) = group[((size_t)row*batch->cols + col) * SMALL_LANES];
+  }
+}
+
+// ------------------------ kernels ------------------------
+
+// row i of C (1 x N) = row i of A (1 x K) * B (K x N), SMALL_LANES products side
+// by side. Columns go 8, then 4, then 1 at a time so each element of A loaded
+// feeds up to 8 independent FMA chains; with constant K and N it all unrolls.
+#define AT(X, r, c, ld) (&(X)[((r)*(ld) + (c)) * SMALL_LANES])
+
+__attribute__((no_instrument_function, always_inline))
+static inline void small_row(const float* A, const float* B, float* C, int i, int K, int N)
+{
+  int j = 0;
+
+  #pragma GCC unroll 4
+  for(; j + 8 <= N; j += 8) {
+    __m256 c[8];
+    #pragma GCC unroll 8
+    for(int u = 0; u < 8; u++) c[u] = _mm256_setzero_ps();
+    #pragma GCC unroll 32
+    for(int k = 0; k < K; k++) {
+      __m256 a = _mm256_load_ps(AT(A, i, k, K));
+      #pragma GCC unroll 8
+      for(int u = 0; u < 8; u++) c[u] = _mm256_fmadd_ps(a, _mm256_load_ps(AT(B, k, j + u, N)), c[u]);
+    }
+    #pragma GCC unroll 8
+    for(int u = 0; u < 8; u++) _mm256_store_ps(AT(C, i, j + u, N), c[u]);
+  }
+
+  for(; j + 4 <= N; j += 4) {
+    __m256 c[4];
+    #pragma GCC unroll 4
+    for(int u = 0; u < 4; u++) c[u] = _mm256_setzero_ps();
+    #pragma GCC unroll 32
+    for(int k = 0; k < K; k++) {
+      __m256 a = _mm256_load_ps(AT(A, i, k, K));
+      #pragma GCC unroll 4
+      for(int u = 0; u < 4; u++) c[u] = _mm256_fmadd_ps(a, _mm256_load_ps(AT(B, k, j + u, N)), c[u]);
+    }
+    #pragma GCC unroll 4
+    for(int u = 0; u < 4; u++) _mm256_store_ps(AT(C, i, j + u, N), c[u]);
+  }
+
+  for(; j < N; j++) {
+    __m256 c = _mm256_setzero_ps();
+    for(int k = 0; k < K; k++) c = _mm256_fmadd_ps(_mm256_load_ps(AT(A, i, k, K)), _mm256_load_ps(AT(B, k, j, N)), c);
+    _mm256_store_ps(AT(C, i, j, N), c);
+  }
+}
+
+// one group: C = A * B. Small matrices unroll over the rows too; past 8 rows
+// that only grows the kernel out of the instruction cache (32x32 reaches 340K).
+__attribute__((no_instrument_function, always_inline))
+static inline void small_group(const float* A, const float* B, float* C, int M, int K, int N)
+{
+  if(M <= 8) {
+    #pragma GCC unroll 8
+    for(int i = 0; i < M; i++) small_row(A, B, C, i, K, N);
+  }
+  else {
+    for(int i = 0; i < M; i++) small_row(A, B, C, i, K, N);
+  }
+}
+
+#undef AT
+
+typedef void (*small_kernel_t)(const float* A, const float* B, float* C, int groups);
+
+// a kernel with M, K and N fixed at compile time, over a run of groups
+#define SMALL_KERNEL(M, K, N) \
+  __attribute__((no_instrument_function)) \
+  static void kernel_##M##x##K##x##N(const float* A, const float* B, float* C, int groups) \
+  { \
+    for(int g = 0; g < groups; g++) { \
+      small_group(&A[(size_t)g*(M)*(K)*SMALL_LANES], &B[(size_t)g*(K)*(N)*SMALL_LANES], \
+                  &C[(size_t)g*(M)*(N)*SMALL_LANES], M, K, N); \
+    } \
+  }
+
+SMALL_KERNEL(2, 2, 2)
+SMALL_KERNEL(3, 3, 3)
+SMALL_KERNEL(4, 4, 4)
+SMALL_KERNEL(6, 6, 6)
+SMALL_KERNEL(8, 8, 8)
+SMALL_KERNEL(12, 12, 12)
+SMALL_KERNEL(16, 16, 16)
+SMALL_KERNEL(24, 24, 24)
+SMALL_KERNEL(32, 32, 32)
+
+static const struct {
+  int M, K, N;
+  small_kernel_t kernel;
+} kernels[] = {
+  { 2, 2, 2, kernel_2x2x2 },
+  { 3, 3, 3, kernel_3x3x3 },
+  { 4, 4, 4, kernel_4x4x4 },
+  { 6, 6, 6, kernel_6x6x6 },
+  { 8, 8, 8, kernel_8x8x8 },
+  { 12, 12, 12, kernel_12x12x12 },
+  { 16, 16, 16, kernel_16x16x16 },
+  { 24, 24, 24, kernel_24x24x24 },
+  { 32, 32, 32, kernel_32x32x32 },
+};
+
+// ------------------------ multiply ------------------------
+
+void mat_batch_mul(mat_batch_t* A, mat_batch_t* B, mat_batch_t* C)
+{
+  if(A->cols != B->rows || A->count != B->count || C->rows != A->rows || C->cols != B->cols || C->count != A->count) {
+    fprintf(stderr, "Invalid batch multiplication of %d x %dx%d * %d x %dx%d into %d x %dx%d\n",
+            A->count, A->rows, A->cols, B->count, B->rows, B->cols, C->count, C->rows, C->cols);
+    exit(1);
+  }
+
+  int M = A->rows, K = A->cols, N = B->cols;
+  int groups = (A->count + SMALL_LANES - 1) / SMALL_LANES;
+
+  for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    if(kernels[i].M == M && kernels[i].K == K && kernels[i].N == N) {
+      kernels[i].kernel(A->data, B->data, C->data, groups);
+      return;
+    }
+  }
+
+  for(int g = 0; g < groups; g++) {
+    small_group(&A->data[g * GROUP(A)], &B->data[g * GROUP(B)], &C->data[g * GROUP(C)], M, K, N);
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef SMALLGEMM_H
+#define SMALLGEMM_H
+
+#include "mat.h"
+
+/**
+ * Batched multiplies of many small matrices (up to about 32x32).
+ *
+ * At these sizes mat_mul spends its time on the malloc, the packing and the
+ * loop setup, not on the FMAs, and a single product is too narrow to keep 8
+ * lanes busy. A batch instead stores its matrices interleaved: matrices are
+ * taken SMALL_LANES at a time, and element (row, col) of those SMALL_LANES
+ * matrices sits in one vector,
+ *   data[((group*rows + row)*cols + col)*SMALL_LANES + lane]
+ * for matrix group*SMALL_LANES + lane. Each FMA then does one multiply-add
+ * for each of SMALL_LANES independent products, whatever the matrix size.
+ *
+ * The common square sizes get kernels fully unrolled at compile time (see
+ * SMALL_KERNEL in smallgemm.c); every other shape runs the same loops with
+ * run-time bounds.
+ */
+
+#define SMALL_LANES 8
+
+typedef struct {
+  int count;      // matrices in the batch
+  int rows, cols; // of each matrix
+  float* data;    // count rounded up to SMALL_LANES matrices, interleaved, unused lanes zero
+} mat_batch_t;
+
+mat_batch_t* mat_batch_alloc(int count, int rows, int cols);
+void free_mat_batch(mat_batch_t* batch);
+// copy matrix i of the batch in from (out to) mat, which must have the batch's shape
+void mat_batch_set(mat_batch_t* batch, int i, mat_t* mat);
+void mat_batch_get(mat_batch_t* batch, int i, mat_t* mat);
+
+// C[i] = A[i] * B[i] for every i; C must already have the product's shape and count
+void mat_batch_mul(mat_batch_t* A, mat_batch_t* B, mat_batch_t* C);
+
+#endif
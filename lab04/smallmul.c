@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "mat.h"
+#include "smallgemm.h"
+
+/**
+ * Outline:
+ * 1. parse argv:
+ *  1. <?--count=n> <M> <K> <N>
+ * 2. fill n random M x K and K x N matrix pairs (small integers, so every
+ *    product is exact)
+ * 3. multiply them one at a time with mat_mul, then all at once with
+ *    mat_batch_mul, timing both
+ * 4. print both rates and whether the two sets of products agree
+ * 5. cleanup memory
+ */
+
+#define SMALL_COUNT 100000
+
+typedef struct {
+  int count;
+  int M, K, N;
+  mat_t **matA, **matB;
+} info_t;
+
+info_t* parse_args(int argc, char* argv[]);
+void free_info(info_t* info);
+
+__attribute__((no_instrument_function))
+static double seconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// ------------------------ main ------------------------
+__attribute__ ((no_instrument_function))
+int main(int argc, char* argv[]) {
+  info_t* info = parse_args(argc, argv);
+
+  mat_t** single = malloc(sizeof(*single) * info->count);
+  double start = seconds();
+  for(int i = 0; i < info->count; i++) single[i] = mat_mul(info->matA[i], info->matB[i], true);
+  double singleSecs = seconds() - start;
+
+  mat_batch_t* A = mat_batch_alloc(info->count, info->M, info->K);
+  mat_batch_t* B = mat_batch_alloc(info->count, info->K, info->N);
+  mat_batch_t* C = mat_batch_alloc(info->count, info->M, info->N);
+  for(int i = 0; i < info->count; i++) {
+    mat_batch_set(A, i, info->matA[i]);
+    mat_batch_set(B, i, info->matB[i]);
+  }
+
+  start = seconds();
+  mat_batch_mul(A, B, C);
+  double batchSecs = seconds() - start;
+
+  bool passed = true;
+  mat_t* product = mat_alloc(info->M, info->N, true);
+  for(int i = 0; i < info->count; i++) {
+    mat_batch_get(C, i, product);
+    passed = passed && mat_equal(single[i], product);
+    free_mat(single[i], true);
+  }
+
+  printf("mat_mul: %.0f products/s, batch: %.0f products/s (%.1fx)\n",
+         info->count / singleSecs, info->count / batchSecs, singleSecs / batchSecs);
+  printf(passed ? "passed\n" : "failed\n");
+
+  free_mat(product, true);
+  free(single);
+  free_mat_batch(A);
+  free_mat_batch(B);
+  free_mat_batch(C);
+  free_info(info);
+}
+
+// ------------------------ main ------------------------
+
+__attribute__((no_instrument_function))
+static mat_t* random_mat(int rows, int cols)
+{
+  mat_t* mat = mat_alloc(rows, cols, true);
+  for(int row = 0; row < rows; row++) {
+    for(int col = 0; col < cols; col++) MAT_AT(mat, row, col) = rand() % 19 - 9;
+  }
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+info_t* parse_args(int argc, char* argv[])
+{
+  info_t* info = calloc(1, sizeof(*info));
+  info->count = SMALL_COUNT;
+
+  int arg = 1;
+  if(arg < argc && strncmp(argv[arg], "--count=", 8) == 0) info->count = atoi(argv[arg++] + 8);
+
+  if(argc - arg != 3 || info->count <= 0) {
+    printf("usage: %s <?--count=products, default=%d> <rows of A> <cols of A> <cols of B>\n", argv[0], SMALL_COUNT);
+    free(info);
+    exit(0);
+  }
+
+  info->M = atoi(argv[arg]);
+  info->K = atoi(argv[arg + 1]);
+  info->N = atoi(argv[arg + 2]);
+  if(info->M <= 0 || info->K <= 0 || info->N <= 0) {
+    fprintf(stderr, "Invalid matrix sizes %s %s %s\n", argv[arg], argv[arg + 1], argv[arg + 2]);
+    exit(1);
+  }
+
+  srand(39);
+  info->matA = malloc(sizeof(*info->matA) * info->count);
+  info->matB = malloc(sizeof(*info->matB) * info->count);
+  for(int i = 0; i < info->count; i++) {
+    info->matA[i] = random_mat(info->M, info->K);
+    info->matB[i] = random_mat(info->K, info->N);
+  }
+
+  return info;
+}
+
+__attribute__((no_instrument_function))
+void free_info(info_t* info)
+{
+  for(int i = 0; i < info->count; i++) {
+    free_mat(info->matA[i], true);
+    free_mat(info->matB[i], true);
+  }
+  free(info->matA);
+  free(info->matB);
+  free(info);
+}
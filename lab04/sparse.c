@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "sparse.h"
+#include "transpose.h"
+
+#define SPARSE_MAX_THREADS 16
+// nonzeros of A below which another thread costs more than it saves
+#define SPARSE_MIN_WORK (64*1024)
+
+// ------------------------ conversion ------------------------
+
+// a counting sort over the dense vectors, so either target form is one
+// contiguous pass over mat no matter which form mat is in
+__attribute__((no_instrument_function))
+sparse_t* sparse_from_dense(mat_t* mat, bool isRowForm)
+{
+  int outer = (mat->isRowForm ? mat->rows:mat->cols);
+  int inner = (mat->isRowForm ? mat->cols:mat->rows);
+  bool same = (mat->isRowForm == isRowForm);
+
+  sparse_t* sp = malloc(sizeof(*sp));
+  sp->isRowForm = isRowForm;
+  sp->rows = mat->rows;
+  sp->cols = mat->cols;
+
+  int spOuter = (same ? outer : inner);
+  sp->ptr = calloc(spOuter + 1, sizeof(size_t));
+
+  for(int o = 0; o < outer; o++) {
+    const float* vec = MAT_VEC(mat, o);
+    if(same) {
+      size_t count = 0;
+      for(int i = 0; i < inner; i++) count += (vec[i] != 0.0f);
+      sp->ptr[o + 1] = count;
+    }
+    else {
+      for(int i = 0; i < inner; i++) sp->ptr[i + 1] += (vec[i] != 0.0f);
+    }
+  }
+  for(int o = 0; o < spOuter; o++) sp->ptr[o + 1] += sp->ptr[o];
+
+  sp->nnz = sp->ptr[spOuter];
+  sp->idx = malloc(sizeof(int) * (sp->nnz > 0 ? sp->nnz : 1));
+  sp->vals = malloc(sizeof(float) * (sp->nnz > 0 ? sp->nnz : 1));
+
+  // next free slot per sparse vector; walking o upwards keeps every vector's indices sorted
+  size_t* next = malloc(sizeof(size_t) * (spOuter > 0 ? spOuter : 1));
+  memcpy(next, sp->ptr, sizeof(size_t) * spOuter);
+
+  for(int o = 0; o < outer; o++) {
+    const float* vec = MAT_VEC(mat, o);
+    for(int i = 0; i < inner; i++) {
+      if(vec[i] == 0.0f) continue;
+      size_t at = next[same ? o : i]++;
+      sp->idx[at] = (same ? i : o);
+      sp->vals[at] = vec[i];
+    }
+  }
+
+  free(next);
+  return sp;
+}
+
+__attribute__((no_instrument_function))
+mat_t* sparse_to_dense(sparse_t* sp, bool isRowForm)
+{
+  mat_t* mat = mat_alloc(sp->rows, sp->cols, isRowForm);
+  int outer = (sp->isRowForm ? sp->rows:sp->cols);
+
+  for(int o = 0; o < outer; o++) {
+    for(size_t p = sp->ptr[o]; p < sp->ptr[o + 1]; p++) {
+      if(sp->isRowForm) MAT_AT(mat, o, sp->idx[p]) = sp->vals[p];
+      else MAT_AT(mat, sp->idx[p], o) = sp->vals[p];
+    }
+  }
+  mat->nnz = sp->nnz;
+
+  return mat;
+}
+
+__attribute__((no_instrument_function))
+void free_sparse(sparse_t* sp)
+{
+  if(sp != NULL) {
+    free(sp->ptr);
+    free(sp->idx);
+    free(sp->vals);
+    free(sp);
+  }
+}
+
+// ------------------------ threading ------------------------
+
+typedef struct {
+  sparse_t *A, *B; // B unused by spmm
+  mat_t *denseB, *C;
+  int start, stop; // rows of A
+} task_t;
+
+// bounds[0..n] over A's rows with about nnz/n nonzeros each, returns n
+__attribute__((no_instrument_function))
+static int split_rows(sparse_t* A, int* bounds)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = A->nnz / SPARSE_MIN_WORK + 1;
+  if(n > cpus) n = cpus;
+  if(n > SPARSE_MAX_THREADS) n = SPARSE_MAX_THREADS;
+  if(n < 1) n = 1;
+
+  bounds[0] = 0;
+  for(int t = 1; t < n; t++) {
+    // first row whose nonzeros start at or past t/n of the total
+    size_t target = A->nnz / n * t;
+    int lo = bounds[t-1], hi = A->rows;
+    while(lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      if(A->ptr[mid] < target) lo = mid + 1;
+      else hi = mid;
+    }
+    bounds[t] = lo;
+  }
+  bounds[n] = A->rows;
+
+  return n;
+}
+
+__attribute__((no_instrument_function))
+static void run_tasks(void* (*fn)(void*), task_t* tasks, int n)
+{
+  pthread_t threads[SPARSE_MAX_THREADS];
+  for(int t = 1; t < n; t++) pthread_create(&threads[t], NULL, fn, &tasks[t]);
+  fn(&tasks[0]);
+  for(int t = 1; t < n; t++) pthread_join(threads[t], NULL);
+}
+
+// ------------------------ spmm ------------------------
+
+__attribute__((no_instrument_function))
+static void* spmm_rows(void* arg)
+{
+  task_t* task = arg;
+  sparse_t* A = task->A;
+  mat_t *B = task->denseB, *C = task->C;
+
+  // ld is a multiple of 16 and the padding is zero, so whole vectors of 8 are safe
+  int width = (C->cols + 7) / 8 * 8;
+
+  for(int row = task->start; row < task->stop; row++) {
+    float* c = MAT_VEC(C, row);
+    memset(c, 0, sizeof(float) * width);
+
+    for(size_t p = A->ptr[row]; p < A->ptr[row + 1]; p++) {
+      __m256 a = _mm256_set1_ps(A->vals[p]);
+      const float* b = MAT_VEC(B, A->idx[p]);
+      for(int col = 0; col < width; col += 8) {
+        _mm256_store_ps(&c[col], _mm256_fmadd_ps(a, _mm256_load_ps(&b[col]), _mm256_load_ps(&c[col])));
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void spmm(sparse_t* A, mat_t* B, mat_t* C)
+{
+  int bounds[SPARSE_MAX_THREADS + 1];
+  int n = split_rows(A, bounds);
+
+  task_t tasks[SPARSE_MAX_THREADS];
+  for(int t = 0; t < n; t++) tasks[t] = (task_t){ .A = A, .denseB = B, .C = C, .start = bounds[t], .stop = bounds[t+1] };
+  run_tasks(spmm_rows, tasks, n);
+}
+
+// ------------------------ spgemm ------------------------
+
+// Gustavson, straight into a dense C: row i of C is the sum of B's rows
+// picked out by row i of A, so no counting or sorting of C's columns
+__attribute__((no_instrument_function))
+static void* spgemm_dense_rows(void* arg)
+{
+  task_t* task = arg;
+  sparse_t *A = task->A, *B = task->B;
+  mat_t* C = task->C;
+
+  for(int row = task->start; row < task->stop; row++) {
+    float* c = MAT_VEC(C, row);
+    memset(c, 0, sizeof(float) * C->cols);
+
+    for(size_t p = A->ptr[row]; p < A->ptr[row + 1]; p++) {
+      int k = A->idx[p];
+      float a = A->vals[p];
+      for(size_t q = B->ptr[k]; q < B->ptr[k + 1]; q++) c[B->idx[q]] += a * B->vals[q];
+    }
+  }
+
+  return NULL;
+}
+
+// ------------------------ dispatch ------------------------
+
+void sparse_mul_into(mat_t* A, mat_t* B, mat_t* C)
+{
+  // both kernels produce rows of C, a column form C gets them transposed in at the end
+  mat_t* R = (C->isRowForm ? C : mat_alloc(C->rows, C->cols, true));
+  sparse_t* sa = sparse_from_dense(A, true);
+
+  if(mat_density(B) <= SPARSE_DENSITY) {
+    sparse_t* sb = sparse_from_dense(B, true);
+
+    int bounds[SPARSE_MAX_THREADS + 1];
+    int n = split_rows(sa, bounds);
+    task_t tasks[SPARSE_MAX_THREADS];
+    for(int t = 0; t < n; t++) tasks[t] = (task_t){ .A = sa, .B = sb, .C = R, .start = bounds[t], .stop = bounds[t+1] };
+    run_tasks(spgemm_dense_rows, tasks, n);
+
+    free_sparse(sb);
+  }
+  else {
+    // spmm streams whole rows of B
+    mat_t* rowB = B;
+    if(!B->isRowForm) {
+      rowB = mat_alloc(B->rows, B->cols, true);
+      transpose(B->data, B->ld, rowB->data, rowB->ld, B->cols, B->rows);
+    }
+
+    spmm(sa, rowB, R);
+
+    if(rowB != B) free_mat(rowB, true);
+  }
+
+  free_sparse(sa);
+
+  if(R != C) {
+    transpose(R->data, R->ld, C->data, C->ld, R->rows, R->cols);
+    free_mat(R, true);
+  }
+}
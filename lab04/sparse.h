@@ -0,0 +1,48 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mat.h"
+
+/**
+ * Compressed sparse matrices for inputs that are mostly zeros.
+ *
+ * Same isRowForm convention as mat_t: in row form (CSR) the nonzeros of row
+ * i are idx/vals[ptr[i] .. ptr[i+1]) with idx holding their columns; in
+ * column form (CSC) it is the same for column i with idx holding rows.
+ * Indices within a row (column) are ascending.
+ *
+ * mat_mul_into() hands a product to sparse_mul_into() when either operand is
+ * at most SPARSE_DENSITY nonzero (the text loader counts nonzeros while
+ * parsing, see mat_density), so the programs keep reading and printing dense
+ * text matrices as before:
+ *  - sparse A, dense B:  spmm, one axpy of a row of B per nonzero of A
+ *  - any A, sparse B:    Gustavson's row by row sum, straight into the dense C
+ * Rows are split across threads in ranges of about equal nonzeros.
+ */
+
+// at most this fraction nonzero counts as sparse
+#define SPARSE_DENSITY 0.1
+
+typedef struct {
+  bool isRowForm;
+  int rows, cols;
+  size_t nnz;
+  size_t* ptr; // outer + 1 offsets into idx/vals
+  int* idx;
+  float* vals;
+} sparse_t;
+
+sparse_t* sparse_from_dense(mat_t* mat, bool isRowForm);
+mat_t* sparse_to_dense(sparse_t* sp, bool isRowForm);
+void free_sparse(sparse_t* sp);
+
+// C = A * B with A in row form and B/C row form dense (C already sized, ld padding zero)
+void spmm(sparse_t* A, mat_t* B, mat_t* C);
+
+// dense in, dense out, through whichever of the above fits
+void sparse_mul_into(mat_t* A, mat_t* B, mat_t* C);
+
+#endif
@@ -4,11 +4,17 @@
 #include <string.h>
 #include <time.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <immintrin.h>
+
+#include "matlayout.h"
+#include "transpose.h"
+#include "fastout.h"
 
 /**
  * Outline:
  * 1. parse argv:
- *  1. <path mat1> <path mat2> <?path debug mat>
+ *  1. <?--verify [--rounds=k]> <path mat1> <path mat2> <?path debug mat>
  * 2. parse file:
  *  1. format:
  *    rows cols
@@ -19,25 +25,30 @@
  * 4. cleanup memory
  */
 
+// mat.h's layout (matlayout.h) with int32 elements, which the integer kernels need
 typedef struct {
   bool isRowForm;
   int rows, cols;
-  int32_t** data;
+  int ld;
+  int32_t* data;
 } mat_t;
 
 typedef struct {
   // using pointers so memory is not copied between function calls -> only the pointer value is
   mat_t *matA, *matB; // required
   mat_t *debug; // optional
+  int verifyRounds; // > 0: Freivalds check instead of a debug matrix
 } info_t;
 
 info_t* parse_args(int argc, char* argv[]);
 void free_info(info_t* info);
+mat_t* mat_alloc(int rows, int cols, bool isRowForm);
 void free_mat(mat_t* mat, bool freePtr);
-mat_t* read_file(char* path);
+mat_t* read_file(char* path, bool isRowForm);
 mat_t* mul(mat_t* A, mat_t* B);
 void mat_print(mat_t* mat);
 bool debug(info_t* info, mat_t* C);
+bool verify(mat_t* A, mat_t* B, mat_t* C, int rounds);
 
 // ------------------------ main ------------------------
 __attribute__ ((no_instrument_function))
@@ -46,7 +57,9 @@ int main(int argc, char* argv[]) {
   
   mat_t* C = mul(info->matA, info->matB);
 
-  if(info->debug != NULL) {
+  if(info->verifyRounds > 0) {
+    printf( verify(info->matA, info->matB, C, info->verifyRounds) ? "passed\n" : "failed\n" );
+  } else if(info->debug != NULL) {
     printf( debug(info, C) ? "passed\n" : "failed\n" );
   } else {
     mat_print(C);
@@ -62,15 +75,25 @@ int main(int argc, char* argv[]) {
 __attribute__((no_instrument_function))
 info_t* parse_args(int argc, char* argv[]) 
 {
+  // pull the verify options out, keep the positional arguments in order
+  int verifyRounds = 0, rounds = 16, kept = 1;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--verify") == 0) verifyRounds = 1;
+    else if(strncmp(argv[i], "--rounds=", 9) == 0) rounds = atoi(argv[i] + 9);
+    else argv[kept++] = argv[i];
+  }
+  argc = kept;
+
   if(argc != 3 && argc != 4) {
-    printf("usage: %s <path to matrix 1> <path to matrix 2> <?path to debug matrix>\n", argv[0]);
+    printf("usage: %s <?--verify [--rounds=k]> <path to matrix 1> <path to matrix 2> <?path to debug matrix>\n", argv[0]);
     exit(0);
   }
 
   info_t* info = malloc(sizeof(*info));
+  info->verifyRounds = (verifyRounds && rounds > 0 ? rounds : 0);
 
   mat_t* mat;
-  if( (mat = read_file(argv[1])) == NULL) {
+  if( (mat = read_file(argv[1], true)) == NULL) {
     free_info(info);
     exit(0);
   }
@@ -78,7 +101,7 @@ info_t* parse_args(int argc, char* argv[])
 
   info->matA = mat;
   
-  if( (mat = read_file(argv[2])) == NULL) {
+  if( (mat = read_file(argv[2], false)) == NULL) {
     free_info(info);
     exit(0);
   }
@@ -86,7 +109,7 @@ info_t* parse_args(int argc, char* argv[])
   info->matB = mat;
 
   if(argc == 4) {
-    if( (mat = read_file(argv[3])) == NULL) {
+    if( (mat = read_file(argv[3], true)) == NULL) {
       free_info(info);
       exit(0);
     }
@@ -106,28 +129,37 @@ void free_info(info_t* info)
   free(info);
 }
 
+__attribute__((no_instrument_function))
+mat_t* mat_alloc(int rows, int cols, bool isRowForm)
+{
+  mat_t* mat = malloc(sizeof(*mat));
+  mat->isRowForm = isRowForm;
+  mat->rows = rows;
+  mat->cols = cols;
+
+  int inner = (isRowForm ? cols:rows);
+  int outer = (isRowForm ? rows:cols);
+  int perLine = MAT_ALIGN / sizeof(int32_t);
+  mat->ld = (inner + perLine - 1) / perLine * perLine;
+
+  size_t bytes = sizeof(int32_t) * (size_t)mat->ld * outer;
+  mat->data = aligned_alloc(MAT_ALIGN, bytes > 0 ? bytes : MAT_ALIGN);
+  memset(mat->data, 0, bytes);
+
+  return mat;
+}
+
   __attribute__((no_instrument_function))
 void free_mat(mat_t* mat, bool freePtr)
 {
   if(mat != NULL) {
-    // loop over it efficiently
-    if(mat->isRowForm) {
-      for(int row = 0; row < mat->rows; row++) {
-        free(mat->data[row]);
-      }
-    }
-    else {
-      for(int col = 0; col < mat->cols; col++) {
-        free(mat->data[col]);
-      }
-    }
     free(mat->data);
     if(freePtr) free(mat);
   }
 }
 
 __attribute__((no_instrument_function))
-mat_t* read_file(char* path)
+mat_t* read_file(char* path, bool isRowForm)
 {
   FILE* file = fopen(path, "r");
   if(!file) {
@@ -135,31 +167,17 @@ mat_t* read_file(char* path)
     exit(1);
   }
   
-  mat_t* mat = malloc(sizeof(*mat));
-  
-  fscanf(file, "%d %d", &mat->rows, &mat->cols);
-  
-  // change this
-  mat->isRowForm = true;
-
-  if(mat->isRowForm) {
-    mat->data = malloc(sizeof(int32_t*)*mat->rows);
-    for(int row = 0; row < mat->rows; row++) {
-      mat->data[row] = malloc(sizeof(int32_t)*mat->cols); 
-      for(int col = 0; col < mat->cols; col++) {
-        fscanf(file, "%d", &mat->data[row][col]); 
-      } 
-    }
-  }
-  else {
-    mat->data = malloc(sizeof(int32_t*)*mat->cols);
+  int rows, cols;
+  fscanf(file, "%d %d", &rows, &cols);
+
+  mat_t* mat = mat_alloc(rows, cols, isRowForm);
+
+  // the file is always row by row, column form just stores it strided
+  for(int row = 0; row < mat->rows; row++) {
     for(int col = 0; col < mat->cols; col++) {
-      mat->data[col] = malloc(sizeof(int32_t)*mat->rows); 
-      for(int row = 0; row < mat->rows; row++) { 
-        fscanf(file, "%d", &mat->data[col][row]); 
-      }
+      fscanf(file, "%d", &MAT_AT(mat, row, col)); 
     }
-  } 
+  }
 
   fclose(file);
 
@@ -171,54 +189,249 @@ mat_t* read_file(char* path)
 __attribute__((no_instrument_function))
 void swap_row_col_form(mat_t* mat) 
 {
-  mat->isRowForm = !mat->isRowForm;
-  int N = (mat->isRowForm ? mat->rows:mat->cols); 
-  int M = (mat->isRowForm ? mat->cols:mat->rows); 
- 
-  int** tmp= malloc(sizeof(int32_t*)*N);
-
-  for(int i = 0; i < N; i++) {
-    tmp[i] = malloc(sizeof(int32_t)*M);
-    for(int j = 0; j < M; j++) {
-      tmp[i][j] = mat->data[j][i];
-    }
+  // n x n: transposed in place, as in mat.c
+  if(mat->rows == mat->cols) {
+    transpose_inplace(mat->data, mat->ld, mat->rows);
+    mat->isRowForm = !mat->isRowForm;
+    return;
   }
-  
+
+  mat_t* tmp = mat_alloc(mat->rows, mat->cols, !mat->isRowForm);
+
+  int outer = (mat->isRowForm ? mat->rows:mat->cols);
+  int inner = (mat->isRowForm ? mat->cols:mat->rows);
+  transpose(mat->data, mat->ld, tmp->data, tmp->ld, outer, inner);
+
   free_mat(mat, false);
+  *mat = *tmp;
+  free(tmp);
+}
 
-  mat->data = tmp;
+// ---------------- integer SIMD kernels ---------------
+// operands are packed into contiguous vectors of K values (rows of A, cols of B),
+// K padded with zeros to a multiple of 32 so every kernel runs whole registers.
+// the narrowest element width that cannot overflow is picked per multiply.
+typedef enum { WIDTH_INT8, WIDTH_INT16, WIDTH_INT32 } width_t;
+
+typedef struct {
+  int32_t min, max;
+} range_t;
+
+#define KPAD(k) (((k) + 31) & ~31)
+
+__attribute__((no_instrument_function))
+range_t mat_range(mat_t* mat)
+{
+  range_t r = { INT32_MAX, INT32_MIN };
+
+  for(int row = 0; row < mat->rows; row++) {
+    for(int col = 0; col < mat->cols; col++) {
+      if(MAT_AT(mat, row, col) < r.min) r.min = MAT_AT(mat, row, col);
+      if(MAT_AT(mat, row, col) > r.max) r.max = MAT_AT(mat, row, col);
+    }
+  }
+
+  return r;
 }
 
+__attribute__((no_instrument_function))
+static bool fits(range_t r, int32_t lo, int32_t hi) { return r.min >= lo && r.max <= hi; }
+
+__attribute__((no_instrument_function))
+static int64_t magnitude(range_t r) { return llabs((int64_t)r.min) > llabs((int64_t)r.max) ? llabs((int64_t)r.min) : llabs((int64_t)r.max); }
+
+// int8 kernels multiply unsigned bytes by signed bytes, *aUnsigned says which side is which
+__attribute__((no_instrument_function))
+width_t choose_width(range_t a, range_t b, int K, bool vnni, bool* aUnsigned)
+{
+  int64_t prod = magnitude(a) * magnitude(b);
+  // every int32 lane holds a partial sum of at most K products
+  if(prod * (int64_t)K > INT32_MAX) return WIDTH_INT32;
+
+  *aUnsigned = fits(a, 0, UINT8_MAX) && fits(b, INT8_MIN, INT8_MAX);
+  bool bUnsigned = fits(b, 0, UINT8_MAX) && fits(a, INT8_MIN, INT8_MAX);
+  // without vnni vpmaddubsw saturates each pair of products to int16
+  if((*aUnsigned || bUnsigned) && (vnni || 2*prod <= INT16_MAX)) return WIDTH_INT8;
+
+  // vpmaddwd only overflows on (-32768)^2 + (-32768)^2
+  if(fits(a, -INT16_MAX, INT16_MAX) && fits(b, -INT16_MAX, INT16_MAX)) return WIDTH_INT16;
+
+  return WIDTH_INT32;
+}
+
+// copy the contiguous vectors of mat into a zero padded, 32-byte aligned buffer of the given width
+__attribute__((no_instrument_function))
+void* pack(mat_t* mat, width_t width)
+{
+  int n = (mat->isRowForm ? mat->rows:mat->cols);
+  int k = (mat->isRowForm ? mat->cols:mat->rows);
+  size_t size = (width == WIDTH_INT8 ? 1 : width == WIDTH_INT16 ? 2 : 4);
+  size_t ld = KPAD(k);
+  // round n up to the 4 vectors the kernels consume at once
+  size_t nPad = (n + 3) & ~3;
+  void* buf = aligned_alloc(32, size*ld*nPad);
+  memset(buf, 0, size*ld*nPad);
+
+  for(int v = 0; v < n; v++) {
+    for(int i = 0; i < k; i++) {
+      if(width == WIDTH_INT8) ((int8_t*)buf)[v*ld + i] = (int8_t)MAT_VEC(mat, v)[i];
+      else if(width == WIDTH_INT16) ((int16_t*)buf)[v*ld + i] = (int16_t)MAT_VEC(mat, v)[i];
+      else ((int32_t*)buf)[v*ld + i] = MAT_VEC(mat, v)[i];
+    }
+  }
+
+  return buf;
+}
+
+__attribute__((no_instrument_function))
+static inline int32_t hsum_epi32(__m256i v)
+{
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_hadd_epi32(s, s);
+  s = _mm_hadd_epi32(s, s);
+  return _mm_cvtsi128_si32(s);
+}
+
+// out[j] = x . y[j] for the 4 consecutive packed vectors starting at y
+typedef void (*dot4_t)(const void* x, const void* y, size_t ld, int kpad, int32_t out[4]);
+
+__attribute__((no_instrument_function))
+void dot4_int32(const void* x, const void* y, size_t ld, int kpad, int32_t out[4])
+{
+  const int32_t* a = x;
+  const int32_t* b = y;
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+
+  for(int k = 0; k < kpad; k += 8) {
+    __m256i va = _mm256_load_si256((const __m256i*)&a[k]);
+    acc0 = _mm256_add_epi32(acc0, _mm256_mullo_epi32(va, _mm256_load_si256((const __m256i*)&b[0*ld + k])));
+    acc1 = _mm256_add_epi32(acc1, _mm256_mullo_epi32(va, _mm256_load_si256((const __m256i*)&b[1*ld + k])));
+    acc2 = _mm256_add_epi32(acc2, _mm256_mullo_epi32(va, _mm256_load_si256((const __m256i*)&b[2*ld + k])));
+    acc3 = _mm256_add_epi32(acc3, _mm256_mullo_epi32(va, _mm256_load_si256((const __m256i*)&b[3*ld + k])));
+  }
+
+  out[0] = hsum_epi32(acc0); out[1] = hsum_epi32(acc1);
+  out[2] = hsum_epi32(acc2); out[3] = hsum_epi32(acc3);
+}
+
+__attribute__((no_instrument_function))
+void dot4_int16(const void* x, const void* y, size_t ld, int kpad, int32_t out[4])
+{
+  const int16_t* a = x;
+  const int16_t* b = y;
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+
+  // vpmaddwd: 16 products summed pairwise into 8 int32 lanes
+  for(int k = 0; k < kpad; k += 16) {
+    __m256i va = _mm256_load_si256((const __m256i*)&a[k]);
+    acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(va, _mm256_load_si256((const __m256i*)&b[0*ld + k])));
+    acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(va, _mm256_load_si256((const __m256i*)&b[1*ld + k])));
+    acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(va, _mm256_load_si256((const __m256i*)&b[2*ld + k])));
+    acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(va, _mm256_load_si256((const __m256i*)&b[3*ld + k])));
+  }
+
+  out[0] = hsum_epi32(acc0); out[1] = hsum_epi32(acc1);
+  out[2] = hsum_epi32(acc2); out[3] = hsum_epi32(acc3);
+}
+
+// x holds the unsigned bytes, y the signed ones
+__attribute__((no_instrument_function))
+void dot4_int8(const void* x, const void* y, size_t ld, int kpad, int32_t out[4])
+{
+  const int8_t* a = x;
+  const int8_t* b = y;
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+
+  // vpmaddubsw into int16 pairs, then vpmaddwd against 1 to widen into int32
+  for(int k = 0; k < kpad; k += 32) {
+    __m256i va = _mm256_load_si256((const __m256i*)&a[k]);
+    acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_maddubs_epi16(va, _mm256_load_si256((const __m256i*)&b[0*ld + k])), ones));
+    acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_maddubs_epi16(va, _mm256_load_si256((const __m256i*)&b[1*ld + k])), ones));
+    acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_maddubs_epi16(va, _mm256_load_si256((const __m256i*)&b[2*ld + k])), ones));
+    acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_maddubs_epi16(va, _mm256_load_si256((const __m256i*)&b[3*ld + k])), ones));
+  }
+
+  out[0] = hsum_epi32(acc0); out[1] = hsum_epi32(acc1);
+  out[2] = hsum_epi32(acc2); out[3] = hsum_epi32(acc3);
+}
+
+// avx-vnni vpdpbusd: 4 u8*s8 products per int32 lane without the int16 saturation step
+__attribute__((no_instrument_function, target("avxvnni")))
+void dot4_int8_vnni(const void* x, const void* y, size_t ld, int kpad, int32_t out[4])
+{
+  const int8_t* a = x;
+  const int8_t* b = y;
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+
+  for(int k = 0; k < kpad; k += 32) {
+    __m256i va = _mm256_load_si256((const __m256i*)&a[k]);
+    acc0 = _mm256_dpbusd_avx_epi32(acc0, va, _mm256_load_si256((const __m256i*)&b[0*ld + k]));
+    acc1 = _mm256_dpbusd_avx_epi32(acc1, va, _mm256_load_si256((const __m256i*)&b[1*ld + k]));
+    acc2 = _mm256_dpbusd_avx_epi32(acc2, va, _mm256_load_si256((const __m256i*)&b[2*ld + k]));
+    acc3 = _mm256_dpbusd_avx_epi32(acc3, va, _mm256_load_si256((const __m256i*)&b[3*ld + k]));
+  }
+
+  out[0] = hsum_epi32(acc0); out[1] = hsum_epi32(acc1);
+  out[2] = hsum_epi32(acc2); out[3] = hsum_epi32(acc3);
+}
+
+// -----------------------------------------------------
+
 mat_t* mul(mat_t* A, mat_t* B)
 {
   if(!A->isRowForm) swap_row_col_form(A);
   if(B->isRowForm) swap_row_col_form(B);
 
-  if(A->rows != B->cols) {
-    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->cols, A->rows, B->cols, B->rows);
+  // NxK * KxM
+  if(A->cols != B->rows) {
+    printf("Invalid matrix multiplication of %dx%d * %dx%d\n", A->rows, A->cols, B->rows, B->cols);
     return NULL;
   }
 
   // make the new matrix
-  mat_t* C = malloc(sizeof(*C));
-  C->cols = A->cols;
-  C->rows = B->rows;
-  C->isRowForm = true;
-
-  C->data = malloc(sizeof(int32_t*)*C->rows);
-
-  for(int row = 0; row < C->rows; row++) {
-    C->data[row] = malloc(sizeof(int32_t)*C->cols);
-    for(int col = 0; col < C->cols; col++) {
-      C->data[row][col] = 0;
-
-      // A->rows == B->cols
-      for(int k = 0; k < A->rows; k++) {
-        C->data[row][col] += A->data[row][k] * B->data[col][k];
+  mat_t* C = mat_alloc(A->rows, B->cols, true);
+
+  int K = A->cols;
+  bool vnni = __builtin_cpu_supports("avxvnni");
+  bool aUnsigned = true;
+  width_t width = choose_width(mat_range(A), mat_range(B), K, vnni, &aUnsigned);
+
+  dot4_t dot4 = (width == WIDTH_INT32 ? dot4_int32 :
+                 width == WIDTH_INT16 ? dot4_int16 :
+                 vnni ? dot4_int8_vnni : dot4_int8);
+  size_t size = (width == WIDTH_INT8 ? 1 : width == WIDTH_INT16 ? 2 : 4);
+  size_t ld = KPAD(K);
+
+  // rows of A and cols of B are both contiguous along k now
+  char* pa = pack(A, width);
+  char* pb = pack(B, width);
+
+  // the unsigned int8 operand has to be the one broadcast against the 4 others
+  char* outer = (aUnsigned ? pa : pb);
+  char* inner = (aUnsigned ? pb : pa);
+  int nOuter = (aUnsigned ? C->rows : C->cols);
+  int nInner = (aUnsigned ? C->cols : C->rows);
+
+  int32_t out[4];
+  for(int i = 0; i < nOuter; i++) {
+    for(int j = 0; j < nInner; j += 4) {
+      dot4(outer + i*ld*size, inner + j*ld*size, ld, ld, out);
+
+      for(int jj = j; jj < j+4 && jj < nInner; jj++) {
+        if(aUnsigned) MAT_VEC(C, i)[jj] = out[jj-j];
+        else MAT_VEC(C, jj)[i] = out[jj-j];
       }
     }
   }
 
+  free(pa);
+  free(pb);
+
   return C;
 }
 
@@ -226,40 +439,76 @@ mat_t* mul(mat_t* A, mat_t* B)
 
 
   __attribute__((no_instrument_function))
-void mat_print(mat_t* mat)
+static void print_row(out_t* out, void* ctx, int row)
 {
-  if(mat->isRowForm) {
-    for(int row = 0; row < mat->rows; row++) {
-      for(int col = 0; col < mat->cols; col++) {
-        printf("%d ", mat->data[row][col]);
-      }
-      printf("\n");
-    }
-  }
-  else {
-    for(int row = 0; row < mat->rows; row++) {
-      for(int col = 0; col < mat->cols; col++) {
-        printf("%d ", mat->data[col][row]);
-      }
-      printf("\n");
-    }
+  mat_t* mat = ctx;
+  for(int col = 0; col < mat->cols; col++) {
+    out_int(out, MAT_AT(mat, row, col));
+    out_char(out, ' ');
   }
+  out_char(out, '\n');
+}
 
+  __attribute__((no_instrument_function))
+void mat_print(mat_t* mat)
+{
+  out_t out;
+  out_init(&out, STDOUT_FILENO, OUT_BUF_SIZE);
+  out_rows(&out, mat->rows, print_row, mat, 12 * (size_t)mat->cols);
+  out_close(&out);
 }
 
   __attribute__((no_instrument_function))
 bool debug(info_t* info, mat_t* C)
 {
-  if(info->debug->isRowForm != C->isRowForm) swap_row_col_form(C);
-  int N = (C->isRowForm ? C->rows:C->cols); 
-  int M = (C->isRowForm ? C->cols:C->rows); 
+  if(info->debug->rows != C->rows || info->debug->cols != C->cols) return false;
 
-  for(int i = 0; i < N; i++) {
-    for(int j = 0; j < M; j++) {
-      if(info->debug->data[i][j] != C->data[i][j]) return false;
+  for(int row = 0; row < C->rows; row++) {
+    for(int col = 0; col < C->cols; col++) {
+      if(MAT_AT(info->debug, row, col) != MAT_AT(C, row, col)) return false;
     }
   }
 
   return true;
 }
 
+// Freivalds' check: compare A(Br) with Cr for random r, O(rounds * n^2).
+// uint32 arithmetic wraps exactly like the int32 kernels, so the comparison
+// is exact; a wrong C slips through one round with probability at most 1/2.
+__attribute__((no_instrument_function))
+static void matvec_u32(mat_t* M, const uint32_t* x, uint32_t* y)
+{
+  memset(y, 0, sizeof(uint32_t) * M->rows);
+  for(int row = 0; row < M->rows; row++) {
+    for(int col = 0; col < M->cols; col++) {
+      y[row] += (uint32_t)MAT_AT(M, row, col) * x[col];
+    }
+  }
+}
+
+  __attribute__((no_instrument_function))
+bool verify(mat_t* A, mat_t* B, mat_t* C, int rounds)
+{
+  if(C == NULL || C->rows != A->rows || C->cols != B->cols) return false;
+
+  uint32_t* r = malloc(sizeof(uint32_t) * B->cols);
+  uint32_t* br = malloc(sizeof(uint32_t) * B->rows);
+  uint32_t* abr = malloc(sizeof(uint32_t) * A->rows);
+  uint32_t* cr = malloc(sizeof(uint32_t) * C->rows);
+
+  srand(time(NULL));
+  bool passed = true;
+  for(int round = 0; round < rounds && passed; round++) {
+    for(int j = 0; j < B->cols; j++) r[j] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+    matvec_u32(B, r, br);
+    matvec_u32(A, br, abr);
+    matvec_u32(C, r, cr);
+
+    passed = memcmp(abr, cr, sizeof(uint32_t) * C->rows) == 0;
+  }
+
+  free(r); free(br); free(abr); free(cr);
+
+  return passed;
+}
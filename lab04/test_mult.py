@@ -0,0 +1,508 @@
+import pytest
+
+import random
+import re
+import struct
+import subprocess
+
+PROGRAMS = ['./matrixrow', './matrixcol', './matrixrow256', './standard_mult']
+
+CASES = [('p0a.txt', 'p0b.txt', 'p0d.txt'),
+         ('p3a.txt', 'p3b.txt', 'p3d.txt'),
+         ('p4a256.txt', 'p4b256.txt', 'p4d256.txt'),
+         ('p4a512.txt', 'p4b512.txt', 'p4d512.txt')]
+
+def read(fn):
+  with open(fn, 'r') as fh:
+    return [[int(x) for x in line.split()] for line in fh.read().strip().split('\n')[1:]]
+
+@pytest.mark.parametrize('prog', PROGRAMS)
+@pytest.mark.parametrize('a,b,d', CASES)
+def test_debug(prog, a, b, d):
+  result = subprocess.run([prog, a, b, d], capture_output=True, text=True)
+
+  assert result.stdout.strip() == 'passed'
+
+@pytest.mark.parametrize('prog', PROGRAMS)
+def test_print(prog):
+  result = subprocess.run([prog, 'p3a.txt', 'p3b.txt'], capture_output=True, text=True)
+
+  actual = [[int(x) for x in line.split()] for line in result.stdout.strip().split('\n')]
+
+  assert actual == read('p3d.txt')
+
+@pytest.mark.parametrize('form', ['row', 'col'])
+def test_binary(tmp_path, form):
+  for name in ['p4a256', 'p4b256', 'p4d256']:
+    subprocess.run(['./matconv', name + '.txt', str(tmp_path / (name + '.bin')), form], check=True)
+
+  result = subprocess.run(['./matrixrow256'] + [str(tmp_path / (name + '.bin')) for name in ['p4a256', 'p4b256', 'p4d256']],
+                          capture_output=True, text=True)
+  assert result.stdout.strip() == 'passed'
+
+  subprocess.run(['./matconv', str(tmp_path / 'p4d256.bin'), str(tmp_path / 'p4d256.txt')], check=True)
+  assert read(str(tmp_path / 'p4d256.txt')) == read('p4d256.txt')
+
+# rows, cols, ld: each passes every check but one of the shape checks
+@pytest.mark.parametrize('rows,cols,ld', [(0, 16, 16), (2, 0, 16), (2, 4096, 16), (2, 20, 20)])
+def test_matbin_bad_header(tmp_path, rows, cols, ld):
+  header = struct.pack('<4sIIIiiiIQ24x', b'MATB', 1, 1, 1, rows, cols, ld, 64, 4 * ld * rows)
+  path = tmp_path / 'bad.bin'
+  path.write_bytes(header + bytes(4 * ld * rows))
+
+  result = subprocess.run(['./matconv', str(path), str(tmp_path / 'bad.txt')], capture_output=True, text=True)
+  assert result.returncode == 1
+  assert 'is not a float matrix' in result.stderr
+
+def test_matbin_round_trip(tmp_path):
+  rng = random.Random(30)
+  rows, cols, ld = 3, 5, 16
+  values = [1.5, -2.75, 3e9, 0.1, -0.0, 1e-7] + [rng.uniform(-1e6, 1e6) for _ in range(rows * cols - 6)]
+  data = b''.join(struct.pack(f'<{cols}f', *values[r * cols:(r + 1) * cols]) + bytes(4 * (ld - cols)) for r in range(rows))
+  original = struct.pack('<4sIIIiiiIQ24x', b'MATB', 1, 1, 1, rows, cols, ld, 64, len(data)) + data
+  (tmp_path / 'a.bin').write_bytes(original)
+
+  subprocess.run(['./matconv', str(tmp_path / 'a.bin'), str(tmp_path / 'a.txt')], check=True)
+  subprocess.run(['./matconv', str(tmp_path / 'a.txt'), str(tmp_path / 'b.bin')], check=True)
+
+  # every float back bit for bit, the -0 included
+  assert (tmp_path / 'b.bin').read_bytes() == original
+  assert (tmp_path / 'a.txt').read_text().split('\n')[1].split() == ['1.5', '-2.75', '3e+09', '0.1', '-0']
+
+@pytest.mark.parametrize('prog', PROGRAMS)
+def test_verify(prog):
+  result = subprocess.run([prog, '--verify', '--rounds=2', 'p4a512.txt', 'p4b512.txt'], capture_output=True, text=True)
+
+  assert result.stdout.strip() == 'passed'
+
+# n x m into m x n, and n x n in place, with every element distinct and the
+# padding past each vector checked untouched
+TRANSPOSE_CHECK = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "transpose.h"
+
+#define PAD 0xdeadbeefu
+
+int main(int argc, char* argv[]) {
+  int n = atoi(argv[1]), m = atoi(argv[2]), lds = atoi(argv[3]), ldd = atoi(argv[4]);
+
+  uint32_t* src = malloc(sizeof(uint32_t) * n * lds);
+  uint32_t* dst = malloc(sizeof(uint32_t) * m * ldd);
+  for(int i = 0; i < n * lds; i++) src[i] = (i % lds < m ? (uint32_t)i : PAD);
+  for(int i = 0; i < m * ldd; i++) dst[i] = PAD;
+  transpose(src, lds, dst, ldd, n, m);
+  for(int j = 0; j < m; j++) {
+    for(int i = 0; i < ldd; i++) {
+      uint32_t want = (i < n ? src[(size_t)i*lds + j] : PAD);
+      if(dst[(size_t)j*ldd + i] != want) {
+        printf("transpose: [%d][%d] is %u, not %u\n", j, i, dst[(size_t)j*ldd + i], want);
+        return 1;
+      }
+    }
+  }
+
+  // n x n in place, with ld lds
+  if(n == m) {
+    for(int i = 0; i < n * lds; i++) src[i] = (i % lds < n ? (uint32_t)i : PAD);
+    transpose_inplace(src, lds, n);
+    for(int i = 0; i < n; i++) {
+      for(int j = 0; j < lds; j++) {
+        uint32_t want = (j < n ? (uint32_t)(j*lds + i) : PAD);
+        if(src[(size_t)i*lds + j] != want) {
+          printf("transpose_inplace: [%d][%d] is %u, not %u\n", i, j, src[(size_t)i*lds + j], want);
+          return 1;
+        }
+      }
+    }
+  }
+
+  printf("passed\n");
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def transpose_check(tmp_path_factory):
+  subprocess.run(['make', 'libmat.a'], check=True, capture_output=True)
+
+  src = tmp_path_factory.mktemp('transpose') / 'transpose_check.c'
+  src.write_text(TRANSPOSE_CHECK)
+  exe = src.with_suffix('')
+  subprocess.run(['gcc', '-O2', '-I.', str(src), '-o', str(exe), '-L.', '-lmat'], check=True)
+  return exe
+
+# sizes around the 8x8 kernel and the 32x32 tiles, odd lds
+@pytest.mark.parametrize('n,m,lds,ldd', [(1, 1, 1, 1), (7, 7, 9, 11), (8, 8, 8, 8), (9, 9, 13, 9), (33, 33, 35, 37),
+                                         (70, 70, 71, 73), (100, 100, 101, 100), (13, 40, 41, 15), (65, 17, 19, 67)])
+def test_transpose(transpose_check, n, m, lds, ldd):
+  result = subprocess.run([str(transpose_check), str(n), str(m), str(lds), str(ldd)], capture_output=True, text=True)
+
+  assert result.stdout.strip() == 'passed'
+
+# C = A * B with C[row][col] then moved by delta: a wrong product to hand the check
+VERIFY_CHECK = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include "mat.h"
+#include "verify.h"
+
+int main(int argc, char* argv[]) {
+  verify_t opts;
+  argc = parse_verify_args(argc, argv, &opts);
+  mat_t* A = read_file(argv[1], true);
+  mat_t* B = read_file(argv[2], false);
+  mat_t* C = mat_mul(A, B, true);
+  MAT_AT(C, atoi(argv[3]), atoi(argv[4])) += atof(argv[5]);
+
+  printf(verify_mul(A, B, C, &opts) ? "passed\n" : "failed\n");
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def verify_check(tmp_path_factory):
+  subprocess.run(['make', 'libmat.a'], check=True, capture_output=True)
+
+  src = tmp_path_factory.mktemp('verify') / 'verify_check.c'
+  src.write_text(VERIFY_CHECK)
+  exe = src.with_suffix('')
+  subprocess.run(['gcc', '-O2', '-pthread', '-I.', '-I../common', str(src), '-o', str(exe), '-L.', '-lmat', '-lm'], check=True)
+  return exe
+
+# off by more than rounding allows for: entries of p3 are tens, of p4 512 around a million
+@pytest.mark.parametrize('a,b,row,col,delta', [('p3a.txt', 'p3b.txt', 2, 1, 1.0),
+                                               ('p4a512.txt', 'p4b512.txt', 200, 37, -1e6),
+                                               ('p4a512.txt', 'p4b512.txt', 511, 511, 1e6)])
+def test_verify_wrong(verify_check, a, b, row, col, delta):
+  # a few rounds, so an r[col] near 0 cannot hide the error
+  result = subprocess.run([str(verify_check), '--verify', '--rounds=3', a, b, str(row), str(col), str(delta)],
+                          capture_output=True, text=True)
+
+  assert result.stdout.strip() == 'failed'
+  assert f'verify: row {row} is off by' in result.stderr
+
+  unchanged = subprocess.run([str(verify_check), '--verify', '--rounds=3', a, b, '0', '0', '0'], capture_output=True, text=True)
+  assert unchanged.stdout.strip() == 'passed'
+
+def write_real(path, rows, cols, rng):
+  path.write_text(f'{rows} {cols}\n' + ''.join(' '.join(repr(rng.uniform(-1, 1)) for _ in range(cols)) + '\n' for _ in range(rows)))
+
+# real valued inputs round, so a fraction of an ulp is tighter than any float product
+# (standard_mult multiplies integers exactly and takes no tolerance)
+@pytest.mark.parametrize('prog', PROGRAMS[:3])
+def test_verify_ulps(tmp_path, prog):
+  rng = random.Random(31)
+  write_real(tmp_path / 'a.txt', 64, 300, rng)
+  write_real(tmp_path / 'b.txt', 300, 48, rng)
+  args = [str(tmp_path / 'a.txt'), str(tmp_path / 'b.txt')]
+
+  result = subprocess.run([prog, '--verify'] + args, capture_output=True, text=True)
+  assert result.stdout.strip() == 'passed'
+
+  result = subprocess.run([prog, '--verify', '--ulps=0.001'] + args, capture_output=True, text=True)
+  assert result.stdout.strip() == 'failed'
+  assert 'is off by' in result.stderr
+
+  result = subprocess.run([prog, '--verify', '--tol=0'] + args, capture_output=True, text=True)
+  assert result.stdout.strip() == 'failed'
+
+def test_batch(tmp_path):
+  subprocess.run(['./matconv', 'p4b256.txt', str(tmp_path / 'p4b256.bin'), 'col'], check=True)
+
+  jobs = [('p3a.txt', 'p3b.txt', 'p3.txt', 'p3d.txt'),
+          ('p4a512.txt', 'p4b512.txt', 'p512.bin', 'p4d512.txt'),
+          ('p4a256.txt', str(tmp_path / 'p4b256.bin'), 'p256.txt', 'p4d256.txt'),
+          ('p0a.txt', 'p0b.txt', 'p0.txt', 'p0d.txt')]
+  manifest = tmp_path / 'manifest'
+  manifest.write_text('# a b out\n' + ''.join(f'{a} {b} {tmp_path / out}\n' for a, b, out, _ in jobs) + '\n')
+
+  result = subprocess.run(['./batch', '--verify', str(manifest)], capture_output=True, text=True)
+  assert result.returncode == 0
+  assert result.stdout.strip().split('\n')[-1] == 'passed'
+
+  subprocess.run(['./matconv', str(tmp_path / 'p512.bin'), str(tmp_path / 'p512.txt')], check=True)
+  for _, _, out, d in jobs:
+    assert read(str(tmp_path / out.replace('.bin', '.txt'))) == read(d)
+
+def test_batch_cache(tmp_path):
+  rng = random.Random(34)
+  write_random(tmp_path / 'a.txt', 64, 256, 1.0, rng)
+  for i in range(5):
+    write_random(tmp_path / f'b{i}.txt', 256, 256, 1.0, rng)
+
+  # a packed 256 x 256 B is 256 kB, so 1 MB holds four: b4 pushes out b0,
+  # and b0 coming back pushes out b1
+  order = [0, 0, 1, 2, 3, 4, 0, 4]
+  for cache in ['1', '0']:
+    manifest = tmp_path / f'manifest{cache}'
+    manifest.write_text(''.join(f'{tmp_path / "a.txt"} {tmp_path / f"b{b}.txt"} {tmp_path / f"c{cache}_{j}.txt"}\n'
+                                for j, b in enumerate(order)))
+    result = subprocess.run(['./batch', '--verify', f'--cache-mb={cache}', str(manifest)], capture_output=True, text=True)
+    assert result.returncode == 0
+    assert result.stdout.strip().split('\n')[-1] == 'passed'
+    if cache == '1':
+      assert 'B cache: 2 hits, 6 misses, 2 evictions' in result.stdout
+
+  # the packed path gives what the unpacked one does
+  for j in range(len(order)):
+    assert (tmp_path / f'c1_{j}.txt').read_text() == (tmp_path / f'c0_{j}.txt').read_text()
+
+def test_chain(tmp_path):
+  rng = random.Random(35)
+  shapes = [(30, 2), (2, 40), (40, 3), (3, 25), (25, 1), (1, 17)]
+
+  mats, paths = [], []
+  for i, (rows, cols) in enumerate(shapes):
+    mat = [[rng.randint(-3, 3) for _ in range(cols)] for _ in range(rows)]
+    path = tmp_path / f'a{i}.txt'
+    path.write_text(f'{rows} {cols}\n' + ''.join(' '.join(map(str, row)) + '\n' for row in mat))
+    mats.append(mat)
+    paths.append(str(path))
+
+  expected = mats[0]
+  for mat in mats[1:]:
+    expected = [[sum(a * b for a, b in zip(row, col)) for col in zip(*mat)] for row in expected]
+
+  result = subprocess.run(['./chain', '--plan'] + paths, capture_output=True, text=True)
+  assert result.returncode == 0
+  assert [[int(x) for x in line.split()] for line in result.stdout.strip().split('\n')] == expected
+
+  # left to right builds 30 x n intermediates, the plan should not
+  cost = re.search(r'(\d+) flops \(left to right: (\d+)', result.stderr)
+  assert int(cost.group(1)) < int(cost.group(2))
+
+def write_random(path, rows, cols, density, rng):
+  mat = [[rng.randint(-9, 9) if rng.random() < density else 0 for _ in range(cols)] for _ in range(rows)]
+  path.write_text(f'{rows} {cols}\n' + ''.join(' '.join(map(str, row)) + '\n' for row in mat))
+  return mat
+
+@pytest.mark.parametrize('prog', PROGRAMS)
+@pytest.mark.parametrize('densityA,densityB', [(0.05, 1.0), (1.0, 0.05), (0.03, 0.08)])
+def test_sparse(tmp_path, prog, densityA, densityB):
+  rng = random.Random(36)
+  A = write_random(tmp_path / 'a.txt', 60, 80, densityA, rng)
+  B = write_random(tmp_path / 'b.txt', 80, 50, densityB, rng)
+  D = [[sum(a * b for a, b in zip(row, col)) for col in zip(*B)] for row in A]
+  (tmp_path / 'd.txt').write_text('60 50\n' + ''.join(' '.join(map(str, row)) + '\n' for row in D))
+
+  result = subprocess.run([prog] + [str(tmp_path / name) for name in ['a.txt', 'b.txt', 'd.txt']], capture_output=True, text=True)
+  assert result.stdout.strip() == 'passed'
+
+# value ranges of A and B, and K, that make standard_mult pick each element width
+@pytest.mark.parametrize('rangeA,rangeB,K', [
+  ((0, 255), (-128, 127), 40),        # u8 x s8: int8 with vnni, int16 without (vpmaddubsw would saturate)
+  ((-1000, 1000), (-3000, 3000), 70), # past int8: vpmaddwd
+  ((-40000, 40000), (-9, 9), 50),     # past int16: int32
+  ((-20000, 20000), (-20000, 20000), 16), # int16 values, but K products could overflow an int32 lane: int32
+])
+def test_int_widths(tmp_path, rangeA, rangeB, K):
+  rng = random.Random(26)
+  A = [[rng.randint(*rangeA) for _ in range(K)] for _ in range(23)]
+  B = [[rng.randint(*rangeB) for _ in range(19)] for _ in range(K)]
+  D = [[sum(a * b for a, b in zip(row, col)) for col in zip(*B)] for row in A]
+  assert all(-2**31 <= d < 2**31 for row in D for d in row)
+
+  for name, mat in [('a.txt', A), ('b.txt', B), ('d.txt', D)]:
+    (tmp_path / name).write_text(f'{len(mat)} {len(mat[0])}\n' + ''.join(' '.join(map(str, row)) + '\n' for row in mat))
+
+  result = subprocess.run(['./standard_mult'] + [str(tmp_path / name) for name in ['a.txt', 'b.txt', 'd.txt']], capture_output=True, text=True)
+  assert result.stdout.strip() == 'passed'
+
+@pytest.mark.parametrize('dtype', ['--fp16', '--bf16'])
+def test_half(dtype):
+  result = subprocess.run(['./halfmul', dtype, '--report', 'p4a512.txt', 'p4b512.txt', 'p4d512.txt'], capture_output=True, text=True)
+
+  # inputs up to 99 and sums accumulated in fp32: nothing to round
+  assert result.stdout.strip() == 'passed'
+  assert 'C: max abs error 0,' in result.stderr
+
+@pytest.mark.parametrize('dtype,expected', [('--fp16', 2047 * 3), ('--bf16', 2048 * 3)])
+def test_half_rounding(tmp_path, dtype, expected):
+  # 2047 needs 11 significant bits: half keeps all of them, bfloat16 only 8
+  (tmp_path / 'a.txt').write_text('1 1\n2047\n')
+  (tmp_path / 'b.txt').write_text('1 1\n3\n')
+  result = subprocess.run(['./halfmul', dtype, str(tmp_path / 'a.txt'), str(tmp_path / 'b.txt')], capture_output=True, text=True)
+
+  assert int(result.stdout.split()[0]) == expected
+
+@pytest.mark.parametrize('formA,formB', [('row', 'row'), ('col', 'row'), ('row', 'col')])
+def test_ooc(tmp_path, formA, formB):
+  subprocess.run(['./matconv', 'p4a512.txt', str(tmp_path / 'a.bin'), formA], check=True)
+  subprocess.run(['./matconv', 'p4b512.txt', str(tmp_path / 'b.bin'), formB], check=True)
+
+  # A, B and C are 3 MB together, a quarter of that is resident
+  result = subprocess.run(['./ooc', '--mem=768K'] + [str(tmp_path / name) for name in ['a.bin', 'b.bin', 'c.bin']],
+                          capture_output=True, text=True)
+  assert result.returncode == 0
+
+  resident, cap = map(int, re.search(r'(\d+) of (\d+) bytes resident', result.stdout).groups())
+  assert resident <= cap == 768 * 1024
+
+  subprocess.run(['./matconv', str(tmp_path / 'c.bin'), str(tmp_path / 'c.txt')], check=True)
+  assert read(str(tmp_path / 'c.txt')) == read('p4d512.txt')
+
+@pytest.mark.parametrize('shape', [['4', '4', '4'], ['32', '32', '32'], ['5', '7', '3'], ['1', '20', '9']])
+def test_small_batch(shape):
+  # a count that leaves the last interleaved group partly empty
+  result = subprocess.run(['./smallmul', '--count=1001'] + shape, capture_output=True, text=True)
+
+  assert result.stdout.strip().split('\n')[-1] == 'passed'
+
+# sgemm against a double precision loop: small integers, so every sum is exact
+SGEMM_CHECK = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sgemm.h"
+
+int main(int argc, char* argv[]) {
+  char ta = argv[1][0], tb = argv[2][0];
+  int M = atoi(argv[3]), N = atoi(argv[4]), K = atoi(argv[5]);
+  float alpha = atof(argv[6]), beta = atof(argv[7]);
+  int lda = atoi(argv[8]), ldb = atoi(argv[9]), ldc = atoi(argv[10]);
+  int colsA = (ta == 'N' ? K : M), colsB = (tb == 'N' ? N : K);
+
+  float* A = malloc(sizeof(float) * lda * colsA);
+  float* B = malloc(sizeof(float) * ldb * colsB);
+  float* C = malloc(sizeof(float) * ldc * N);
+  srand(29);
+  for(int i = 0; i < lda * colsA; i++) A[i] = rand() % 7 - 3;
+  for(int i = 0; i < ldb * colsB; i++) B[i] = rand() % 7 - 3;
+  // the padding below each column of C is a NaN nobody may touch
+  for(int j = 0; j < N; j++) for(int i = 0; i < ldc; i++) C[j*ldc + i] = (i < M ? rand() % 7 - 3 : NAN);
+
+  double* D = malloc(sizeof(double) * M * N);
+  for(int j = 0; j < N; j++) {
+    for(int i = 0; i < M; i++) {
+      double sum = 0.0;
+      for(int k = 0; k < K; k++) sum += (double)(ta == 'N' ? A[k*lda + i] : A[i*lda + k]) * (tb == 'N' ? B[j*ldb + k] : B[k*ldb + j]);
+      D[j*M + i] = alpha * sum + beta * C[j*ldc + i];
+    }
+  }
+
+  sgemm(ta, tb, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+
+  for(int j = 0; j < N; j++) {
+    for(int i = 0; i < ldc; i++) {
+      if(i < M ? C[j*ldc + i] != (float)D[j*M + i] : !isnan(C[j*ldc + i])) {
+        printf("C(%d, %d) is %g\n", i, j, C[j*ldc + i]);
+        return 1;
+      }
+    }
+  }
+  printf("passed\n");
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def sgemm_check(tmp_path_factory):
+  subprocess.run(['make', 'libmat.a'], check=True, capture_output=True)
+
+  src = tmp_path_factory.mktemp('sgemm') / 'sgemm_check.c'
+  src.write_text(SGEMM_CHECK)
+  exe = src.with_suffix('')
+  subprocess.run(['gcc', '-O2', '-pthread', '-I.', str(src), '-o', str(exe), '-L.', '-lmat', '-lm'], check=True)
+  return exe
+
+@pytest.mark.parametrize('ta', ['N', 'T'])
+@pytest.mark.parametrize('tb', ['N', 'T'])
+@pytest.mark.parametrize('M,N,K', [(37, 29, 41), (200, 150, 300)])
+def test_sgemm_blas(sgemm_check, ta, tb, M, N, K):
+  # padded lds, alpha != 1 and beta != 0 accumulating into C
+  lda = (M if ta == 'N' else K) + 3
+  ldb = (K if tb == 'N' else N) + 5
+  args = [ta, tb, M, N, K, 2.5, -1.5, lda, ldb, M + 7]
+  result = subprocess.run([str(sgemm_check)] + [str(a) for a in args], capture_output=True, text=True)
+
+  assert result.stdout.strip() == 'passed'
+
+# every class on a 3 x 2 grid, then each packed combination against plain sgemm
+SGEMM_PACKED_CHECK = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sgemm.h"
+
+int main(int argc, char* argv[]) {
+  int M = atoi(argv[1]), N = atoi(argv[2]), K = atoi(argv[3]);
+  for(int c = 0; c < SGEMM_CLASSES; c++) {
+    sgemm_config_t cfg = sgemm_default_config();
+    cfg.gridM = 3;
+    cfg.gridN = 2;
+    sgemm_set_config(c, cfg);
+  }
+
+  float* A = malloc(sizeof(float) * M * K);
+  float* B = malloc(sizeof(float) * K * N);
+  float* C = malloc(sizeof(float) * M * N);
+  float* D = malloc(sizeof(float) * M * N);
+  srand(40);
+  for(int i = 0; i < M * K; i++) A[i] = rand() / (float)RAND_MAX - 0.5f;
+  for(int i = 0; i < K * N; i++) B[i] = rand() / (float)RAND_MAX - 0.5f;
+
+  sgemm('N', 'T', M, N, K, 1.5f, A, M, B, N, 0.0f, C, M);
+  sgemm_pack_t* pa = sgemm_pack_a('N', M, K, A, M);
+  sgemm_pack_t* pb = sgemm_pack_b('T', K, N, B, N);
+  const sgemm_pack_t* packs[3][2] = { { pa, NULL }, { NULL, pb }, { pa, pb } };
+
+  for(int p = 0; p < 3; p++) {
+    memset(D, 0, sizeof(float) * M * N);
+    sgemm_packed('N', 'T', M, N, K, 1.5f, A, M, packs[p][0], B, N, packs[p][1], 0.0f, D, M);
+    if(memcmp(C, D, sizeof(float) * M * N) != 0) {
+      printf("packed %c%c differs\n", packs[p][0] ? 'A' : '-', packs[p][1] ? 'B' : '-');
+      return 1;
+    }
+  }
+  printf("passed\n");
+  return 0;
+}
+'''
+
+# the same kc and the same kernel per tile, so the threaded packed product is bit for bit the plain one
+@pytest.mark.parametrize('M,N,K', [(300, 200, 150), (97, 301, 257)])
+def test_sgemm_packed_grid(sgemm_check, M, N, K):
+  src = sgemm_check.parent / 'sgemm_packed_check.c'
+  src.write_text(SGEMM_PACKED_CHECK)
+  exe = src.with_suffix('')
+  subprocess.run(['gcc', '-O2', '-pthread', '-I.', str(src), '-o', str(exe), '-L.', '-lmat', '-lm'], check=True)
+
+  result = subprocess.run([str(exe), str(M), str(N), str(K)], capture_output=True, text=True)
+  assert result.stdout.strip() == 'passed'
+
+
+@pytest.mark.parametrize('ta,tb,lda,ldb,ldc', [('N', 'N', 9, 12, 10), ('T', 'N', 11, 12, 10), ('N', 'N', 10, 11, 10),
+                                               ('N', 'T', 10, 10, 10), ('N', 'N', 10, 12, 9)])
+def test_sgemm_bad_ld(sgemm_check, ta, tb, lda, ldb, ldc):
+  # M, N, K = 10, 11, 12: each case has one ld below its stored height
+  result = subprocess.run([str(sgemm_check), ta, tb, '10', '11', '12', '1', '0', str(lda), str(ldb), str(ldc)],
+                          capture_output=True, text=True)
+
+  assert 'sgemm: invalid arguments' in result.stderr
+
+def test_autotune(tmp_path):
+  config = tmp_path / 'sgemm.conf'
+  other = 'large mc=96 kc=128 nc=1020 kernel=16x6 grid=1x1 cpu=some other host\n'
+  config.write_text(other)
+
+  result = subprocess.run(['./autotune', '--quick', str(config)], capture_output=True, text=True)
+  assert result.returncode == 0
+
+  lines = config.read_text().split('\n')
+  assert other.strip() in lines
+  assert sorted(line.split()[0] for line in lines if line and 'some other host' not in line) == ['large', 'medium', 'small']
+
+@pytest.mark.parametrize('shape', [['300', '200', '150'], ['900', '700', '800']])
+def test_sgemm_config(tmp_path, shape):
+  # odd blocking, the unrolled kernel and a thread grid, on every class this host could look up
+  with open('/proc/cpuinfo') as fh:
+    model = next(line.split(':', 1)[1].strip() for line in fh if line.startswith('model name'))
+  config = tmp_path / 'sgemm.conf'
+  config.write_text(''.join(f'{cls} mc=32 kc=40 nc=30 kernel=16x6u4 grid=2x3 cpu={model}\n' for cls in ['small', 'medium', 'large'])
+                    + 'large mc=33 kc=40 nc=30 kernel=16x6 grid=1x1 cpu=mc is not a multiple of 16\n')
+
+  result = subprocess.run(['./smallmul', '--count=2'] + shape, capture_output=True, text=True, env={'SGEMM_CONFIG': str(config)})
+  assert result.stdout.strip().split('\n')[-1] == 'passed'
+  assert 'sgemm.conf:4: ignoring invalid sgemm config line' in result.stderr
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include "transpose.h"
+
+// 32x32 tiles of 4 bytes: a source and a destination tile together fit in L1
+#define TILE 32
+
+__attribute__((no_instrument_function))
+static inline void load8x8(const float* src, size_t ld, __m256 r[8])
+{
+  for(int i = 0; i < 8; i++) r[i] = _mm256_loadu_ps(&src[i*ld]);
+}
+
+__attribute__((no_instrument_function))
+static inline void store8x8(float* dst, size_t ld, __m256 r[8])
+{
+  for(int i = 0; i < 8; i++) _mm256_storeu_ps(&dst[i*ld], r[i]);
+}
+
+// transpose 8 rows of 8 in registers: interleave pairs, then quads, then 128-bit halves
+__attribute__((no_instrument_function))
+static inline void transpose8x8(__m256 r[8])
+{
+  __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+  __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+  __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+  __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+  __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+  __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+  __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+  __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+  __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+  r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+  r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+  r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+  r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+  r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+  r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+  r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+  r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+__attribute__((no_instrument_function))
+void transpose(const void* src, int lds, void* dst, int ldd, int n, int m)
+{
+  // only ever moved, never used as floats, so int32_t goes through here too
+  const float* s = src;
+  float* d = dst;
+  int n8 = n & ~7, m8 = m & ~7;
+
+  for(int ib = 0; ib < n8; ib += TILE) {
+    for(int jb = 0; jb < m8; jb += TILE) {
+      for(int i = ib; i < ib+TILE && i < n8; i += 8) {
+        for(int j = jb; j < jb+TILE && j < m8; j += 8) {
+          __m256 r[8];
+          load8x8(&s[(size_t)i*lds + j], lds, r);
+          transpose8x8(r);
+          store8x8(&d[(size_t)j*ldd + i], ldd, r);
+        }
+      }
+    }
+  }
+
+  // leftover strips that do not fill an 8x8 block
+  const uint32_t* su = src;
+  uint32_t* du = dst;
+  for(int i = 0; i < n; i++) {
+    for(int j = (i < n8 ? m8 : 0); j < m; j++) {
+      du[(size_t)j*ldd + i] = su[(size_t)i*lds + j];
+    }
+  }
+}
+
+__attribute__((no_instrument_function))
+void transpose_inplace(void* data, int ld, int n)
+{
+  float* a = data;
+  int n8 = n & ~7;
+
+  // swap block (i, j) with block (j, i), each transposed on the way through registers
+  for(int ib = 0; ib < n8; ib += TILE) {
+    for(int jb = 0; jb <= ib; jb += TILE) {
+      for(int i = ib; i < ib+TILE && i < n8; i += 8) {
+        for(int j = jb; j < jb+TILE && j <= i; j += 8) {
+          __m256 upper[8], lower[8];
+          load8x8(&a[(size_t)i*ld + j], ld, lower);
+          transpose8x8(lower);
+
+          if(i == j) {
+            store8x8(&a[(size_t)i*ld + j], ld, lower);
+            continue;
+          }
+
+          load8x8(&a[(size_t)j*ld + i], ld, upper);
+          transpose8x8(upper);
+          store8x8(&a[(size_t)j*ld + i], ld, lower);
+          store8x8(&a[(size_t)i*ld + j], ld, upper);
+        }
+      }
+    }
+  }
+
+  // the last n % 8 rows against everything before them
+  uint32_t* au = data;
+  for(int i = n8; i < n; i++) {
+    for(int j = 0; j < i; j++) {
+      uint32_t tmp = au[(size_t)i*ld + j];
+      au[(size_t)i*ld + j] = au[(size_t)j*ld + i];
+      au[(size_t)j*ld + i] = tmp;
+    }
+  }
+}
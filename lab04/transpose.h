@@ -0,0 +1,16 @@
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+/**
+ * Cache-blocked transposes of 32-bit elements (float or int32_t) built on an
+ * 8x8 AVX in-register kernel. Matrices are given as vectors of contiguous
+ * elements with a leading dimension, like mat_t.
+ */
+
+// src: n vectors of m elements (src[i*lds + j]) -> dst: m vectors of n elements (dst[j*ldd + i])
+void transpose(const void* src, int lds, void* dst, int ldd, int n, int m);
+
+// transposes the n x n matrix in data without a second buffer
+void transpose_inplace(void* data, int ld, int n);
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <time.h>
+#include <immintrin.h>
+
+#include "verify.h"
+
+__attribute__((no_instrument_function))
+int parse_verify_args(int argc, char* argv[], verify_t* opts)
+{
+  opts->enabled = false;
+  opts->rounds = 1;
+  opts->tol = -1.0;
+
+  int kept = 1;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--verify") == 0) opts->enabled = true;
+    else if(strncmp(argv[i], "--rounds=", 9) == 0) opts->rounds = atoi(argv[i] + 9);
+    else if(strncmp(argv[i], "--tol=", 6) == 0) opts->tol = atof(argv[i] + 6);
+    else if(strncmp(argv[i], "--ulps=", 7) == 0) opts->tol = atof(argv[i] + 7) * FLT_EPSILON;
+    else argv[kept++] = argv[i];
+  }
+  argv[kept] = NULL;
+
+  if(opts->rounds < 1) opts->rounds = 1;
+
+  return kept;
+}
+
+// splitmix64: seeded from the clock so a bad C cannot line up with fixed vectors
+__attribute__((no_instrument_function))
+static uint64_t next_rand(uint64_t* state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// y = M x and, when yabs is given, yabs = |M| xabs. doubles throughout so the
+// check adds no error of its own, 4 lanes at a time with the floats widened
+__attribute__((no_instrument_function))
+static void matvec(mat_t* M, const double* x, const double* xabs, double* y, double* yabs)
+{
+  const __m256d signBit = _mm256_set1_pd(-0.0);
+
+  if(M->isRowForm) {
+    for(int row = 0; row < M->rows; row++) {
+      const float* m = MAT_VEC(M, row);
+      // two accumulators each so the FMA latency chains overlap
+      __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+      __m256d abs0 = _mm256_setzero_pd(), abs1 = _mm256_setzero_pd();
+      int col = 0;
+      for(; col + 8 <= M->cols; col += 8) {
+        __m256d v0 = _mm256_cvtps_pd(_mm_loadu_ps(&m[col]));
+        __m256d v1 = _mm256_cvtps_pd(_mm_loadu_ps(&m[col + 4]));
+        sum0 = _mm256_fmadd_pd(v0, _mm256_loadu_pd(&x[col]), sum0);
+        sum1 = _mm256_fmadd_pd(v1, _mm256_loadu_pd(&x[col + 4]), sum1);
+        if(yabs) {
+          abs0 = _mm256_fmadd_pd(_mm256_andnot_pd(signBit, v0), _mm256_loadu_pd(&xabs[col]), abs0);
+          abs1 = _mm256_fmadd_pd(_mm256_andnot_pd(signBit, v1), _mm256_loadu_pd(&xabs[col + 4]), abs1);
+        }
+      }
+
+      double s[4], sa[4];
+      _mm256_storeu_pd(s, _mm256_add_pd(sum0, sum1));
+      _mm256_storeu_pd(sa, _mm256_add_pd(abs0, abs1));
+      double total = s[0] + s[1] + s[2] + s[3], totalAbs = sa[0] + sa[1] + sa[2] + sa[3];
+      for(; col < M->cols; col++) {
+        total += m[col] * x[col];
+        if(yabs) totalAbs += fabs(m[col]) * xabs[col];
+      }
+
+      y[row] = total;
+      if(yabs) yabs[row] = totalAbs;
+    }
+  }
+  else {
+    memset(y, 0, sizeof(double) * M->rows);
+    if(yabs) memset(yabs, 0, sizeof(double) * M->rows);
+
+    for(int col = 0; col < M->cols; col++) {
+      const float* m = MAT_VEC(M, col);
+      __m256d xc = _mm256_set1_pd(x[col]), xa = _mm256_set1_pd(yabs ? xabs[col] : 0.0);
+      int row = 0;
+      for(; row + 4 <= M->rows; row += 4) {
+        __m256d v = _mm256_cvtps_pd(_mm_loadu_ps(&m[row]));
+        _mm256_storeu_pd(&y[row], _mm256_fmadd_pd(v, xc, _mm256_loadu_pd(&y[row])));
+        if(yabs) _mm256_storeu_pd(&yabs[row], _mm256_fmadd_pd(_mm256_andnot_pd(signBit, v), xa, _mm256_loadu_pd(&yabs[row])));
+      }
+      for(; row < M->rows; row++) {
+        y[row] += m[row] * x[col];
+        if(yabs) yabs[row] += fabs(m[row]) * xabs[col];
+      }
+    }
+  }
+}
+
+__attribute__((no_instrument_function))
+bool verify_mul(mat_t* A, mat_t* B, mat_t* C, verify_t* opts)
+{
+  if(C == NULL || A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) return false;
+
+  int M = A->rows, K = A->cols, N = B->cols;
+  double tol = (opts->tol >= 0.0 ? opts->tol : 4.0 * sqrt(K) * FLT_EPSILON);
+  uint64_t seed = (uint64_t)time(NULL) ^ (uintptr_t)C;
+
+  double* r = malloc(sizeof(double) * N);
+  double* rabs = malloc(sizeof(double) * N);
+  double* br = malloc(sizeof(double) * K);
+  double* brabs = malloc(sizeof(double) * K);
+  double* abr = malloc(sizeof(double) * M);
+  double* scale = malloc(sizeof(double) * M);
+  double* cr = malloc(sizeof(double) * M);
+
+  bool passed = true;
+  for(int round = 0; round < opts->rounds && passed; round++) {
+    for(int j = 0; j < N; j++) {
+      // uniform in [-1, 1)
+      r[j] = (double)(next_rand(&seed) >> 11) * 0x1.0p-52 - 1.0;
+      rabs[j] = fabs(r[j]);
+    }
+
+    matvec(B, r, rabs, br, brabs);
+    matvec(A, br, brabs, abr, scale);
+    matvec(C, r, NULL, cr, NULL);
+
+    for(int i = 0; i < M; i++) {
+      double err = fabs(abr[i] - cr[i]);
+      // written so a NaN in C fails too
+      if(!(err <= tol * scale[i])) {
+        fprintf(stderr, "verify: row %d is off by %g (allowed %g)\n", i, err, tol * scale[i]);
+        passed = false;
+        break;
+      }
+    }
+  }
+
+  free(r); free(rabs); free(br); free(brabs);
+  free(abr); free(scale); free(cr);
+
+  return passed;
+}
@@ -0,0 +1,34 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdbool.h>
+
+#include "mat.h"
+
+/**
+ * Freivalds' check of C == A * B without a reference matrix: for random
+ * vectors r compare A(Br) with Cr, O(rounds * n^2) instead of O(n^3).
+ *
+ * Kernels that reorder the summation (blocking, FMA, ...) give slightly
+ * different floats, so row i passes when
+ *   |A(Br) - Cr|_i <= tol * (|A| |B| |r|)_i
+ * The default tol, 4 * sqrt(K) * FLT_EPSILON, covers the rounding a length K
+ * dot product picks up in practice; widen it with --tol/--ulps for kernels
+ * that lose more (Strassen). Errors smaller than that are, by design, not
+ * told apart from rounding.
+ *
+ * r is real valued, so one round already misses a wrong C with probability 0
+ * in exact arithmetic; extra rounds guard against unlucky cancellation.
+ */
+
+typedef struct {
+  bool enabled;
+  int rounds;  // random vectors to try
+  double tol;  // relative tolerance, < 0 means 4 * sqrt(K) * FLT_EPSILON
+} verify_t;
+
+// pulls --verify, --rounds=<k>, --tol=<relative> and --ulps=<n> out of argv, returns the new argc
+int parse_verify_args(int argc, char* argv[], verify_t* opts);
+bool verify_mul(mat_t* A, mat_t* B, mat_t* C, verify_t* opts);
+
+#endif
@@ -1,101 +1,268 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <inttypes.h>
 #include <math.h>
 #include <time.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <immintrin.h>
 
 // pthread library
 #include <pthread.h>
 
-// information to pass the thread
+#include "mc.h"
+
+/*
+ * No thread shares a random generator: rand() takes a lock inside glibc, so
+ * threads sharing it ran slower than one thread, and drew correlated numbers.
+ *
+ * The generator is xoshiro256++, four of them side by side in the 64-bit
+ * lanes of AVX2 registers. The points are drawn CHUNK at a time, and chunk c
+ * starts its four streams from Philox words keyed by (seed, c) (see mc.h),
+ * never from a thread's state: whichever thread runs a chunk draws the same
+ * points, so a --seed gives the same pi on any number of threads. (Streams
+ * seeded per thread by jump-ahead could not: the points would follow the
+ * split.) The chunks' integer hit counts are added up in chunk order.
+ *
+ * Two steps of the four streams give 8 x and 8 y coordinates (the top 24 bits
+ * of each 32-bit half, exact as floats); one compare tests all 8 points and
+ * the popcount of its mask is the number of hits.
+ *
+ * With --stderr=<target> the number of points is not fixed: threads take
+ * chunks off a shared atomic counter and publish their hit counts after
+ * each, and the main thread, working chunks too, stops everyone
+ * once the standard error of the estimate is down to the target. A hit is a
+ * Bernoulli trial, so after n points with a fraction p of hits the estimate
+ * 4p has standard error 4 * sqrt(p(1 - p) / n). Where it stops depends on
+ * timing, so this mode is not reproducible.
+ */
+
+#define LANES 4
+#define CHUNK (1 << 16)
+// too few points can show p = 0 or 1 and so a standard error of 0
+#define MIN_ADAPTIVE_PTS (1 << 20)
+
 typedef struct {
-  int id, num;
-  double* pi; // pointer to an array that will contain each pi value
-} thread_info;
+  __m256i s0, s1, s2, s3; // lane k of each is stream k's state
+} rng_t;
 
-int in_circle(double x, double y) {
-    if (y*y <= 1 - x*x) return 1;
+// information to pass the thread; each on its own cache line, the counters
+// are read by the main thread while the thread is running
+typedef struct {
+  int id;
+  _Atomic uint64_t hits, done; // published after every chunk in adaptive mode
+} __attribute__((aligned(64))) thread_info;
 
-    return 0;
+static uint64_t seed;
+
+// adaptive mode
+static _Atomic uint64_t next_chunk;
+static atomic_bool stop;
+
+// the four streams of chunk c
+void seed_chunk(uint64_t c, rng_t* rng) {
+    uint64_t words[4 * LANES];
+    mc_block_words(seed, c, words, 4 * LANES);
+
+    // an all zero xoshiro state would stay zero, and has odds 2^-256
+    rng->s0 = _mm256_loadu_si256((__m256i*)&words[0]);
+    rng->s1 = _mm256_loadu_si256((__m256i*)&words[4]);
+    rng->s2 = _mm256_loadu_si256((__m256i*)&words[8]);
+    rng->s3 = _mm256_loadu_si256((__m256i*)&words[12]);
 }
 
+#define ROTL4(x, k) _mm256_or_si256(_mm256_slli_epi64((x), (k)), _mm256_srli_epi64((x), 64 - (k)))
 
-double approx_pi(int n) {
-    int count = 0;
+// one xoshiro256++ step of all four streams
+__attribute__((no_instrument_function))
+static inline __m256i next4(rng_t* r) {
+    __m256i result = _mm256_add_epi64(ROTL4(_mm256_add_epi64(r->s0, r->s3), 23), r->s0);
+    __m256i t = _mm256_slli_epi64(r->s1, 17);
 
-    for (int i = 0; i < n; i++) {
-        double x = (double) rand() / (double) RAND_MAX;
-        double y = (double) rand() / (double) RAND_MAX;
+    r->s2 = _mm256_xor_si256(r->s2, r->s0);
+    r->s3 = _mm256_xor_si256(r->s3, r->s1);
+    r->s1 = _mm256_xor_si256(r->s1, r->s2);
+    r->s0 = _mm256_xor_si256(r->s0, r->s3);
+    r->s2 = _mm256_xor_si256(r->s2, t);
+    r->s3 = ROTL4(r->s3, 45);
 
-        count += in_circle(x,y);
-    }
+    return result;
+}
+
+// 8 uniform floats in [0, 1) from the top 24 bits of each 32-bit half
+__attribute__((no_instrument_function))
+static inline __m256 unit8(__m256i bits) {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits, 8)), _mm256_set1_ps(1.0f / (1 << 24)));
+}
+
+// mask of which of the next 8 points fall in the quarter circle
+__attribute__((no_instrument_function))
+static inline int in_circle8(rng_t* rng) {
+    __m256 x = unit8(next4(rng));
+    __m256 y = unit8(next4(rng));
+    __m256 r2 = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+
+    return _mm256_movemask_ps(_mm256_cmp_ps(r2, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+}
+
+// number of n random points in the unit square that land in the quarter circle
+uint64_t count_hits(rng_t* rng, uint64_t n) {
+    uint64_t count = 0;
+
+    uint64_t i = 0;
+    for (; i + 8 <= n; i += 8) count += __builtin_popcount(in_circle8(rng));
+
+    if (i < n) count += __builtin_popcount(in_circle8(rng) & ((1 << (n - i)) - 1));
+
+    return count;
+}
 
-    return 4.0* (double) count / (double) n;
+// fixed mode: chunk c of n points
+typedef struct {
+  uint64_t n;
+} fixed_job;
+
+void fixed_chunk(uint64_t c, void* ctx, mc_tally_t* out) {
+  uint64_t n = ((fixed_job*)ctx)->n;
+  uint64_t num = (n - c * CHUNK < CHUNK ? n - c * CHUNK : CHUNK);
+
+  rng_t rng;
+  seed_chunk(c, &rng);
+  out->count = num;
+  out->sum = (double) count_hits(&rng, num);
 }
 
-// parallel function
-void* parallelized(void* arg) {
+// adaptive mode: chunk by chunk until told to stop
+void* adaptive(void* arg) {
   thread_info* info = (thread_info*)arg;
-  info->pi[info->id] = approx_pi(info->num);
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    rng_t rng;
+    seed_chunk(atomic_fetch_add_explicit(&next_chunk, 1, memory_order_relaxed), &rng);
+    uint64_t hits = count_hits(&rng, CHUNK);
+
+    // hits first: a reader that sees the new done also sees these hits
+    atomic_fetch_add_explicit(&info->hits, hits, memory_order_relaxed);
+    atomic_fetch_add_explicit(&info->done, CHUNK, memory_order_release);
+  }
 
   return NULL;
 }
 
+// standard error of 4 * hits / n
+double std_error(uint64_t hits, uint64_t n) {
+    double p = (double) hits / (double) n;
+    return 4.0 * sqrt(p * (1.0 - p) / (double) n);
+}
+
+// the main thread's share of adaptive mode: work, and check the totals between chunks
+void adaptive_main(thread_info* info, int num_threads, double target) {
+  while (true) {
+    rng_t rng;
+    seed_chunk(atomic_fetch_add_explicit(&next_chunk, 1, memory_order_relaxed), &rng);
+    info[0].hits += count_hits(&rng, CHUNK);
+    info[0].done += CHUNK;
+
+    uint64_t hits = 0, n = 0;
+    for (int i = 0; i < num_threads; i++) {
+      n += atomic_load_explicit(&info[i].done, memory_order_acquire);
+      hits += atomic_load_explicit(&info[i].hits, memory_order_relaxed);
+    }
+
+    // hits may run ahead of done by a chunk in flight, which only matters this early
+    if (n >= MIN_ADAPTIVE_PTS && std_error(hits, n) <= target) break;
+  }
+
+  atomic_store_explicit(&stop, true, memory_order_relaxed);
+}
+
 int main(int argc, char* argv[]) {
-    /* 
+    /*
     input:
-        num_pts (int)
+        --seed=<n> (optional) - default: the time
+        num_pts (int), or --stderr=<target standard error>
         num_threads (int) - default: 1
     */
     int num_threads = 1;
 
-    if (argc != 2){
-        printf("useage: %s <num_pts> <num_threads: default=1>\n", argv[0]);
+    int arg = 1;
+    seed = time(NULL);
+    if (arg < argc && strncmp(argv[arg], "--seed=", 7) == 0) seed = strtoull(argv[arg++] + 7, NULL, 10);
+
+    if (argc - arg != 1 && argc - arg != 2){
+        printf("useage: %s <?--seed=n> <num_pts | --stderr=target> <num_threads: default=1>\n", argv[0]);
+        exit(0);
+    }
+    if (argc - arg == 2) num_threads = atoi(argv[arg + 1]);
+    if (num_threads < 1) num_threads = 1;
+
+    double target = 0.0;
+    uint64_t n = 0;
+    if (strncmp(argv[arg], "--stderr=", 9) == 0) {
+        target = atof(argv[arg] + 9);
+        if (target <= 0.0) {
+            fprintf(stderr, "Error: the target standard error must be positive\n");
+            exit(1);
+        }
     }
-    if (argc == 3) num_threads = atoi(argv[2]);
-    
-    int n = atoi(argv[1]);
-
-    srand(time(NULL));
-
-    // start threads
-    pthread_t threads [num_threads];
-    thread_info info[num_threads];
-    double* pis = malloc(sizeof(double)*num_threads);
-
-    // create and run threads
-    int leftover = n % num_threads;
-    for(int i = 0; i < num_threads; i++) {
-      info[i].id = i;
-      info[i].num = n / num_threads;
-      info[i].pi = pis;
-
-      if(pthread_create(&threads[i], NULL, parallelized, (void*)&info[i]) != 0) {
-        fprintf(stderr, "Error: thread %d not created \n", i);
-        exit(1);
-      }
+    else {
+        n = strtoull(argv[arg], NULL, 10);
+        if (n == 0) {
+            fprintf(stderr, "Error: num_pts must be positive\n");
+            exit(1);
+        }
     }
-   
-    // do work while threads are working
-    double sum = approx_pi(leftover);
 
-    // join all of the threads
-    for(int i = 0; i < num_threads; i++) {
-      pthread_join(threads[i], NULL);
+    struct timespec start, stop_time;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t hits = 0;
+    if (target == 0.0) {
+        // the same chunks and the same integer sums whatever the thread count
+        fixed_job job = { n };
+        hits = (uint64_t) mc_run_blocks((n + CHUNK - 1) / CHUNK, num_threads, fixed_chunk, &job).sum;
     }
+    else {
+        // start threads
+        pthread_t threads [num_threads];
+        thread_info* info = aligned_alloc(64, sizeof(thread_info) * num_threads);
+        memset(info, 0, sizeof(thread_info) * num_threads);
+
+        for(int i = 1; i < num_threads; i++) {
+          info[i].id = i;
+          if(pthread_create(&threads[i], NULL, adaptive, (void*)&info[i]) != 0) {
+            fprintf(stderr, "Error: thread %d not created \n", i);
+            exit(1);
+          }
+        }
 
-    // average all of the pi's
+        // the main thread works chunks too, and decides when to stop
+        adaptive_main(info, num_threads, target);
 
-    for(int i = 0; i < num_threads; i++) {
-      sum += pis[i];
+        // join all of the threads
+        for(int i = 1; i < num_threads; i++) {
+          pthread_join(threads[i], NULL);
+        }
+
+        // including the chunks finished after the stop
+        for(int i = 0; i < num_threads; i++) {
+          hits += info[i].hits;
+          n += info[i].done;
+        }
+        free(info);
     }
 
-    free(pis);
+    clock_gettime(CLOCK_MONOTONIC, &stop_time);
+    double secs = (stop_time.tv_sec - start.tv_sec) + (stop_time.tv_nsec - start.tv_nsec) * 1e-9;
 
-    double pi = sum / (num_threads + (leftover > 0 ? 1 : 0));
+    double pi = 4.0 * (double) hits / (double) n;
 
     printf("pi: %f\n", pi);
+    printf("seed %" PRIu64 ", %" PRIu64 " hits of %" PRIu64 "\n", seed, hits, n);
+    if (target > 0.0) printf("standard error %.3g after %" PRIu64 " samples in %" PRIu64 " chunks\n", std_error(hits, n), n, next_chunk);
+    printf("%.3g samples/s on %d threads\n", n / secs, num_threads);
 
     return 0;
 }
-
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <string.h>
+
+#include "qmc.h"
+
+int in_circle(double x, double y) {
+    if (y*y <= 1 - x*x) return 1;
+
+    return 0;
+}
+
+// pi as the integral of 4 * in_circle over the unit square
+double quarter_circle(const double* p, void* ctx) {
+    return 4.0 * in_circle(p[0], p[1]);
+}
+
+int main(int argc, char* argv[]) {
+    /*
+    input:
+        --seed=<n> (optional) - default: the time
+        num_pts (int) - per replica
+        num_threads (int) - default: 1
+        num_replicas (int) - default: 16
+    */
+    int num_threads = 1, replicas = 16;
+
+    int arg = 1;
+    uint64_t seed = time(NULL);
+    if (arg < argc && strncmp(argv[arg], "--seed=", 7) == 0) seed = strtoull(argv[arg++] + 7, NULL, 10);
+
+    if (argc - arg < 1 || argc - arg > 3){
+        printf("useage: %s <?--seed=n> <num_pts per replica> <num_threads: default=1> <num_replicas: default=16>\n", argv[0]);
+        exit(0);
+    }
+    if (argc - arg >= 2) num_threads = atoi(argv[arg + 1]);
+    if (argc - arg == 3) replicas = atoi(argv[arg + 2]);
+
+    uint64_t n = strtoull(argv[arg], NULL, 10);
+
+    qmc_result_t res = qmc_integrate(quarter_circle, NULL, 2, n, replicas, num_threads, seed);
+
+    // what plain Monte Carlo would give with as many points: a hit is a Bernoulli trial
+    double p = M_PI / 4.0;
+    double mc_error = 4.0 * sqrt(p * (1.0 - p) / (double) res.points);
+
+    printf("pi: %f\n", res.estimate);
+    printf("seed %" PRIu64 ", estimate %.17g\n", seed, res.estimate);
+    printf("standard error %.3g from %d replicas of %" PRIu64 " points (plain MC: %.3g), actual error %.3g\n",
+           res.std_error, replicas, n, mc_error, fabs(res.estimate - M_PI));
+
+    return 0;
+}
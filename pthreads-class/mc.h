@@ -0,0 +1,151 @@
+#ifndef MC_H
+#define MC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+/*
+ * Reproducible parallel Monte Carlo.
+ *
+ * Two things made parallel runs differ: which random numbers a thread drew
+ * depended on how the work was split, and floating point sums depended on the
+ * order the threads finished in. Here neither depends on the thread count:
+ *  - the work is a fixed number of logical blocks, and the random numbers of
+ *    block b come from a counter-based generator (Philox4x32-10) keyed by
+ *    the seed with b as the counter, so any thread can run any block and draw
+ *    exactly the same numbers;
+ *  - the blocks are cut into at most MC_SEGMENTS runs of consecutive blocks,
+ *    a thread adds up the tallies of a run in block order, and the runs' sums
+ *    are added in a fixed pairwise tree over the run indices. The cuts depend
+ *    only on the number of blocks, so the additions are the same ones in the
+ *    same order however many threads took the runs, and memory is one tally
+ *    per run rather than per block.
+ * A seed then gives bit-identical results on 1 thread or 64, which is what
+ * comparing two builds of the same computation needs.
+ *
+ * A program supplies an mc_block_fn, draws its numbers with mc_block_words()
+ * and hands both to mc_run_blocks().
+ */
+
+#define MC_SEGMENTS 1024
+
+typedef struct {
+  uint64_t count;   // samples
+  double sum, sumSq;
+} mc_tally_t;
+
+// fills out with block's results; must depend only on block (and ctx)
+typedef void (*mc_block_fn)(uint64_t block, void* ctx, mc_tally_t* out);
+
+// ------------------------ Philox4x32-10 ------------------------
+
+__attribute__((no_instrument_function))
+static inline uint32_t mc_mulhilo(uint32_t a, uint32_t b, uint32_t* hi) {
+  uint64_t p = (uint64_t)a * b;
+  *hi = (uint32_t)(p >> 32);
+  return (uint32_t)p;
+}
+
+// ctr <- Philox4x32-10(ctr) under key (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+__attribute__((no_instrument_function))
+static void mc_philox(uint32_t ctr[4], uint64_t key) {
+  uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+
+  for (int round = 0; round < 10; round++) {
+    uint32_t hi0, hi1;
+    uint32_t lo0 = mc_mulhilo(0xD2511F53, ctr[0], &hi0);
+    uint32_t lo1 = mc_mulhilo(0xCD9E8D57, ctr[2], &hi1);
+    uint32_t next[4] = { hi1 ^ ctr[1] ^ k0, lo1, hi0 ^ ctr[3] ^ k1, lo0 };
+    for (int i = 0; i < 4; i++) ctr[i] = next[i];
+
+    k0 += 0x9E3779B9;
+    k1 += 0xBB67AE85;
+  }
+}
+
+// word i (of as many as needed) of block's random stream under seed
+__attribute__((no_instrument_function))
+static void mc_block_words(uint64_t seed, uint64_t block, uint64_t* out, int n) {
+  for (int i = 0; i < n; i += 2) {
+    uint32_t ctr[4] = { (uint32_t)block, (uint32_t)(block >> 32), (uint32_t)(i / 2), 0 };
+    mc_philox(ctr, seed);
+    out[i] = (uint64_t)ctr[0] | (uint64_t)ctr[1] << 32;
+    if (i + 1 < n) out[i + 1] = (uint64_t)ctr[2] | (uint64_t)ctr[3] << 32;
+  }
+}
+
+// ------------------------ blocks ------------------------
+
+__attribute__((no_instrument_function))
+static mc_tally_t mc_add(mc_tally_t a, mc_tally_t b) {
+  return (mc_tally_t){ a.count + b.count, a.sum + b.sum, a.sumSq + b.sumSq };
+}
+
+// sum of t[0..n) as a balanced tree: the same additions in the same order every time
+__attribute__((no_instrument_function))
+static mc_tally_t mc_reduce(const mc_tally_t* t, uint64_t n) {
+  if (n == 0) return (mc_tally_t){ 0, 0.0, 0.0 };
+  if (n == 1) return t[0];
+  return mc_add(mc_reduce(t, n / 2), mc_reduce(t + n / 2, n - n / 2));
+}
+
+typedef struct {
+  mc_block_fn fn;
+  void* ctx;
+  uint64_t blocks, perSegment, segments;
+  _Atomic uint64_t next; // next segment nobody has taken
+  mc_tally_t* tallies;   // one per segment
+} mc_job_t;
+
+__attribute__((no_instrument_function))
+static void* mc_worker(void* arg) {
+  mc_job_t* job = (mc_job_t*)arg;
+
+  // segments are taken one at a time, so threads that get ahead take more
+  uint64_t s;
+  while ((s = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed)) < job->segments) {
+    uint64_t first = s * job->perSegment;
+    uint64_t last = (job->blocks - first < job->perSegment ? job->blocks : first + job->perSegment);
+
+    mc_tally_t sum = { 0, 0.0, 0.0 };
+    for (uint64_t b = first; b < last; b++) {
+      mc_tally_t t = { 0, 0.0, 0.0 };
+      job->fn(b, job->ctx, &t);
+      sum = mc_add(sum, t);
+    }
+    job->tallies[s] = sum;
+  }
+
+  return NULL;
+}
+
+// runs fn on blocks [0, blocks) over threads, returns the sum of their tallies
+__attribute__((no_instrument_function))
+static mc_tally_t mc_run_blocks(uint64_t blocks, int threads, mc_block_fn fn, void* ctx) {
+  mc_job_t job = { .fn = fn, .ctx = ctx, .blocks = blocks };
+  job.perSegment = (blocks + MC_SEGMENTS - 1) / MC_SEGMENTS;
+  if (job.perSegment == 0) job.perSegment = 1;
+  job.segments = (blocks + job.perSegment - 1) / job.perSegment;
+  job.tallies = calloc(job.segments > 0 ? job.segments : 1, sizeof(mc_tally_t));
+  atomic_init(&job.next, 0);
+
+  pthread_t tids[threads > 1 ? threads : 1];
+  for (int t = 1; t < threads; t++) {
+    if (pthread_create(&tids[t], NULL, mc_worker, &job) != 0) {
+      fprintf(stderr, "Error: thread %d not created \n", t);
+      exit(1);
+    }
+  }
+  mc_worker(&job);
+  for (int t = 1; t < threads; t++) pthread_join(tids[t], NULL);
+
+  mc_tally_t total = mc_reduce(job.tallies, job.segments);
+  free(job.tallies);
+  return total;
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef QMC_H
+#define QMC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <pthread.h>
+
+/*
+ * Quasi-Monte Carlo integration over the unit hypercube [0, 1)^dims.
+ *
+ * Random points leave gaps and clumps, so plain Monte Carlo error falls like
+ * 1/sqrt(n). The points of a Sobol sequence fill the cube evenly by design,
+ * and for integrands of bounded variation the error falls close to 1/n
+ * instead: about the same accuracy from the square root as many points.
+ *
+ * Point i of dimension d is the XOR of the direction numbers v[d][b] for the
+ * set bits b of gray(i) = i ^ (i >> 1). Consecutive Gray codes differ in one
+ * bit, the lowest zero bit of i, so each next point costs one XOR per
+ * dimension. The indices are cut into QMC_SEGMENTS blocks whatever the
+ * thread count, and threads take whole blocks: the first point of a block is
+ * built from gray(start) and the rest are stepped from it. Each block's sum
+ * is kept and the blocks are added in index order, so a seed gives the same
+ * bits on any number of threads.
+ *
+ * A Sobol sequence is deterministic and says nothing about its own error.
+ * Each replica therefore scrambles the direction numbers with a random lower
+ * triangular matrix and adds a random digital shift (Matousek's scrambling).
+ * Every replica is still a Sobol-quality point set, and each gives an
+ * independent unbiased estimate. Their spread gives the standard error.
+ *
+ * qmc_integrate() is the entry point: an integrand of up to QMC_MAX_DIMS
+ * coordinates, the points per replica, the replicas and the threads.
+ */
+
+#define QMC_MAX_DIMS 10
+#define QMC_BITS 32
+#define QMC_SEGMENTS 64
+
+typedef double (*qmc_integrand_t)(const double* x, void* ctx);
+
+typedef struct {
+  double estimate;  // mean over the replicas
+  double std_error; // standard deviation of the replica estimates / sqrt(replicas)
+  uint64_t points;  // in total, all replicas
+} qmc_result_t;
+
+// primitive polynomials and initial direction numbers for dimensions 2.. (Joe & Kuo, new-joe-kuo-6.21201)
+static const struct {
+  int s, a;
+  uint32_t m[5];
+} qmc_joe_kuo[QMC_MAX_DIMS - 1] = {
+  { 1, 0, { 1 } },
+  { 2, 1, { 1, 3 } },
+  { 3, 1, { 1, 3, 1 } },
+  { 3, 2, { 1, 1, 1 } },
+  { 4, 1, { 1, 1, 3, 3 } },
+  { 4, 4, { 1, 3, 5, 13 } },
+  { 5, 2, { 1, 1, 5, 5, 17 } },
+  { 5, 4, { 1, 1, 5, 5, 5 } },
+  { 5, 7, { 1, 1, 7, 11, 19 } },
+};
+
+// the unscrambled direction numbers of dims dimensions, v[d][b] for bit b of the index
+__attribute__((no_instrument_function))
+static void qmc_directions(int dims, uint32_t v[][QMC_BITS]) {
+  // first dimension: the van der Corput sequence
+  for (int b = 0; b < QMC_BITS; b++) v[0][b] = UINT32_C(1) << (QMC_BITS - 1 - b);
+
+  for (int d = 1; d < dims; d++) {
+    int s = qmc_joe_kuo[d - 1].s, a = qmc_joe_kuo[d - 1].a;
+    for (int b = 0; b < s && b < QMC_BITS; b++) v[d][b] = qmc_joe_kuo[d - 1].m[b] << (QMC_BITS - 1 - b);
+    for (int b = s; b < QMC_BITS; b++) {
+      v[d][b] = v[d][b - s] ^ (v[d][b - s] >> s);
+      for (int k = 1; k < s; k++) {
+        if ((a >> (s - 1 - k)) & 1) v[d][b] ^= v[d][b - k];
+      }
+    }
+  }
+}
+
+// splitmix64: seeds the scrambles from (seed, replica)
+__attribute__((no_instrument_function))
+static uint64_t qmc_mix(uint64_t* x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// v <- L v for a random unit lower triangular L over GF(2), bit 31 being the
+// first (most significant) digit; plus a random digital shift per dimension
+__attribute__((no_instrument_function))
+static void qmc_scramble(int dims, uint32_t v[][QMC_BITS], uint32_t shift[], uint64_t seed) {
+  for (int d = 0; d < dims; d++) {
+    // row r of L: a 1 on the diagonal and random digits before it
+    uint32_t L[QMC_BITS];
+    for (int r = 0; r < QMC_BITS; r++) {
+      uint32_t diag = UINT32_C(1) << (QMC_BITS - 1 - r);
+      uint32_t above = (r == 0 ? 0 : ~(uint32_t)0 << (QMC_BITS - r));
+      L[r] = ((uint32_t)qmc_mix(&seed) & above) | diag;
+    }
+
+    for (int b = 0; b < QMC_BITS; b++) {
+      uint32_t out = 0;
+      for (int r = 0; r < QMC_BITS; r++) {
+        if (__builtin_parity(L[r] & v[d][b])) out |= UINT32_C(1) << (QMC_BITS - 1 - r);
+      }
+      v[d][b] = out;
+    }
+
+    shift[d] = (uint32_t)qmc_mix(&seed);
+  }
+}
+
+typedef struct {
+  qmc_integrand_t f;
+  void* ctx;
+  int dims, replicas;
+  uint64_t n;
+  int thread, threads; // this thread takes blocks thread, thread + threads, ...
+  uint32_t (*v)[QMC_MAX_DIMS][QMC_BITS]; // per replica
+  uint32_t (*shift)[QMC_MAX_DIMS];
+  double* sums; // per block and replica, the sum of f over the block
+} qmc_block_t;
+
+__attribute__((no_instrument_function))
+static void* qmc_worker(void* arg) {
+  qmc_block_t* blk = (qmc_block_t*)arg;
+  uint32_t x[QMC_MAX_DIMS];
+  double p[QMC_MAX_DIMS];
+
+  for (int s = blk->thread; s < QMC_SEGMENTS; s += blk->threads) {
+    uint64_t start = blk->n * s / QMC_SEGMENTS, end = blk->n * (s + 1) / QMC_SEGMENTS;
+
+    for (int r = 0; r < blk->replicas; r++) {
+      uint32_t (*v)[QMC_BITS] = blk->v[r];
+      double sum = 0.0;
+      blk->sums[(size_t)s * blk->replicas + r] = 0.0;
+      if (start == end) continue;
+
+      // point start, from its Gray code
+      uint64_t gray = start ^ (start >> 1);
+      for (int d = 0; d < blk->dims; d++) {
+        x[d] = blk->shift[r][d];
+        for (int b = 0; b < QMC_BITS; b++) {
+          if ((gray >> b) & 1) x[d] ^= v[d][b];
+        }
+      }
+
+      for (uint64_t i = start; ; i++) {
+        for (int d = 0; d < blk->dims; d++) p[d] = x[d] * (1.0 / 4294967296.0);
+        sum += blk->f(p, blk->ctx);
+        if (i + 1 == end) break;
+
+        // gray(i + 1) flips bit ctz(i + 1) of gray(i)
+        int b = __builtin_ctzll(i + 1);
+        for (int d = 0; d < blk->dims; d++) x[d] ^= v[d][b];
+      }
+      blk->sums[(size_t)s * blk->replicas + r] = sum;
+    }
+  }
+
+  return NULL;
+}
+
+// integral of f over [0, 1)^dims from replicas scrambled copies of the first n Sobol points
+__attribute__((no_instrument_function))
+static qmc_result_t qmc_integrate(qmc_integrand_t f, void* ctx, int dims, uint64_t n, int replicas, int threads, uint64_t seed) {
+  if (dims < 1 || dims > QMC_MAX_DIMS || n == 0 || n > (UINT64_C(1) << QMC_BITS) || replicas < 2 || threads < 1) {
+    fprintf(stderr, "qmc_integrate: invalid arguments\n");
+    exit(1);
+  }
+
+  uint32_t (*v)[QMC_MAX_DIMS][QMC_BITS] = malloc(sizeof(*v) * replicas);
+  uint32_t (*shift)[QMC_MAX_DIMS] = malloc(sizeof(*shift) * replicas);
+  for (int r = 0; r < replicas; r++) {
+    uint64_t mixed = seed + (uint64_t)r * 0x632be59bd9b4e019;
+    qmc_directions(dims, v[r]);
+    qmc_scramble(dims, v[r], shift[r], qmc_mix(&mixed));
+  }
+
+  if (threads > QMC_SEGMENTS) threads = QMC_SEGMENTS;
+  pthread_t tids[threads];
+  qmc_block_t* blocks = malloc(sizeof(qmc_block_t) * threads);
+  double* sums = malloc(sizeof(double) * replicas * QMC_SEGMENTS);
+  for (int t = 0; t < threads; t++) {
+    blocks[t] = (qmc_block_t){ f, ctx, dims, replicas, n, t, threads, v, shift, sums };
+    if (t > 0 && pthread_create(&tids[t], NULL, qmc_worker, &blocks[t]) != 0) {
+      fprintf(stderr, "Error: thread %d not created \n", t);
+      exit(1);
+    }
+  }
+  qmc_worker(&blocks[0]);
+  for (int t = 1; t < threads; t++) pthread_join(tids[t], NULL);
+
+  // block order is fixed, so the sums come out the same every run
+  double mean = 0.0, sq = 0.0;
+  for (int r = 0; r < replicas; r++) {
+    double sum = 0.0;
+    for (int s = 0; s < QMC_SEGMENTS; s++) sum += sums[(size_t)s * replicas + r];
+    double est = sum / (double) n;
+
+    // Welford
+    double delta = est - mean;
+    mean += delta / (r + 1);
+    sq += delta * (est - mean);
+  }
+
+  free(sums);
+  free(blocks);
+  free(shift);
+  free(v);
+
+  return (qmc_result_t){ mean, sqrt(sq / (replicas - 1) / replicas), n * (uint64_t)replicas };
+}
+
+#endif
@@ -0,0 +1,145 @@
+import pytest
+
+import os
+import re
+import subprocess
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+def run_pi(points, threads, seed=7):
+  result = subprocess.run(['./approx_pi_parallel', '--seed=%d' % seed, str(points), str(threads)],
+                          capture_output=True, text=True, check=True)
+  hits, n = re.search(r'seed \d+, (\d+) hits of (\d+)', result.stdout).groups()
+  assert int(n) == points
+  return int(hits)
+
+# 1526 chunks, so two to a segment and a short last one
+@pytest.mark.parametrize('points', [1000, 5000123, 100000001])
+def test_pi_seed(points):
+  hits = run_pi(points, 1)
+
+  assert all(run_pi(points, threads) == hits for threads in (2, 3, 8))
+  assert abs(4.0 * hits / points - 3.14159) < 0.2
+
+def test_pi_seeds_differ():
+  assert run_pi(1000000, 2, seed=1) != run_pi(1000000, 2, seed=2)
+
+# --stderr: threads take chunks until the estimate is good enough
+@pytest.mark.parametrize('threads', [1, 3])
+def test_pi_adaptive(threads):
+  result = subprocess.run(['./approx_pi_parallel', '--stderr=1e-4', str(threads)], capture_output=True, text=True, check=True)
+  pi = float(re.search(r'pi: ([\d.]+)', result.stdout).group(1))
+  error, n = re.search(r'standard error ([\d.e+-]+) after (\d+) samples', result.stdout).groups()
+
+  assert float(error) <= 1e-4 and int(n) >= 1 << 20
+  assert abs(pi - 3.14159265) < 5 * 1e-4
+
+@pytest.mark.parametrize('target', ['0', '-1e-3'])
+def test_pi_adaptive_bad_target(target):
+  result = subprocess.run(['./approx_pi_parallel', '--stderr=' + target], capture_output=True, text=True)
+
+  assert result.returncode == 1
+  assert 'the target standard error must be positive' in result.stderr
+
+# double sums of mixed magnitudes, which any change in the order of the additions would round differently
+MC_SUM = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include "mc.h"
+
+void block(uint64_t b, void* ctx, mc_tally_t* out) {
+  uint64_t w[2];
+  mc_block_words(3, b, w, 2);
+  double x = (double)(w[0] >> 11) * 0x1.0p-53 * (w[1] % 7 == 0 ? 1e12 : 1e-3);
+  out->count = 1;
+  out->sum = x;
+  out->sumSq = x * x;
+}
+
+int main(int argc, char* argv[]) {
+  mc_tally_t t = mc_run_blocks(strtoull(argv[1], NULL, 10), atoi(argv[2]), block, NULL);
+  printf("%lu %a %a\n", (unsigned long)t.count, t.sum, t.sumSq);
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def mc_sum(tmp_path_factory):
+  src = tmp_path_factory.mktemp('mc') / 'mc_sum.c'
+  src.write_text(MC_SUM)
+  exe = src.with_suffix('')
+  subprocess.run(['gcc', '-O2', '-pthread', '-I' + HERE, str(src), '-o', str(exe)], check=True)
+  return exe
+
+@pytest.mark.parametrize('blocks', [1, 1000, 1024, 1025, 100003])
+def test_mc_bit_identical(mc_sum, blocks):
+  out = [subprocess.run([str(mc_sum), str(blocks), str(threads)], capture_output=True, text=True, check=True).stdout
+         for threads in (1, 2, 5, 16)]
+
+  assert out[0].split()[0] == str(blocks)
+  assert all(o == out[0] for o in out)
+
+def run_qmc(points, threads, seed):
+  result = subprocess.run(['./approx_pi_qmc', '--seed=%d' % seed, str(points), str(threads)],
+                          capture_output=True, text=True, check=True)
+  estimate = re.search(r'estimate (\S+)', result.stdout).group(1)
+  error = re.search(r'standard error (\S+) from', result.stdout).group(1)
+  return estimate, float(error)
+
+@pytest.mark.parametrize('seed', [1, 2, 3])
+def test_qmc_pi(seed):
+  estimate, error = run_qmc(100000, 2, seed)
+
+  assert 0 < error < 1e-3
+  assert abs(float(estimate) - 3.14159265358979) <= 4 * error
+
+def test_qmc_seed():
+  same = {run_qmc(50001, threads, 9) for threads in (1, 2, 5, 64)}
+
+  assert len(same) == 1
+
+# prod x_i over [0, 1)^3 is 1/8; the sums are real valued, so any change in
+# their order across thread counts would show in the last bits
+QMC_PROD = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include "qmc.h"
+
+double prod(const double* x, void* ctx) {
+  return x[0] * x[1] * x[2];
+}
+
+int main(int argc, char* argv[]) {
+  qmc_result_t res = qmc_integrate(prod, NULL, 3, strtoull(argv[1], NULL, 10), 16, atoi(argv[2]), 11);
+  printf("%a %a\n", res.estimate, res.std_error);
+  return 0;
+}
+'''
+
+@pytest.fixture(scope='module')
+def qmc_prod(tmp_path_factory):
+  src = tmp_path_factory.mktemp('qmc') / 'qmc_prod.c'
+  src.write_text(QMC_PROD)
+  exe = src.with_suffix('')
+  subprocess.run(['gcc', '-O2', '-pthread', '-I' + HERE, str(src), '-o', str(exe), '-lm'], check=True)
+  return exe
+
+def run_prod(qmc_prod, points, threads):
+  out = subprocess.run([str(qmc_prod), str(points), str(threads)], capture_output=True, text=True, check=True).stdout
+  return tuple(float.fromhex(x) for x in out.split())
+
+def test_qmc_converges(qmc_prod):
+  errors = []
+  for points in (1 << 8, 1 << 12, 1 << 16):
+    estimate, error = run_prod(qmc_prod, points, 2)
+    assert abs(estimate - 0.125) <= 4 * error
+    errors.append(error)
+
+  # close to 1/n: 16x the points, far more than 4x (plain Monte Carlo) less error
+  assert errors[1] < errors[0] / 8 and errors[2] < errors[1] / 8
+
+@pytest.mark.parametrize('points', [1000, 65536, 100003])
+def test_qmc_bit_identical(qmc_prod, points):
+  first = run_prod(qmc_prod, points, 1)
+
+  assert all(run_prod(qmc_prod, points, threads) == first for threads in (2, 3, 7, 64))